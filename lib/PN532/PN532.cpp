@@ -9,6 +9,8 @@
 #include "Arduino.h"
 #include "PN532.h"
 #include "PN532_debug.h"
+#include "PN532_trace.h"
+#include "PN532_crc.h"
 #include <string.h>
 
 #define HAL(func)   (_interface->func)
@@ -16,6 +18,10 @@
 PN532::PN532(PN532Interface &interface)
 {
     _interface = &interface;
+    _hostCRC = false;
+    _command = 0;
+    _commandStart = 0;
+    resetStats();
 }
 
 /**************************************************************************/
@@ -119,12 +125,12 @@ uint32_t PN532::getFirmwareVersion(void)
 
     pn532_packetbuffer[0] = PN532_COMMAND_GETFIRMWAREVERSION;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 1)) {
+    if (writeCommand(pn532_packetbuffer, 1)) {
         return 0;
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
     if (0 > status) {
         return 0;
     }
@@ -158,12 +164,12 @@ uint32_t PN532::readRegister(uint16_t reg)
     pn532_packetbuffer[1] = (reg >> 8) & 0xFF;
     pn532_packetbuffer[2] = reg & 0xFF;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 3)) {
+    if (writeCommand(pn532_packetbuffer, 3)) {
         return 0;
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
     if (0 > status) {
         return 0;
     }
@@ -193,12 +199,12 @@ uint32_t PN532::writeRegister(uint16_t reg, uint8_t val)
     pn532_packetbuffer[3] = val;
 
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 4)) {
+    if (writeCommand(pn532_packetbuffer, 4)) {
         return 0;
     }
 
     // read data packet
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    int16_t status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
     if (0 > status) {
         return 0;
     }
@@ -242,10 +248,10 @@ bool PN532::writeGPIO(uint8_t pinstate)
     DMSG("\n");
 
     // Send the WRITEGPIO command (0x0E)
-    if (HAL(writeCommand)(pn532_packetbuffer, 3))
+    if (writeCommand(pn532_packetbuffer, 3))
         return 0;
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
 }
 
 /**************************************************************************/
@@ -267,10 +273,10 @@ uint8_t PN532::readGPIO(void)
     pn532_packetbuffer[0] = PN532_COMMAND_READGPIO;
 
     // Send the READGPIO command (0x0C)
-    if (HAL(writeCommand)(pn532_packetbuffer, 1))
+    if (writeCommand(pn532_packetbuffer, 1))
         return 0x0;
 
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
 
     /* READGPIO response without prefix and suffix should be in the following format:
 
@@ -304,10 +310,10 @@ bool PN532::SAMConfig(void)
 
     DMSG("SAMConfig\n");
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 4))
+    if (writeCommand(pn532_packetbuffer, 4))
         return false;
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
 }
 
 /**************************************************************************/
@@ -328,10 +334,10 @@ bool PN532::setPassiveActivationRetries(uint8_t maxRetries)
     pn532_packetbuffer[3] = 0x01; // MxRtyPSL (default = 0x01)
     pn532_packetbuffer[4] = maxRetries;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 5))
+    if (writeCommand(pn532_packetbuffer, 5))
         return 0x0;  // no ACK
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
 }
 
 /**************************************************************************/
@@ -357,11 +363,134 @@ bool PN532::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
     pn532_packetbuffer[1] = 1;
     pn532_packetbuffer[2] = 0x00 | autoRFCA | rFOnOff;  
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 3)) {
+    if (writeCommand(pn532_packetbuffer, 3)) {
         return 0x0;  // command failed
     }
 
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+}
+
+/**************************************************************************/
+/*!
+    @brief  Writes a command through the interface and starts timing it
+*/
+/**************************************************************************/
+int8_t PN532::writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    _command = header[0];
+    _commandStart = micros();
+
+    int8_t status = HAL(writeCommand)(header, hlen, body, blen);
+    if (status) {
+        recordStats(status, true);
+    }
+    return status;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Reads the response of the command in flight and records its
+            latency or failure
+*/
+/**************************************************************************/
+int16_t PN532::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
+{
+    int16_t status = HAL(readResponse)(buf, len, timeout);
+    bool targetWait = PN532_COMMAND_INLISTPASSIVETARGET == _command || PN532_COMMAND_TGINITASTARGET == _command;
+    bool noTarget = PN532_TIMEOUT == status ||
+                    (PN532_COMMAND_INLISTPASSIVETARGET == _command && status > 0 && 0 == buf[0]);
+    if (targetWait && noTarget) {
+        PN532CommandStats *entry = statsEntry();
+        if (entry) {
+            entry->noTarget++;
+        }
+    } else {
+        recordStats(status, false);
+    }
+    return status;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Finds or adds the statistics of the command in flight
+
+    @returns  0 once the table is full, the command counts as untracked
+*/
+/**************************************************************************/
+PN532CommandStats *PN532::statsEntry()
+{
+    for (uint8_t i = 0; i < _stats.count; i++) {
+        if (_stats.commands[i].command == _command) {
+            return &_stats.commands[i];
+        }
+    }
+    if (_stats.count >= PN532_STATS_COMMANDS) {
+        _stats.untracked++;
+        return 0;
+    }
+    PN532CommandStats *entry = &_stats.commands[_stats.count++];
+    entry->command = _command;
+    return entry;
+}
+
+void PN532::recordStats(int16_t status, bool ack)
+{
+    PN532CommandStats *entry = statsEntry();
+    if (!entry) {
+        return;
+    }
+
+    switch (status) {
+    case PN532_TIMEOUT:
+        if (ack) {
+            entry->ackTimeout++;
+        } else {
+            entry->timeout++;
+        }
+        return;
+    case PN532_INVALID_ACK:
+        entry->invalidAck++;
+        return;
+    case PN532_INVALID_FRAME:
+        entry->invalidFrame++;
+        return;
+    case PN532_NO_SPACE:
+        entry->noSpace++;
+        return;
+    }
+    if (status < 0) {
+        entry->invalidFrame++;
+        return;
+    }
+
+    uint32_t elapsed = micros() - _commandStart;
+    uint32_t scaled = elapsed >> PN532_STATS_BUCKET_SHIFT;
+    uint8_t bucket = 0;
+    while (scaled && bucket < PN532_STATS_BUCKETS - 1) {
+        scaled >>= 1;
+        bucket++;
+    }
+
+    entry->success++;
+    entry->histogram[bucket]++;
+    if (elapsed > entry->maxMicros) {
+        entry->maxMicros = elapsed;
+    }
+}
+
+/**************************************************************************/
+/*!
+    @brief  Copies the command statistics collected since the last reset
+*/
+/**************************************************************************/
+void PN532::getStats(PN532Stats *stats) const
+{
+    memcpy(stats, &_stats, sizeof(_stats));
+}
+
+void PN532::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
 }
 
 /***** ISO14443A Commands ******/
@@ -375,22 +504,26 @@ bool PN532::setRFField(uint8_t autoRFCA, uint8_t rFOnOff)
                           with the card's UID (up to 7 bytes)
     @param  uidLength     Pointer to the variable that will hold the
                           length of the card's UID.
+    @param  timeout       Max time to wait for a target, in ms
+    @param  info          Optional, receives ATQA, SAK and the card type
+                          derived from them
 
     @returns 1 if everything executed properly, 0 for an error
 */
 /**************************************************************************/
-bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout)
+bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout, PN532TargetInfo *info)
 {
     pn532_packetbuffer[0] = PN532_COMMAND_INLISTPASSIVETARGET;
     pn532_packetbuffer[1] = 1;  // max 1 cards at once (we can set this to 2 later)
     pn532_packetbuffer[2] = cardbaudrate;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 3)) {
+    if (writeCommand(pn532_packetbuffer, 3)) {
         return 0x0;  // command failed
     }
+    _hostCRC = false;  // inlisting turns the CIU CRC back on
 
     // read data packet
-    if (HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout) < 0) {
+    if (readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout) < 0) {
         return 0x0;
     }
 
@@ -418,7 +551,12 @@ bool PN532::readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uid
     DMSG("SAK: 0x");  DMSG_HEX(pn532_packetbuffer[4]);
     DMSG("\n");
 
-    /* Card appears to be Mifare Classic */
+    if (info) {
+        info->atqa = sens_res;
+        info->sak = pn532_packetbuffer[4];
+        info->type = pn532_classify(sens_res, pn532_packetbuffer[4]);
+    }
+
     *uidLength = pn532_packetbuffer[5];
 
     for (uint8_t i = 0; i < pn532_packetbuffer[5]; i++) {
@@ -498,11 +636,11 @@ uint8_t PN532::mifareclassic_AuthenticateBlock (uint8_t *uid, uint8_t uidLen, ui
         pn532_packetbuffer[10 + i] = _uid[i];              /* 4 bytes card ID */
     }
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 10 + _uidLen))
+    if (writeCommand(pn532_packetbuffer, 10 + _uidLen))
         return 0;
 
     // Read the response packet
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
 
     // Check if the response is valid and we are authenticated???
     // for an auth success it should be bytes 5-7: 0xD5 0x41 0x00
@@ -540,12 +678,12 @@ uint8_t PN532::mifareclassic_ReadDataBlock (uint8_t blockNumber, uint8_t *data)
     pn532_packetbuffer[3] = blockNumber;            /* Block Number (0..63 for 1K, 0..255 for 4K) */
 
     /* Send the command */
-    if (HAL(writeCommand)(pn532_packetbuffer, 4)) {
+    if (writeCommand(pn532_packetbuffer, 4)) {
         return 0;
     }
 
     /* Read the response packet */
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
 
     /* If byte 8 isn't 0x00 we probably have an error */
     if (pn532_packetbuffer[0] != 0x00) {
@@ -581,12 +719,12 @@ uint8_t PN532::mifareclassic_WriteDataBlock (uint8_t blockNumber, uint8_t *data)
     memcpy (pn532_packetbuffer + 4, data, 16);        /* Data Payload */
 
     /* Send the command */
-    if (HAL(writeCommand)(pn532_packetbuffer, 20)) {
+    if (writeCommand(pn532_packetbuffer, 20)) {
         return 0;
     }
 
     /* Read the response packet */
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
 }
 
 /**************************************************************************/
@@ -722,12 +860,12 @@ uint8_t PN532::mifareultralight_ReadPage (uint8_t page, uint8_t *buffer)
     pn532_packetbuffer[3] = page;                /* Page Number (0..63 in most cases) */
 
     /* Send the command */
-    if (HAL(writeCommand)(pn532_packetbuffer, 4)) {
+    if (writeCommand(pn532_packetbuffer, 4)) {
         return 0;
     }
 
     /* Read the response packet */
-    HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
 
     /* If byte 8 isn't 0x00 we probably have an error */
     if (pn532_packetbuffer[0] == 0x00) {
@@ -766,12 +904,12 @@ uint8_t PN532::mifareultralight_WritePage (uint8_t page, uint8_t *buffer)
     memcpy (pn532_packetbuffer + 4, buffer, 4);          /* Data Payload */
 
     /* Send the command */
-    if (HAL(writeCommand)(pn532_packetbuffer, 8)) {
+    if (writeCommand(pn532_packetbuffer, 8)) {
         return 0;
     }
 
     /* Read the response packet */
-    return (0 < HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
+    return (0 < readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)));
 }
 
 /**************************************************************************/
@@ -791,17 +929,18 @@ bool PN532::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response,
     pn532_packetbuffer[0] = 0x40; // PN532_COMMAND_INDATAEXCHANGE;
     pn532_packetbuffer[1] = inListedTag;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 2, send, sendLength)) {
+    if (writeCommand(pn532_packetbuffer, 2, send, sendLength)) {
         return false;
     }
 
-    int16_t status = HAL(readResponse)(response, *responseLength, 1000);
+    int16_t status = readResponse(response, *responseLength, 1000);
     if (status < 0) {
         return false;
     }
 
     if ((response[0] & 0x3f) != 0) {
         DMSG("Status code indicates an error\n");
+        PN532_TRACE(PN532_TRACE_STATUS, PN532_COMMAND_INDATAEXCHANGE, 0, response, 1);
         return false;
     }
 
@@ -820,6 +959,118 @@ bool PN532::inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response,
     return true;
 }
 
+/**************************************************************************/
+/*!
+    @brief  Sends a raw frame to the inlisted ISO14443A target, bypassing
+            the PN532 protocol handling (FAST_READ, READ_SIG, READ_CNT, ...)
+
+    @param  send            Frame without CRC
+    @param  sendLength      Length of the frame, at most 58 bytes
+    @param  response        Receives the target's answer; on entry the
+                            buffer must hold one status byte more than
+                            the expected answer
+    @param  responseLength  In: size of response, out: answer length
+                            (without CRC)
+
+    @returns true if the target answered and, with host CRC enabled, the
+             CRC_A of the answer is correct
+*/
+/**************************************************************************/
+bool PN532::inCommunicateThru(const uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength)
+{
+    if (sendLength > sizeof(pn532_packetbuffer) - 6) {
+        DMSG("inCommunicateThru: frame too long\n");
+        return false;
+    }
+
+    pn532_packetbuffer[0] = PN532_COMMAND_INCOMMUNICATETHRU;
+    memcpy(pn532_packetbuffer + 1, send, sendLength);
+
+    uint8_t crcLength = 0;
+    if (_hostCRC) {
+        uint16_t crc = pn532_crcA(send, sendLength);
+        pn532_packetbuffer[1 + sendLength] = crc & 0xFF;
+        pn532_packetbuffer[2 + sendLength] = crc >> 8;
+        crcLength = 2;
+    }
+
+    if (writeCommand(pn532_packetbuffer, 1 + sendLength + crcLength)) {
+        return false;
+    }
+
+    int16_t status = readResponse(response, *responseLength, 1000);
+    if (status < 1) {
+        return false;
+    }
+
+    if ((response[0] & 0x3f) != 0) {
+        DMSG("Status code indicates an error\n");
+        PN532_TRACE(PN532_TRACE_STATUS, PN532_COMMAND_INCOMMUNICATETHRU, 0, response, 1);
+        return false;
+    }
+
+    uint8_t length = status - 1;
+
+    // 4 bit ACK/NAK answers carry no CRC
+    if (_hostCRC && length > 2) {
+        length -= 2;
+        uint16_t crc = pn532_crcA(response + 1, length);
+        if ((crc & 0xFF) != response[1 + length] || (crc >> 8) != response[2 + length]) {
+            DMSG("CRC_A mismatch\n");
+            return false;
+        }
+    }
+
+    memmove(response, response + 1, length);
+    *responseLength = length;
+
+    return true;
+}
+
+/**************************************************************************/
+/*!
+    @brief  Moves CRC_A generation and checking from the PN532 to the
+            host for inCommunicateThru(). InListPassiveTarget re-enables
+            the CIU CRC, so call this after a target has been inlisted.
+
+    @param  enable  true to let the host append and check CRC_A
+*/
+/**************************************************************************/
+bool PN532::setHostCRC(bool enable)
+{
+    // both modes in one ReadRegister, readRegister() cannot tell a failure from 0
+    pn532_packetbuffer[0] = PN532_COMMAND_READREGISTER;
+    pn532_packetbuffer[1] = (PN532_REG_CIU_TXMODE >> 8) & 0xFF;
+    pn532_packetbuffer[2] = PN532_REG_CIU_TXMODE & 0xFF;
+    pn532_packetbuffer[3] = (PN532_REG_CIU_RXMODE >> 8) & 0xFF;
+    pn532_packetbuffer[4] = PN532_REG_CIU_RXMODE & 0xFF;
+
+    if (writeCommand(pn532_packetbuffer, 5)) {
+        return false;
+    }
+    if (readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer)) < 2) {
+        return false;
+    }
+
+    uint8_t txMode = pn532_packetbuffer[0];
+    uint8_t rxMode = pn532_packetbuffer[1];
+
+    if (enable) {
+        txMode &= ~PN532_CIU_CRC_ENABLE;
+        rxMode &= ~PN532_CIU_CRC_ENABLE;
+    } else {
+        txMode |= PN532_CIU_CRC_ENABLE;
+        rxMode |= PN532_CIU_CRC_ENABLE;
+    }
+
+    if (!writeRegister(PN532_REG_CIU_TXMODE, txMode) || !writeRegister(PN532_REG_CIU_RXMODE, rxMode)) {
+        return false;
+    }
+
+    _hostCRC = enable;
+    return true;
+}
+
 /**************************************************************************/
 /*!
     @brief  'InLists' a passive target. PN532 acting as reader/initiator,
@@ -834,11 +1085,12 @@ bool PN532::inListPassiveTarget()
 
     DMSG("inList passive target\n");
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 3)) {
+    if (writeCommand(pn532_packetbuffer, 3)) {
         return false;
     }
+    _hostCRC = false;  // inlisting turns the CIU CRC back on
 
-    int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 30000);
+    int16_t status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), 30000);
     if (status < 0) {
         return false;
     }
@@ -854,12 +1106,12 @@ bool PN532::inListPassiveTarget()
 
 int8_t PN532::tgInitAsTarget(const uint8_t* command, const uint8_t len, const uint16_t timeout){
   
-  int8_t status = HAL(writeCommand)(command, len);
+  int8_t status = writeCommand(command, len);
     if (status < 0) {
         return -1;
     }
 
-    status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout);
+    status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), timeout);
     if (status > 0) {
         return 1;
     } else if (PN532_TIMEOUT == status) {
@@ -896,11 +1148,11 @@ int16_t PN532::tgGetData(uint8_t *buf, uint8_t len)
 {
     buf[0] = PN532_COMMAND_TGGETDATA;
 
-    if (HAL(writeCommand)(buf, 1)) {
+    if (writeCommand(buf, 1)) {
         return -1;
     }
 
-    int16_t status = HAL(readResponse)(buf, len, 3000);
+    int16_t status = readResponse(buf, len, 3000);
     if (0 >= status) {
         return status;
     }
@@ -910,6 +1162,7 @@ int16_t PN532::tgGetData(uint8_t *buf, uint8_t len)
 
     if (buf[0] != 0) {
         DMSG("status is not ok\n");
+        PN532_TRACE(PN532_TRACE_STATUS, PN532_COMMAND_TGGETDATA, 0, buf, 1);
         return -5;
     }
 
@@ -929,7 +1182,7 @@ bool PN532::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body,
         }
 
         pn532_packetbuffer[0] = PN532_COMMAND_TGSETDATA;
-        if (HAL(writeCommand)(pn532_packetbuffer, 1, header, hlen)) {
+        if (writeCommand(pn532_packetbuffer, 1, header, hlen)) {
             return false;
         }
     } else {
@@ -938,12 +1191,12 @@ bool PN532::tgSetData(const uint8_t *header, uint8_t hlen, const uint8_t *body,
         }
         pn532_packetbuffer[0] = PN532_COMMAND_TGSETDATA;
 
-        if (HAL(writeCommand)(pn532_packetbuffer, hlen + 1, body, blen)) {
+        if (writeCommand(pn532_packetbuffer, hlen + 1, body, blen)) {
             return false;
         }
     }
 
-    if (0 > HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 3000)) {
+    if (0 > readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), 3000)) {
         return false;
     }
 
@@ -959,12 +1212,12 @@ int16_t PN532::inRelease(const uint8_t relevantTarget){
     pn532_packetbuffer[0] = PN532_COMMAND_INRELEASE;
     pn532_packetbuffer[1] = relevantTarget;
 
-    if (HAL(writeCommand)(pn532_packetbuffer, 2)) {
+    if (writeCommand(pn532_packetbuffer, 2)) {
         return 0;
     }
 
     // read data packet
-    return HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer));
+    return readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer));
 }
 
 
@@ -998,12 +1251,12 @@ int8_t PN532::felica_Polling(uint16_t systemCode, uint8_t requestCode, uint8_t *
   pn532_packetbuffer[6] = requestCode;
   pn532_packetbuffer[7] = 0;
 
-  if (HAL(writeCommand)(pn532_packetbuffer, 8)) {
+  if (writeCommand(pn532_packetbuffer, 8)) {
     DMSG("Could not send Polling command\n");
     return -1;
   }
 
-  int16_t status = HAL(readResponse)(pn532_packetbuffer, 22, timeout);
+  int16_t status = readResponse(pn532_packetbuffer, 22, timeout);
   if (status < 0) {
     DMSG("Could not receive response\n");
     return -2;
@@ -1070,13 +1323,13 @@ int8_t PN532::felica_SendCommand (const uint8_t *command, uint8_t commandlength,
   pn532_packetbuffer[1] = inListedTag;
   pn532_packetbuffer[2] = commandlength + 1;
 
-  if (HAL(writeCommand)(pn532_packetbuffer, 3, command, commandlength)) {
+  if (writeCommand(pn532_packetbuffer, 3, command, commandlength)) {
     DMSG("Could not send FeliCa command\n");
     return -2;
   }
 
   // Wait card response
-  int16_t status = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 200);
+  int16_t status = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), 200);
   if (status < 0) {
     DMSG("Could not receive response\n");
     return -3;
@@ -1086,6 +1339,7 @@ int8_t PN532::felica_SendCommand (const uint8_t *command, uint8_t commandlength,
   if ((pn532_packetbuffer[0] & 0x3F)!=0) {
     DMSG("Status code indicates an error: ");
     DMSG_HEX(pn532_packetbuffer[0]);
+    PN532_TRACE(PN532_TRACE_STATUS, PN532_COMMAND_INDATAEXCHANGE, 0, pn532_packetbuffer, 1);
     DMSG("\n");
     return -4;
   }
@@ -1387,13 +1641,13 @@ int8_t PN532::felica_Release()
   pn532_packetbuffer[1] = 0x00;   // All target
   DMSG("Release all FeliCa target\n");
 
-  if (HAL(writeCommand)(pn532_packetbuffer, 2)) {
+  if (writeCommand(pn532_packetbuffer, 2)) {
     DMSG("No ACK\n");
     return -1;  // no ACK
   }
 
   // Wait card response
-  int16_t frameLength = HAL(readResponse)(pn532_packetbuffer, sizeof(pn532_packetbuffer), 1000);
+  int16_t frameLength = readResponse(pn532_packetbuffer, sizeof(pn532_packetbuffer), 1000);
   if (frameLength < 0) {
     DMSG("Could not receive response\n");
     return -2;
@@ -1403,6 +1657,7 @@ int8_t PN532::felica_Release()
   if ((pn532_packetbuffer[0] & 0x3F)!=0) {
     DMSG("Status code indicates an error: ");
     DMSG_HEX(pn532_packetbuffer[7]);
+    PN532_TRACE(PN532_TRACE_STATUS, PN532_COMMAND_INRELEASE, 0, pn532_packetbuffer, 1);
     DMSG("\n");
     return -3;
   }
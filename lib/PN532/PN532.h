@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include "PN532Interface.h"
+#include "PN532_cardtype.h"
 
 // PN532 Commands
 #define PN532_COMMAND_DIAGNOSE              (0x00)
@@ -52,6 +53,11 @@
 
 #define PN532_MIFARE_ISO14443A              (0x00)
 
+// CIU registers
+#define PN532_REG_CIU_TXMODE                (0x6302)
+#define PN532_REG_CIU_RXMODE                (0x6303)
+#define PN532_CIU_CRC_ENABLE                (0x80)
+
 // Mifare Commands
 #define MIFARE_CMD_AUTH_A                   (0x60)
 #define MIFARE_CMD_AUTH_B                   (0x61)
@@ -124,6 +130,35 @@
 #define FELICA_WRITE_MAX_BLOCK_NUM          10 // for typical FeliCa card
 #define FELICA_REQ_SERVICE_MAX_NODE_NUM     32
 
+#define PN532_PACKBUFFSIZ                   64  // command buffer, getBuffer() leaves 4 bytes of it
+
+// Command statistics
+#define PN532_STATS_COMMANDS                8   // distinct command codes tracked
+#define PN532_STATS_BUCKETS                 18  // latency buckets, the last one is open ended
+#define PN532_STATS_BUCKET_SHIFT            7   // bucket 0 is < 128us, bucket n is < 128us << n
+
+struct PN532CommandStats {
+    uint8_t  command;                           // PN532_COMMAND_*
+    uint32_t success;
+    uint32_t ackTimeout;                        // no ACK within PN532_ACK_WAIT_TIME
+    uint32_t invalidAck;
+    uint32_t timeout;                           // no response within the command timeout
+    uint32_t noTarget;                          // target wait that ended with no target, see below
+    uint32_t invalidFrame;
+    uint32_t noSpace;
+    uint32_t maxMicros;                         // slowest successful command
+    uint32_t histogram[PN532_STATS_BUCKETS];    // successful command latency
+};
+
+// InListPassiveTarget and TgInitAsTarget wait for a card or a reader to come
+// into the field. A wait that times out, is aborted, or lists no target counts
+// as noTarget, not as a failure, and is left out of the latency histogram.
+struct PN532Stats {
+    uint8_t  count;                             // used entries of commands[]
+    uint32_t untracked;                         // commands seen after the table filled up
+    PN532CommandStats commands[PN532_STATS_COMMANDS];
+};
+
 class PN532
 {
 public:
@@ -158,8 +193,10 @@ public:
 
     // ISO14443A functions
     bool inListPassiveTarget();
-    bool readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout = 1000);
+    bool readPassiveTargetID(uint8_t cardbaudrate, uint8_t *uid, uint8_t *uidLength, uint16_t timeout = 1000, PN532TargetInfo *info = 0);
     bool inDataExchange(uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength);
+    bool inCommunicateThru(const uint8_t *send, uint8_t sendLength, uint8_t *response, uint8_t *responseLength);
+    bool setHostCRC(bool enable);
 
     // Mifare Classic functions
     bool mifareclassic_IsFirstBlock (uint32_t uiBlock);
@@ -188,6 +225,12 @@ public:
     static void PrintHex(const uint8_t *data, const uint32_t numBytes);
     static void PrintHexChar(const uint8_t *pbtData, const uint32_t numBytes);
 
+    /**
+    * @brief    copy the per-command latency histograms and error counters
+    */
+    void getStats(PN532Stats *stats) const;
+    void resetStats();
+
     uint8_t *getBuffer(uint8_t *len) {
         *len = sizeof(pn532_packetbuffer) - 4;
         return pn532_packetbuffer;
@@ -200,10 +243,20 @@ private:
     uint8_t inListedTag; // Tg number of inlisted tag.
     uint8_t _felicaIDm[8]; // FeliCa IDm (NFCID2)
     uint8_t _felicaPMm[8]; // FeliCa PMm (PAD)
+    bool _hostCRC;         // CRC_A computed here instead of by the CIU
 
-    uint8_t pn532_packetbuffer[64];
+    uint8_t pn532_packetbuffer[PN532_PACKBUFFSIZ];
 
     PN532Interface *_interface;
+
+    PN532Stats _stats;
+    uint8_t _command;           // command in flight
+    uint32_t _commandStart;     // micros() when it was written
+
+    int8_t writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout = 1000);
+    PN532CommandStats *statsEntry();
+    void recordStats(int16_t status, bool ack);
 };
 
 #endif
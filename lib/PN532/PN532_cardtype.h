@@ -0,0 +1,96 @@
+
+#ifndef __PN532_CARDTYPE_H__
+#define __PN532_CARDTYPE_H__
+
+#include <stdint.h>
+
+// ISO14443A target classification from SENS_RES (ATQA) and SEL_RES (SAK),
+// after NXP AN10833. Cards sharing an ATQA/SAK pair cannot be told apart
+// without further commands: MIFARE Plus SL3 2K and phones emulating a card
+// both answer 0x0004/0x20 and are reported as PN532_CARD_ISO_DEP.
+
+enum PN532CardType {
+    PN532_CARD_UNKNOWN = 0,
+    PN532_CARD_MIFARE_MINI,
+    PN532_CARD_MIFARE_CLASSIC_1K,
+    PN532_CARD_MIFARE_CLASSIC_4K,
+    PN532_CARD_ULTRALIGHT,          // Ultralight, Ultralight C/EV1, NTAG21x
+    PN532_CARD_MIFARE_PLUS_SL2,
+    PN532_CARD_MIFARE_PLUS_SL3,
+    PN532_CARD_DESFIRE,
+    PN532_CARD_ISO_DEP              // other ISO14443-4 targets, phones
+};
+
+struct PN532TargetInfo {
+    uint16_t atqa;
+    uint8_t  sak;
+    PN532CardType type;
+};
+
+// ATQA bits 7..6 only encode the UID size, 4 and 7 byte variants share a row
+#define PN532_ATQA_UID_SIZE_MASK    (0x00C0)
+
+struct PN532CardSignature {
+    uint16_t atqa;
+    uint8_t  sak;
+    PN532CardType type;
+};
+
+constexpr PN532CardSignature PN532_CARD_SIGNATURES[] = {
+    {0x0004, 0x00, PN532_CARD_ULTRALIGHT},
+    {0x0004, 0x09, PN532_CARD_MIFARE_MINI},
+    {0x0004, 0x08, PN532_CARD_MIFARE_CLASSIC_1K},
+    {0x0004, 0x28, PN532_CARD_MIFARE_CLASSIC_1K},   // SmartMX with Classic 1K
+    {0x0002, 0x18, PN532_CARD_MIFARE_CLASSIC_4K},
+    {0x0002, 0x38, PN532_CARD_MIFARE_CLASSIC_4K},   // SmartMX with Classic 4K
+    {0x0004, 0x10, PN532_CARD_MIFARE_PLUS_SL2},     // 2K
+    {0x0002, 0x11, PN532_CARD_MIFARE_PLUS_SL2},     // 4K
+    {0x0002, 0x20, PN532_CARD_MIFARE_PLUS_SL3},     // 4K
+    {0x0304, 0x20, PN532_CARD_DESFIRE},
+    {0x0004, 0x20, PN532_CARD_ISO_DEP},
+};
+
+constexpr uint8_t PN532_CARD_SIGNATURE_COUNT = sizeof(PN532_CARD_SIGNATURES) / sizeof(PN532_CARD_SIGNATURES[0]);
+
+constexpr PN532CardType pn532_classifyFrom(uint16_t atqa, uint8_t sak, uint8_t i)
+{
+    return i >= PN532_CARD_SIGNATURE_COUNT
+        ? ((sak & 0x20) ? PN532_CARD_ISO_DEP : PN532_CARD_UNKNOWN)
+        : (PN532_CARD_SIGNATURES[i].atqa == atqa && PN532_CARD_SIGNATURES[i].sak == sak)
+            ? PN532_CARD_SIGNATURES[i].type
+            : pn532_classifyFrom(atqa, sak, i + 1);
+}
+
+/**
+ * @brief    classify an ISO14443A target, usable in constant expressions
+ * @param    atqa    SENS_RES as returned by InListPassiveTarget (byte 0 high)
+ * @param    sak     SEL_RES
+ */
+constexpr PN532CardType pn532_classify(uint16_t atqa, uint8_t sak)
+{
+    return pn532_classifyFrom(atqa & ~PN532_ATQA_UID_SIZE_MASK, sak, 0);
+}
+
+static_assert(pn532_classify(0x0044, 0x00) == PN532_CARD_ULTRALIGHT, "NTAG21x");
+static_assert(pn532_classify(0x0004, 0x08) == PN532_CARD_MIFARE_CLASSIC_1K, "Classic 1K");
+static_assert(pn532_classify(0x0042, 0x18) == PN532_CARD_MIFARE_CLASSIC_4K, "Classic 4K, 7 byte UID");
+static_assert(pn532_classify(0x0344, 0x20) == PN532_CARD_DESFIRE, "DESFire EV1");
+static_assert(pn532_classify(0x0008, 0x60) == PN532_CARD_ISO_DEP, "unlisted ISO-DEP");
+static_assert(pn532_classify(0x0004, 0x88) == PN532_CARD_UNKNOWN, "unlisted");
+
+inline const char *pn532_cardTypeName(PN532CardType type)
+{
+    switch (type) {
+    case PN532_CARD_MIFARE_MINI:       return "MIFARE Mini";
+    case PN532_CARD_MIFARE_CLASSIC_1K: return "MIFARE Classic 1K";
+    case PN532_CARD_MIFARE_CLASSIC_4K: return "MIFARE Classic 4K";
+    case PN532_CARD_ULTRALIGHT:        return "Ultralight/NTAG";
+    case PN532_CARD_MIFARE_PLUS_SL2:   return "MIFARE Plus SL2";
+    case PN532_CARD_MIFARE_PLUS_SL3:   return "MIFARE Plus SL3";
+    case PN532_CARD_DESFIRE:           return "DESFire";
+    case PN532_CARD_ISO_DEP:           return "ISO-DEP";
+    default:                           return "Unknown";
+    }
+}
+
+#endif
@@ -3,6 +3,9 @@
 
 //#define DEBUG
 
+// DMSG is for human readable messages only, frame bytes are recorded by
+// PN532_trace.h which is cheap enough to leave enabled.
+
 #include "Arduino.h"
 
 #ifdef DEBUG
@@ -0,0 +1,92 @@
+
+#include "PN532_trace.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO
+#include "Arduino.h"
+#else
+#include <time.h>
+
+static uint32_t micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+#endif
+
+static PN532TraceRecord ring[PN532_TRACE_SIZE];
+static std::atomic<uint32_t> head(0);   // next slot to write, owned by the producer
+static std::atomic<uint32_t> tail(0);   // next slot to read, owned by the consumer
+static std::atomic<uint32_t> lost(0);
+
+void PN532Trace::record(uint8_t dir, uint8_t command, int8_t status,
+                        const uint8_t *header, uint8_t hlen,
+                        const uint8_t *body, uint8_t blen)
+{
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= PN532_TRACE_SIZE) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    PN532TraceRecord *rec = &ring[h & (PN532_TRACE_SIZE - 1)];
+    rec->time = micros();
+    rec->dir = dir;
+    rec->command = command;
+    rec->length = hlen + blen;
+    rec->status = status;
+
+    uint8_t n = hlen < PN532_TRACE_BYTES ? hlen : PN532_TRACE_BYTES;
+    memcpy(rec->data, header, n);
+    if (n < PN532_TRACE_BYTES && blen) {
+        uint8_t m = PN532_TRACE_BYTES - n;
+        memcpy(rec->data + n, body, blen < m ? blen : m);
+    }
+
+    head.store(h + 1, std::memory_order_release);
+}
+
+bool PN532Trace::pop(PN532TraceRecord *rec)
+{
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    memcpy(rec, &ring[t & (PN532_TRACE_SIZE - 1)], sizeof(*rec));
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+}
+
+uint32_t PN532Trace::count()
+{
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_relaxed);
+}
+
+uint32_t PN532Trace::dropped()
+{
+    return lost.load(std::memory_order_relaxed);
+}
+
+int PN532Trace::format(const PN532TraceRecord *rec, char *out, size_t size)
+{
+    static const char *const names[] = {"TX ", "ACK", "RX ", "ERR"};
+    const char *name = rec->dir < 4 ? names[rec->dir] : "???";
+
+    int n = snprintf(out, size, "%10lu us  %s %02X  len %3u  st %4d :",
+                     (unsigned long)rec->time, name, rec->command, rec->length, rec->status);
+
+    uint8_t stored = rec->length < PN532_TRACE_BYTES ? rec->length : PN532_TRACE_BYTES;
+    for (uint8_t i = 0; i < stored && n > 0 && (size_t)n < size; i++) {
+        n += snprintf(out + n, size - n, " %02X", rec->data[i]);
+    }
+    if (rec->length > stored && n > 0 && (size_t)n < size) {
+        n += snprintf(out + n, size - n, " ...");
+    }
+
+    return (n > 0 && (size_t)n >= size) ? (int)size - 1 : n;
+}
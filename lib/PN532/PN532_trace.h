@@ -0,0 +1,75 @@
+
+#ifndef __PN532_TRACE_H__
+#define __PN532_TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Binary frame trace. Records are written by the task talking to the PN532
+// and read by one drain task; when the ring is full new records are dropped
+// and counted, the producer never waits. Define PN532_NO_TRACE to compile
+// every PN532_TRACE() call out.
+
+#define PN532_TRACE_SIZE        32      // records, must be a power of two
+#define PN532_TRACE_BYTES       16      // payload bytes kept per record
+
+// record directions
+#define PN532_TRACE_TX          (0)     // host -> PN532 frame, data = TFI payload
+#define PN532_TRACE_ACK         (1)     // ACK frame, status only
+#define PN532_TRACE_RX          (2)     // PN532 -> host frame, data = response payload
+#define PN532_TRACE_STATUS      (3)     // error status byte reported inside a response
+
+/**
+ * One trace entry, 24 bytes with no padding so a dump taken on the ESP32 can
+ * be read back as-is on a little-endian host.
+ */
+struct PN532TraceRecord {
+    uint32_t time;                      // micros() when recorded
+    uint8_t  dir;                       // PN532_TRACE_*
+    uint8_t  command;                   // PN532 command code
+    uint8_t  length;                    // payload length, may exceed PN532_TRACE_BYTES
+    int8_t   status;                    // 0 or PN532_TIMEOUT, PN532_INVALID_FRAME, ...
+    uint8_t  data[PN532_TRACE_BYTES];   // first bytes of the payload
+};
+
+class PN532Trace {
+public:
+    /**
+    * @brief    append a record, the payload is header followed by body
+    */
+    static void record(uint8_t dir, uint8_t command, int8_t status,
+                       const uint8_t *header = 0, uint8_t hlen = 0,
+                       const uint8_t *body = 0, uint8_t blen = 0);
+
+    /**
+    * @brief    take the oldest record
+    * @return   true    a record was copied to rec
+    *           false   ring is empty
+    */
+    static bool pop(PN532TraceRecord *rec);
+
+    /**
+    * @brief    number of records waiting, for the consumer
+    */
+    static uint32_t count();
+
+    /**
+    * @brief    number of records lost because the ring was full
+    */
+    static uint32_t dropped();
+
+    /**
+    * @brief    render a record as one transcript line, e.g.
+    *           "   1234567 us  TX  4A  len   3  st    0 : 4A 01 00"
+    * @return   length of the text written to out (always terminated)
+    */
+    static int format(const PN532TraceRecord *rec, char *out, size_t size);
+};
+
+#ifndef PN532_NO_TRACE
+#define PN532_TRACE(args...)    PN532Trace::record(args)
+#else
+#define PN532_TRACE(args...)
+#endif
+
+#endif
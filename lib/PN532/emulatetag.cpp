@@ -54,14 +54,73 @@ bool EmulateTag::init(){
 }
 
 void EmulateTag::setNdefFile(const uint8_t* ndef, const int16_t ndefLength){
-  if(ndefLength >  (NDEF_MAX_LENGTH -2)){
-	DMSG("ndef file too large (> NDEF_MAX_LENGHT -2) - aborting");
+  if(ndefLength >  (ndefFileSize -2)){
+	DMSG("ndef file too large (> ndef file size -2) - aborting");
 	return;
   }
 
-  ndef_file[0] = ndefLength >> 8;
-  ndef_file[1] = ndefLength & 0xFF;
-  memcpy(ndef_file+2, ndef, ndefLength);
+  ndefMessage = 0;
+  ndefFile[0] = ndefLength >> 8;
+  ndefFile[1] = ndefLength & 0xFF;
+  memcpy(ndefFile+2, ndef, ndefLength);
+}
+
+void EmulateTag::setNdefStorage(uint8_t* file, uint16_t size){
+  if(size > NDEF_TYPE4_MAX_LENGTH){
+    size = NDEF_TYPE4_MAX_LENGTH;
+  }
+
+  ndefMessage = 0;
+  ndefFile = file;
+  ndefFileSize = size;
+}
+
+void EmulateTag::setNdefMessage(const uint8_t* message, uint16_t length){
+  if(length > (NDEF_TYPE4_MAX_LENGTH - 2)){
+	DMSG("ndef message too large - aborting");
+	return;
+  }
+
+  ndefMessage = message;
+  ndefMessageLength = length;
+}
+
+uint16_t EmulateTag::ndefSize(){
+  if(ndefProvider != 0){
+    return ndefProvider->length() + 2;
+  }
+  return ndefMessage ? ndefMessageLength + 2 : ndefFileSize;
+}
+
+uint16_t EmulateTag::readNdef(uint16_t offset, uint8_t* buf, uint16_t len){
+  uint16_t size = ndefSize();
+  if(offset >= size){
+    return 0;
+  }
+  if(len > size - offset){
+    len = size - offset;
+  }
+
+  if(ndefProvider == 0 && ndefMessage == 0){
+    memcpy(buf, ndefFile + offset, len);
+    return len;
+  }
+
+  // generated length prefix followed by the referenced or generated message
+  uint16_t messageLength = size - 2;
+  uint16_t n = 0;
+  for(; n < len && offset + n < 2; n++){
+    buf[n] = (offset + n == 0) ? (messageLength >> 8) : (messageLength & 0xFF);
+  }
+  if(n < len){
+    if(ndefProvider != 0){
+      n += ndefProvider->read(offset + n - 2, buf + n, len - n);
+    } else{
+      memcpy(buf + n, ndefMessage + offset + n - 2, len - n);
+      n = len;
+    }
+  }
+  return n;
 }
 
 void EmulateTag::setUid(uint8_t* uid){
@@ -69,7 +128,134 @@ void EmulateTag::setUid(uint8_t* uid){
 }
 
 bool EmulateTag::emulate(const uint16_t tgInitAsTargetTimeout){
+  if(!startSession(tgInitAsTargetTimeout)){
+    return false;
+  }
+
+  while(EMULATE_RUNNING == step()){
+  }
+  return true;
+}
+
+emulateState EmulateTag::step(const uint16_t tgInitAsTargetTimeout){
+  if(!sessionActive){
+    return startSession(tgInitAsTargetTimeout) ? EMULATE_RUNNING : EMULATE_WAITING;
+  }
+
+  uint8_t rwbuf[128];
+  uint8_t sendlen;
+  int16_t status;
+
+  status = pn532.tgGetData(rwbuf, sizeof(rwbuf));
+  if(status < 0){
+    DMSG("tgGetData failed!\n");
+    stop();
+    return EMULATE_FINISHED;
+  }
+
+  uint8_t p1 = rwbuf[C_APDU_P1];
+  uint8_t p2 = rwbuf[C_APDU_P2];
+  uint8_t lc = rwbuf[C_APDU_LC];
+  uint16_t p1p2_length = ((int16_t) p1 << 8) + p2;
+  uint16_t le = (lc == 0 || lc > sizeof(rwbuf) - 2) ? sizeof(rwbuf) - 2 : lc; // READ_BINARY: lc holds Le
+
+  switch(rwbuf[C_APDU_INS]){
+  case ISO7816_SELECT_FILE:
+    switch(p1){
+    case C_APDU_P1_SELECT_BY_ID:
+      if(p2 != 0x0c){
+        DMSG("C_APDU_P2 != 0x0c\n");
+        setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
+      } else if(lc == 2 && rwbuf[C_APDU_DATA] == 0xE1 && (rwbuf[C_APDU_DATA+1] == 0x03 || rwbuf[C_APDU_DATA+1] == 0x04)){
+        setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
+        if(rwbuf[C_APDU_DATA+1] == 0x03){
+          currentFile = CC;
+        } else if(rwbuf[C_APDU_DATA+1] == 0x04){
+          currentFile = NDEF;
+        }
+      } else {
+        setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
+      }
+      break;
+    case C_APDU_P1_SELECT_BY_NAME: 
+      const uint8_t ndef_tag_application_name_v2[] = {0, 0x7, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
+      if(0 == memcmp(ndef_tag_application_name_v2, rwbuf + C_APDU_P2, sizeof(ndef_tag_application_name_v2))){
+        setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
+      } else{
+        DMSG("function not supported\n");
+        setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
+      } 
+      break;
+    }
+    break;
+  case ISO7816_READ_BINARY:
+    switch(currentFile){
+    case NONE:
+      setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
+      break;
+    case CC:
+      if( p1p2_length >= sizeof(compatibilityContainer)){
+        setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
+      }else {
+        if(le > sizeof(compatibilityContainer) - p1p2_length){
+          le = sizeof(compatibilityContainer) - p1p2_length;
+        }
+        memcpy(rwbuf,compatibilityContainer + p1p2_length, le);
+        setResponse(COMMAND_COMPLETE, rwbuf + le, &sendlen, le);
+      }
+      break;
+    case NDEF:
+      if( p1p2_length >= ndefSize()){
+        setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
+      }else {
+        le = readNdef(p1p2_length, rwbuf, le);
+        setResponse(COMMAND_COMPLETE, rwbuf + le, &sendlen, le);
+      }
+      break;
+    }
+    break;    
+  case ISO7816_UPDATE_BINARY:
+    if(!tagWriteable || ndefMessage != 0 || ndefProvider != 0){
+      setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
+    } else{      
+      if( (uint32_t)p1p2_length + lc > ndefFileSize){
+        setResponse(MEMORY_FAILURE, rwbuf, &sendlen);
+      }
+      else{
+        memcpy(ndefFile + p1p2_length, rwbuf + C_APDU_DATA, lc);
+        setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
+        tagWrittenByInitiator = true;
+
+        uint16_t ndef_length = (ndefFile[0] << 8) + ndefFile[1];
+        if ((ndef_length > 0) && (updateNdefCallback != 0)) {
+          updateNdefCallback(ndefFile + 2, ndef_length);
+        }
+      }
+    }
+    break;
+  default:
+    DMSG("Command not supported!");
+    DMSG_HEX(rwbuf[C_APDU_INS]);
+    DMSG("\n");
+    setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
+  }
+  status = pn532.tgSetData(rwbuf, sendlen);
+  if(status < 0){
+    DMSG("tgSetData failed\n!");
+    stop();
+    return EMULATE_FINISHED;
+  }
+  return EMULATE_RUNNING;
+}
+
+void EmulateTag::stop(){
+  if(sessionActive){
+    sessionActive = false;
+    pn532.inRelease();
+  }
+}
 
+bool EmulateTag::startSession(const uint16_t tgInitAsTargetTimeout){
   uint8_t command[] = {
         PN532_COMMAND_TGINITASTARGET,
         5,                  // MODE: PICC only, Passive only
@@ -97,7 +283,11 @@ bool EmulateTag::emulate(const uint16_t tgInitAsTargetTimeout){
     return false;
   }
 
-  uint8_t compatibility_container[] = {
+  if(ndefProvider != 0){
+    ndefProvider->open();
+  }
+
+  const uint8_t compatibility_container[] = {
     0, 0x0F,
     0x20,
     0, 0x54,
@@ -105,122 +295,22 @@ bool EmulateTag::emulate(const uint16_t tgInitAsTargetTimeout){
     0x04,       // T
     0x06,       // L
     0xE1, 0x04, // File identifier
-    ((NDEF_MAX_LENGTH & 0xFF00) >> 8), (NDEF_MAX_LENGTH & 0xFF), // maximum NDEF file size
+    0, 0,       // maximum NDEF file size
     0x00,       // read access 0x0 = granted
     0x00        // write access 0x0 = granted | 0xFF = deny
   };
 
-  if(tagWriteable == false){
-    compatibility_container[14] = 0xFF;
+  memcpy(compatibilityContainer, compatibility_container, sizeof(compatibilityContainer));
+  compatibilityContainer[11] = ndefSize() >> 8;
+  compatibilityContainer[12] = ndefSize() & 0xFF;
+
+  if(tagWriteable == false || ndefMessage != 0 || ndefProvider != 0){
+    compatibilityContainer[14] = 0xFF;
   }
 
   tagWrittenByInitiator = false;
-
-  uint8_t rwbuf[128];
-  uint8_t sendlen;
-  int16_t status;
-  tag_file currentFile = NONE;
-  uint16_t cc_size = sizeof(compatibility_container);
-  bool runLoop = true;
-
-  while(runLoop){
-    status = pn532.tgGetData(rwbuf, sizeof(rwbuf));
-    if(status < 0){
-      DMSG("tgGetData failed!\n");
-      pn532.inRelease();
-      return true;
-    }
-
-    uint8_t p1 = rwbuf[C_APDU_P1];
-    uint8_t p2 = rwbuf[C_APDU_P2];
-    uint8_t lc = rwbuf[C_APDU_LC];
-    uint16_t p1p2_length = ((int16_t) p1 << 8) + p2;
-
-    switch(rwbuf[C_APDU_INS]){
-    case ISO7816_SELECT_FILE:
-      switch(p1){
-      case C_APDU_P1_SELECT_BY_ID:
-	if(p2 != 0x0c){
-	  DMSG("C_APDU_P2 != 0x0c\n");
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	} else if(lc == 2 && rwbuf[C_APDU_DATA] == 0xE1 && (rwbuf[C_APDU_DATA+1] == 0x03 || rwbuf[C_APDU_DATA+1] == 0x04)){
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	  if(rwbuf[C_APDU_DATA+1] == 0x03){
-	    currentFile = CC;
-	  } else if(rwbuf[C_APDU_DATA+1] == 0x04){
-	    currentFile = NDEF;
-	  }
-	} else {
-	  setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
-	}
-	break;
-      case C_APDU_P1_SELECT_BY_NAME: 
-        const uint8_t ndef_tag_application_name_v2[] = {0, 0x7, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01 };
-	if(0 == memcmp(ndef_tag_application_name_v2, rwbuf + C_APDU_P2, sizeof(ndef_tag_application_name_v2))){
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	} else{
-	  DMSG("function not supported\n");
-	  setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
-	} 
-	break;
-      }
-      break;
-    case ISO7816_READ_BINARY:
-      switch(currentFile){
-      case NONE:
-	setResponse(TAG_NOT_FOUND, rwbuf, &sendlen);
-	break;
-      case CC:
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
-	}else {
-	  memcpy(rwbuf,compatibility_container + p1p2_length, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf + lc, &sendlen, lc);
-	}
-	break;
-      case NDEF:
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(END_OF_FILE_BEFORE_REACHED_LE_BYTES, rwbuf, &sendlen);
-	}else {
-	  memcpy(rwbuf, ndef_file + p1p2_length, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf + lc, &sendlen, lc);
-	}
-	break;
-      }
-      break;    
-    case ISO7816_UPDATE_BINARY:
-      if(!tagWriteable){
-	  setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
-      } else{      
-	if( p1p2_length > NDEF_MAX_LENGTH){
-	  setResponse(MEMORY_FAILURE, rwbuf, &sendlen);
-	}
-	else{
-	  memcpy(ndef_file + p1p2_length, rwbuf + C_APDU_DATA, lc);
-	  setResponse(COMMAND_COMPLETE, rwbuf, &sendlen);
-	  tagWrittenByInitiator = true;
-      
-      uint16_t ndef_length = (ndef_file[0] << 8) + ndef_file[1];
-      if ((ndef_length > 0) && (updateNdefCallback != 0)) {
-        updateNdefCallback(ndef_file + 2, ndef_length);
-      }
-	}
-      }
-      break;
-    default:
-      DMSG("Command not supported!");
-      DMSG_HEX(rwbuf[C_APDU_INS]);
-      DMSG("\n");
-      setResponse(FUNCTION_NOT_SUPPORTED, rwbuf, &sendlen);
-    }
-    status = pn532.tgSetData(rwbuf, sendlen);
-    if(status < 0){
-      DMSG("tgSetData failed\n!");
-      pn532.inRelease();
-      return true;
-    }
-  }
-  pn532.inRelease();
+  currentFile = NONE;
+  sessionActive = true;
   return true;
 }
 
@@ -12,19 +12,39 @@
 #define __EMULATETAG_H__
 
 #include "PN532.h"
+#include "ndef_provider.h"
 
-#define NDEF_MAX_LENGTH 128  // altough ndef can handle up to 0xfffe in size, arduino cannot.
+#define NDEF_MAX_LENGTH 128  // size of the built-in file, use setNdefStorage() or setNdefMessage() for more
+#define NDEF_TYPE4_MAX_LENGTH 0xFFFE  // largest NDEF file a Type 4 tag can advertise
 typedef enum {COMMAND_COMPLETE, TAG_NOT_FOUND, FUNCTION_NOT_SUPPORTED, MEMORY_FAILURE, END_OF_FILE_BEFORE_REACHED_LE_BYTES} responseCommand;
+typedef enum {EMULATE_WAITING, EMULATE_RUNNING, EMULATE_FINISHED} emulateState;
 
 class EmulateTag{
 
 public:
-EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenByInitiator(false), tagWriteable(true), updateNdefCallback(0) { }
+EmulateTag(PN532Interface &interface) : pn532(interface), ndefFile(ndef_file), ndefFileSize(NDEF_MAX_LENGTH), ndefMessage(0), ndefMessageLength(0), ndefProvider(0), currentFile(0), sessionActive(false), uidPtr(0), tagWrittenByInitiator(false), tagWriteable(true), updateNdefCallback(0) { }
   
   bool init();
 
   bool emulate(const uint16_t tgInitAsTargetTimeout = 0);
 
+  /*
+   * Non-blocking emulation, handles at most one reader APDU per call so the caller can
+   * interleave other work. Without a session it waits up to tgInitAsTargetTimeout ms for
+   * a reader. The selected file and session state persist between calls.
+   * @return EMULATE_WAITING no reader, EMULATE_RUNNING session open, EMULATE_FINISHED reader left
+   */
+  emulateState step(const uint16_t tgInitAsTargetTimeout = 10);
+
+  /*
+   * Close the current session, if any, and release the PN532.
+   */
+  void stop();
+
+  bool isActive(){
+    return sessionActive;
+  }
+
   /*
    * @param uid pointer to byte array of length 3 (uid is 4 bytes - first byte is fixed) or zero for uid 
    */
@@ -32,9 +52,31 @@ EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenB
 
   void setNdefFile(const uint8_t* ndef, const int16_t ndefLength);
 
+  /*
+   * Serve and update the NDEF file in place from caller owned RAM.
+   * @param file  whole NDEF file: 2 bytes big endian message length followed by the message
+   * @param size  size of file, up to NDEF_TYPE4_MAX_LENGTH
+   */
+  void setNdefStorage(uint8_t* file, uint16_t size);
+
+  /*
+   * Serve a read only NDEF message without copying it, e.g. a const array mapped from flash.
+   * The length prefix of the NDEF file is generated. The tag is not writeable while set.
+   */
+  void setNdefMessage(const uint8_t* message, uint16_t length);
+
+  /*
+   * Generate the NDEF message on demand, READ_BINARY asks the provider for exactly the
+   * requested range. open() is called once per reader session. Takes precedence over
+   * the other sources while set, pass 0 to go back to them. The tag is not writeable.
+   */
+  void setNdefProvider(NdefProvider* provider){
+    ndefProvider = provider;
+  }
+
   void getContent(uint8_t** buf, uint16_t* length){
-    *buf = ndef_file + 2; // first 2 bytes = length
-    *length = (ndef_file[0] << 8) + ndef_file[1];
+    *buf = ndefFile + 2; // first 2 bytes = length
+    *length = (ndefFile[0] << 8) + ndefFile[1];
   }
 
   bool writeOccured(){
@@ -46,25 +88,46 @@ EmulateTag(PN532Interface &interface) : pn532(interface), uidPtr(0), tagWrittenB
   }
 
   uint8_t* getNdefFilePtr(){
-    return ndef_file;
+    return ndefFile;
   }
 
-  uint8_t getNdefMaxLength(){
-    return NDEF_MAX_LENGTH;
+  uint16_t getNdefMaxLength(){
+    return ndefFileSize;
   }
 
   void attach(void (*func)(uint8_t *buf, uint16_t length)) {
     updateNdefCallback = func;
   };
 
+  /*
+   * Command statistics of the PN532 driving the emulation: TgInitAsTarget,
+   * TgGetData, TgSetData and InRelease. Kept apart from those of any other
+   * PN532 instance on the same interface.
+   */
+  void getStats(PN532Stats *stats) const {
+    pn532.getStats(stats);
+  }
+
 private:
   PN532 pn532;
   uint8_t ndef_file[NDEF_MAX_LENGTH];
+  uint8_t* ndefFile;            // writable NDEF file, ndef_file unless setNdefStorage() was called
+  uint16_t ndefFileSize;
+  const uint8_t* ndefMessage;   // read only message set by setNdefMessage(), takes precedence
+  uint16_t ndefMessageLength;
+  NdefProvider* ndefProvider;
+  uint8_t compatibilityContainer[15];
+  uint8_t currentFile;          // file selected by the reader, kept across step() calls
+  bool sessionActive;
   uint8_t* uidPtr;
   bool tagWrittenByInitiator;
   bool tagWriteable;
   void (*updateNdefCallback)(uint8_t *ndef, uint16_t length);
 
+  bool startSession(const uint16_t tgInitAsTargetTimeout);
+  uint16_t ndefSize();
+  uint16_t readNdef(uint16_t offset, uint8_t* buf, uint16_t len);
+
   void setResponse(responseCommand cmd, uint8_t* buf, uint8_t* sendlen, uint8_t sendlenOffset = 0);
 };
 
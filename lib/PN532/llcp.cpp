@@ -2,6 +2,8 @@
 #include "llcp.h"
 #include "PN532_debug.h"
 
+#include <string.h>
+
 // LLCP PDU Type Values
 #define PDU_SYMM    0x00
 #define PDU_PAX     0x01
@@ -12,6 +14,11 @@
 #define PDU_I       0x0c
 #define PDU_RR      0x0d
 
+// LLCP Parameter Types
+#define PARAM_MIUX  0x02
+#define PARAM_RW    0x05
+#define PARAM_SN    0x06
+
 uint8_t LLCP::SYMM_PDU[2] = {0, 0};
 
 inline uint8_t getPType(const uint8_t *buf)
@@ -29,46 +36,126 @@ inline uint8_t getDSAP(const uint8_t *buf)
     return buf[0] >> 2;
 }
 
+// SYMM and RR PDUs only keep the link alive or acknowledge, nothing to answer
+inline bool isIdle(uint8_t type)
+{
+    return PDU_SYMM == type || PDU_RR == type;
+}
+
 int8_t LLCP::activate(uint16_t timeout)
 {
+    pending = false;
     return link.activateAsTarget(timeout);
 }
 
-int8_t LLCP::waitForConnection(uint16_t timeout)
+void LLCP::reset()
 {
-    uint8_t type;
-
-    mode = 1;
     ns = 0;
     nr = 0;
+    va = 0;
+    unacked = 0;
+    remoteMIU = LLCP_DEFAULT_MIU;
+    remoteRW = 1;
+}
+
+void LLCP::parseParameters(const uint8_t *buf, uint8_t len)
+{
+    for (uint16_t i = 0; i + 2 <= len && i + 2 + buf[i + 1] <= len; i += 2 + buf[i + 1]) {
+        const uint8_t *value = buf + i + 2;
+        if (PARAM_MIUX == buf[i] && 2 == buf[i + 1]) {
+            remoteMIU = LLCP_DEFAULT_MIU + (((value[0] & 0x07) << 8) | value[1]);
+        } else if (PARAM_RW == buf[i] && 1 == buf[i + 1]) {
+            // RW 0 means the peer is not ready to receive, treat it as 1
+            remoteRW = (value[0] & 0x0F) ? (value[0] & 0x0F) : 1;
+        }
+    }
+    DMSG("remote MIU: ");
+    DMSG_INT(remoteMIU);
+    DMSG(", RW: ");
+    DMSG_INT(remoteRW);
+    DMSG("\n");
+}
+
+bool LLCP::send(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    pending = false;
+    return link.write(header, hlen, body, blen);
+}
+
+bool LLCP::answer()
+{
+    if (!pending) {
+        return true;
+    }
+
+    // Acknowledge once our receive window is full or the peer has gone idle,
+    // it may be waiting for the RR to send more
+    if (unacked && (PDU_I != lastType || unacked >= LLCP_DEFAULT_RW)) {
+        uint8_t rr[3];
+        rr[0] = (dsap << 2) + (PDU_RR >> 2);
+        rr[1] = ((PDU_RR & 0x3) << 6) + ssap;
+        rr[2] = nr;
+        unacked = 0;
+        return send(rr, sizeof(rr));
+    }
+
+    return send(SYMM_PDU, sizeof(SYMM_PDU));
+}
+
+int16_t LLCP::receive(uint8_t *buf, uint8_t len)
+{
+    if (!answer()) {
+        return -2;
+    }
+
+    int16_t status = link.read(buf, len);
+    if (2 > status) {
+        return -1;
+    }
+
+    pending = true;
+    lastType = getPType(buf);
+    if ((PDU_I == lastType || PDU_RR == lastType) && 3 <= status) {
+        va = buf[2] & 0x0F;         // N(R)
+    }
+
+    return status;
+}
+
+int8_t LLCP::waitForConnection(uint16_t timeout)
+{
+    int16_t status;
+
+    reset();
 
     // Get CONNECT PDU
     DMSG("wait for a CONNECT PDU\n");
     do {
-        if (2 > link.read(headerBuf, headerBufLen)) {
-            return -1;
+        status = receive(headerBuf, headerBufLen);
+        if (2 > status) {
+            return status < -1 ? -2 : -1;
         }
 
-        type = getPType(headerBuf);
-        if (PDU_CONNECT == type) {
+        if (PDU_CONNECT == lastType) {
             break;
-        } else if (PDU_SYMM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return -2;
-            }
-        } else {
+        } else if (!isIdle(lastType)) {
             return -3;
         }
 
     } while (1);
 
+    parseParameters(headerBuf + 2, status - 2);
+
     // Put CC PDU
     DMSG("put a CC(Connection Complete) PDU to response the CONNECT PDU\n");
     ssap = getDSAP(headerBuf);
     dsap = getSSAP(headerBuf);
     headerBuf[0] = (dsap << 2) + ((PDU_CC >> 2) & 0x3);
     headerBuf[1] = ((PDU_CC & 0x3) << 6) + ssap;
-    if (!link.write(headerBuf, 2)) {
+    headerBuf[2] = PARAM_RW;
+    headerBuf[3] = 1;
+    headerBuf[4] = LLCP_DEFAULT_RW;
+    if (!send(headerBuf, 5)) {
         return -2;
     }
 
@@ -77,23 +164,19 @@ int8_t LLCP::waitForConnection(uint16_t timeout)
 
 int8_t LLCP::waitForDisconnection(uint16_t timeout)
 {
-    uint8_t type;
+    int16_t status;
 
     // Get DISC PDU
     DMSG("wait for a DISC PDU\n");
     do {
-        if (2 > link.read(headerBuf, headerBufLen)) {
-            return -1;
+        status = receive(headerBuf, headerBufLen);
+        if (2 > status) {
+            return status < -1 ? -2 : -1;
         }
 
-        type = getPType(headerBuf);
-        if (PDU_DISC == type) {
+        if (PDU_DISC == lastType) {
             break;
-        } else if (PDU_SYMM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return -2;
-            }
-        } else {
+        } else if (!isIdle(lastType)) {
             return -3;
         }
 
@@ -101,11 +184,10 @@ int8_t LLCP::waitForDisconnection(uint16_t timeout)
 
     // Put DM PDU
     DMSG("put a DM(Disconnect Mode) PDU to response the DISC PDU\n");
-    // ssap = getDSAP(headerBuf);
-    // dsap = getSSAP(headerBuf);
     headerBuf[0] = (dsap << 2) + (PDU_DM >> 2);
     headerBuf[1] = ((PDU_DM & 0x3) << 6) + ssap;
-    if (!link.write(headerBuf, 2)) {
+    headerBuf[2] = 0;               // reason: disconnected
+    if (!send(headerBuf, 3)) {
         return -2;
     }
 
@@ -114,91 +196,89 @@ int8_t LLCP::waitForDisconnection(uint16_t timeout)
 
 int8_t LLCP::connect(uint16_t timeout)
 {
-    uint8_t type;
+    int16_t status;
+    static const char SERVICE_NAME[] = "urn:nfc:sn:snep";
 
-    mode = 0;
     dsap = LLCP_DEFAULT_DSAP;
     ssap = LLCP_DEFAULT_SSAP;
-    ns = 0;
-    nr = 0;
+    reset();
 
-    // try to get a SYMM PDU
-    if (2 > link.read(headerBuf, headerBufLen)) {
-        return -1;
-    }
-    type = getPType(headerBuf);
-    if (PDU_SYMM != type) {
-        return -1;
+    // try to get a SYMM PDU, unless the initiator is already waiting for us
+    if (!pending) {
+        if (2 > receive(headerBuf, headerBufLen)) {
+            return -1;
+        }
+        if (!isIdle(lastType)) {
+            return -1;
+        }
     }
 
-    // put a CONNECT PDU
+    // put a CONNECT PDU with the service name and our receive window
+    uint8_t body[2 + sizeof(SERVICE_NAME) - 1 + 3];
+    uint8_t n = sizeof(SERVICE_NAME) - 1;
+    body[0] = PARAM_SN;
+    body[1] = n;
+    memcpy(body + 2, SERVICE_NAME, n);
+    body[2 + n] = PARAM_RW;
+    body[3 + n] = 1;
+    body[4 + n] = LLCP_DEFAULT_RW;
+
     headerBuf[0] = (LLCP_DEFAULT_DSAP << 2) + (PDU_CONNECT >> 2);
     headerBuf[1] = ((PDU_CONNECT & 0x03) << 6) + LLCP_DEFAULT_SSAP;
-    uint8_t body[] = "  urn:nfc:sn:snep";
-    body[0] = 0x06;
-    body[1] = sizeof(body) - 2 - 1;
-    if (!link.write(headerBuf, 2, body, sizeof(body) - 1)) {
+    if (!send(headerBuf, 2, body, sizeof(body))) {
         return -2;
     }
 
     // wait for a CC PDU
     DMSG("wait for a CC PDU\n");
     do {
-        if (2 > link.read(headerBuf, headerBufLen)) {
-            return -1;
+        status = receive(headerBuf, headerBufLen);
+        if (2 > status) {
+            return status < -1 ? -2 : -1;
         }
 
-        type = getPType(headerBuf);
-        if (PDU_CC == type) {
+        if (PDU_CC == lastType) {
             break;
-        } else if (PDU_SYMM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return -2;
-            }
-        } else {
+        } else if (!isIdle(lastType)) {
             return -3;
         }
 
     } while (1);
 
+    parseParameters(headerBuf + 2, status - 2);
+
     return 1;
 }
 
 int8_t LLCP::disconnect(uint16_t timeout)
 {
-    uint8_t type;
+    int16_t status;
 
-    // try to get a SYMM PDU
-    if (2 > link.read(headerBuf, headerBufLen)) {
-        return -1;
-    }
-    type = getPType(headerBuf);
-    if (PDU_SYMM != type) {
-        return -1;
+    // try to get a SYMM PDU, unless the initiator is already waiting for us
+    if (!pending) {
+        if (2 > receive(headerBuf, headerBufLen)) {
+            return -1;
+        }
     }
 
     // put a DISC PDU
-    headerBuf[0] = (LLCP_DEFAULT_DSAP << 2) + (PDU_DISC >> 2);
-    headerBuf[1] = ((PDU_DISC & 0x03) << 6) + LLCP_DEFAULT_SSAP;
-    if (!link.write(headerBuf, 2)) {
+    headerBuf[0] = (dsap << 2) + (PDU_DISC >> 2);
+    headerBuf[1] = ((PDU_DISC & 0x03) << 6) + ssap;
+    if (!send(headerBuf, 2)) {
         return -2;
     }
 
     // wait for a DM PDU
     DMSG("wait for a DM PDU\n");
     do {
-        if (2 > link.read(headerBuf, headerBufLen)) {
-            return -1;
+        status = receive(headerBuf, headerBufLen);
+        if (2 > status) {
+            return status < -1 ? -2 : -1;
         }
 
-        type = getPType(headerBuf);
-        if (PDU_CC == type) {
+        if (PDU_DM == lastType) {
             break;
-        } else if (PDU_DM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return -2;
-            }
-        } else {
+        } else if (!isIdle(lastType) && PDU_I != lastType) {
             return -3;
         }
 
@@ -209,93 +289,70 @@ int8_t LLCP::disconnect(uint16_t timeout)
 
 bool LLCP::write(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
 {
-    uint8_t type;
-    uint8_t buf[3];
-
-    if (mode) {
-        // Get a SYMM PDU
-        if (2 != link.read(buf, sizeof(buf))) {
-            return false;
-        }
-    }
-
-    if (headerBufLen < (hlen + 3)) {
+    if (headerBufLen < (hlen + 3) || getRemoteMIU() < (hlen + blen)) {
         return false;
     }
 
-    for (int8_t i = hlen - 1; i >= 0; i--) {
-        headerBuf[i + 3] = header[i];
-    }
+    // header usually lives in headerBuf, which every exchange below overwrites,
+    // and hlen + 3 <= headerBufLen < PN532_PACKBUFFSIZ
+    uint8_t pdu[PN532_PACKBUFFSIZ];
+    memcpy(pdu + 3, header, hlen);
 
-    headerBuf[0] = (dsap << 2) + (PDU_I >> 2);
-    headerBuf[1] = ((PDU_I & 0x3) << 6) + ssap;
-    headerBuf[2] = (ns << 4) + nr;
-    if (!link.write(headerBuf, 3 + hlen, body, blen)) {
-        return false;
-    }
-
-    ns++;
-
-    // Get a RR PDU
-    int16_t status;
-    do {
-        status = link.read(headerBuf, headerBufLen);
-        if (2 > status) {
+    // wait for our turn and for room in the peer's receive window
+    while (!pending || ((ns - va) & 0x0F) >= remoteRW) {
+        if (2 > receive(headerBuf, headerBufLen)) {
             return false;
         }
-
-        type = getPType(headerBuf);
-        if (PDU_RR == type) {
-            break;
-        } else if (PDU_SYMM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return false;
-            }
-        } else {
+        if (!isIdle(lastType)) {
             return false;
         }
-    } while (1);
+    }
 
-    if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
+    pdu[0] = (dsap << 2) + (PDU_I >> 2);
+    pdu[1] = ((PDU_I & 0x3) << 6) + ssap;
+    pdu[2] = (ns << 4) + nr;        // N(R) acknowledges everything received so far
+    if (!send(pdu, 3 + hlen, body, blen)) {
         return false;
     }
 
+    ns = (ns + 1) & 0x0F;
+    unacked = 0;
+
     return true;
 }
 
 int16_t LLCP::read(uint8_t *buf, uint8_t length)
 {
-    uint8_t type;
-    uint16_t status;
+    int16_t status;
 
     // Get INFO PDU
     do {
-        status = link.read(buf, length);
+        status = receive(buf, length);
         if (2 > status) {
-            return -1;
+            return status < -1 ? -2 : -1;
         }
 
-        type = getPType(buf);
-        if (PDU_I == type) {
+        if (PDU_I == lastType) {
             break;
-        } else if (PDU_SYMM == type) {
-            if (!link.write(SYMM_PDU, sizeof(SYMM_PDU))) {
-                return -2;
-            }
-        } else {
+        } else if (!isIdle(lastType)) {
             return -3;
         }
 
     } while (1);
 
+    if (3 > status) {
+        return -3;
+    }
+
     uint8_t len = status - 3;
     ssap = getDSAP(buf);
     dsap = getSSAP(buf);
+    nr = ((buf[2] >> 4) + 1) & 0x0F;
+    unacked++;
 
-    headerBuf[0] = (dsap << 2) + (PDU_RR >> 2);
-    headerBuf[1] = ((PDU_RR & 0x3) << 6) + ssap;
-    headerBuf[2] = (buf[2] >> 4) + 1;
-    if (!link.write(headerBuf, 3)) {
+    // Acknowledge at once only when our receive window is full, otherwise the
+    // RR is left to the next exchange or piggybacked on the next I PDU
+    if (unacked >= LLCP_DEFAULT_RW && !answer()) {
         return -2;
     }
 
@@ -303,7 +360,5 @@ int16_t LLCP::read(uint8_t *buf, uint8_t length)
         buf[i] = buf[i + 3];
     }
 
-    nr++;
-
     return len;
 }
@@ -7,6 +7,9 @@
 #define LLCP_DEFAULT_TIMEOUT  20000
 #define LLCP_DEFAULT_DSAP     0x04
 #define LLCP_DEFAULT_SSAP     0x20
+#define LLCP_DEFAULT_MIU      128     // link MIU when no MIUX parameter is sent
+#define LLCP_DEFAULT_RW       4       // I PDUs the peer may send before we acknowledge
+#define LLCP_FRAME_MIU        250     // information field of an I PDU in one PN532 frame
 
 class LLCP {
 public:
@@ -14,6 +17,12 @@ public:
         headerBuf = link.getHeaderBuffer(&headerBufLen);
         ns = 0;
         nr = 0;
+        va = 0;
+        unacked = 0;
+        pending = false;
+        lastType = 0;
+        remoteMIU = LLCP_DEFAULT_MIU;
+        remoteRW = 1;
 	};
 
 	/**
@@ -34,18 +43,23 @@ public:
     int8_t disconnect(uint16_t timeout = LLCP_DEFAULT_TIMEOUT);
 
 	/**
-    * @brief    write a packet, the packet should be less than (255 - 2) bytes
+    * @brief    write an I PDU. Returns as soon as it is sent while fewer than
+    *           the peer's RW I PDUs are unacknowledged, otherwise waits for
+    *           an acknowledgement first
     * @param    header  packet header
     * @param    hlen    length of header
     * @param    body    packet body
-    * @param    blen    length of body
+    * @param    blen    length of body, hlen + blen must not exceed getRemoteMIU()
     * @return   true    success
     *           false   failed
     */
     bool write(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
 
     /**
-    * @brief    read a  packet, the packet will be less than (255 - 2) bytes
+    * @brief    read an I PDU, the packet will be less than (255 - 2) bytes.
+    *           Acknowledgement is deferred until LLCP_DEFAULT_RW I PDUs are
+    *           outstanding, the peer goes idle or the next write() carries it,
+    *           so another LLCP call must follow
     * @param    buf     the buffer to contain the packet
     * @param    len     lenght of the buffer
     * @return   >=0     length of the packet 
@@ -55,19 +69,38 @@ public:
 
     uint8_t *getHeaderBuffer(uint8_t *len) {
         uint8_t *buf = link.getHeaderBuffer(len);
-        len -= 3;       // I PDU header has 3 bytes
+        *len -= 3;      // I PDU header has 3 bytes
         return buf;
     };
 
+    /**
+    * @brief    largest information field write() can send in one I PDU,
+    *           the peer's MIU limited to what fits in a PN532 frame
+    */
+    uint16_t getRemoteMIU() {
+        return remoteMIU < LLCP_FRAME_MIU ? remoteMIU : LLCP_FRAME_MIU;
+    };
+
 private:
 	MACLink link;
-    uint8_t mode;
 	uint8_t ssap;
 	uint8_t dsap;
     uint8_t *headerBuf;
     uint8_t headerBufLen;
-    uint8_t ns;         // Number of I PDU Sent
-    uint8_t nr;         // Number of I PDU Received
+    uint8_t ns;         // V(S), send sequence number of the next I PDU
+    uint8_t nr;         // V(R), receive sequence number expected next
+    uint8_t va;         // V(SA), oldest I PDU not acknowledged by the peer
+    uint8_t unacked;    // I PDUs received but not acknowledged yet
+    bool pending;       // a PDU from the initiator still waits for our answer
+    uint8_t lastType;   // type of that PDU
+    uint16_t remoteMIU;
+    uint8_t remoteRW;
+
+    int16_t receive(uint8_t *buf, uint8_t len);
+    bool send(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    bool answer();
+    void reset();
+    void parseParameters(const uint8_t *buf, uint8_t len);
 
 	static uint8_t SYMM_PDU[2];
 };
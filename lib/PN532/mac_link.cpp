@@ -4,8 +4,13 @@
 
 int8_t MACLink::activateAsTarget(uint16_t timeout)
 {
-	pn532.begin();
-	pn532.SAMConfig();
+    if (!initialized) {
+        pn532.begin();
+        if (!pn532.SAMConfig()) {
+            return -1;
+        }
+        initialized = true;
+    }
     return pn532.tgInitAsTarget(timeout);
 }
 
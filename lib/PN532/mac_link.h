@@ -8,11 +8,11 @@
 class MACLink {
 public:
     MACLink(PN532Interface &interface) : pn532(interface) {
-
+        initialized = false;
     };
     
     /**
-    * @brief    Activate PN532 as a target
+    * @brief    Activate PN532 as a target, the PN532 is set up on the first call only
     * @param    timeout max time to wait, 0 means no timeout
     * @return   > 0     success
     *           = 0     timeout
@@ -46,6 +46,7 @@ public:
     
 private:
     PN532 pn532;
+    bool initialized;
 };
 
 #endif // __MAC_LINK_H__
@@ -0,0 +1,84 @@
+
+#include "ndef_provider.h"
+
+#include <string.h>
+
+#define NDEF_TNF_WELL_KNOWN 0x01
+#define NDEF_MB             0x80    // message begin
+#define NDEF_ME             0x40    // message end
+#define NDEF_SR             0x10    // short record, 1 byte payload length
+#define NDEF_RTD_URI        'U'
+
+void NdefUriProvider::setUri(uint8_t uriPrefix, const char *uriBase, const char *uriSuffix)
+{
+    prefix = uriPrefix;
+    base = uriBase;
+    suffix = uriSuffix ? uriSuffix : "";
+    baseLen = strlen(base);
+    suffixLen = strlen(suffix);
+}
+
+// record header, type and the URI identifier code
+uint8_t NdefUriProvider::headerLength()
+{
+    uint32_t payload = 1 + baseLen + suffixLen;
+    return payload > 0xFF ? 8 : 5;
+}
+
+uint8_t NdefUriProvider::headerByte(uint8_t i)
+{
+    uint32_t payload = 1 + baseLen + suffixLen;
+    bool shortRecord = payload <= 0xFF;
+
+    if (i == 0) {
+        return NDEF_MB | NDEF_ME | (shortRecord ? NDEF_SR : 0) | NDEF_TNF_WELL_KNOWN;
+    }
+    if (i == 1) {
+        return 1;                                   // type length
+    }
+    if (shortRecord) {
+        const uint8_t rest[] = {(uint8_t)payload, NDEF_RTD_URI, prefix};
+        return rest[i - 2];
+    }
+    const uint8_t rest[] = {(uint8_t)(payload >> 24), (uint8_t)(payload >> 16), (uint8_t)(payload >> 8),
+                            (uint8_t)payload, NDEF_RTD_URI, prefix};
+    return rest[i - 2];
+}
+
+uint16_t NdefUriProvider::length()
+{
+    return headerLength() + baseLen + suffixLen;
+}
+
+uint16_t NdefUriProvider::read(uint16_t offset, uint8_t *buf, uint16_t len)
+{
+    uint16_t n = 0;
+    uint8_t hlen = headerLength();
+
+    for (; n < len && offset < hlen; n++, offset++) {
+        buf[n] = headerByte(offset);
+    }
+
+    offset -= hlen;
+    if (n < len && offset < baseLen) {
+        uint16_t count = baseLen - offset;
+        if (count > len - n) {
+            count = len - n;
+        }
+        memcpy(buf + n, base + offset, count);
+        n += count;
+        offset += count;
+    }
+
+    offset -= baseLen;
+    if (n < len && offset < suffixLen) {
+        uint16_t count = suffixLen - offset;
+        if (count > len - n) {
+            count = len - n;
+        }
+        memcpy(buf + n, suffix + offset, count);
+        n += count;
+    }
+
+    return n;
+}
@@ -0,0 +1,68 @@
+/**************************************************************************/
+/*!
+    @file     ndef_provider.h
+    @license  BSD
+
+    NDEF messages produced on demand, a byte range at a time
+*/
+/**************************************************************************/
+
+#ifndef __NDEF_PROVIDER_H__
+#define __NDEF_PROVIDER_H__
+
+#include <stdint.h>
+
+class NdefProvider {
+public:
+    /**
+    * @brief    a reader started a new session, the message may change here
+    *           but must stay the same until the next call
+    */
+    virtual void open() {}
+
+    /**
+    * @brief    length of the NDEF message in bytes
+    */
+    virtual uint16_t length() = 0;
+
+    /**
+    * @brief    copy part of the NDEF message
+    * @param    offset  first byte of the message to copy
+    * @param    buf     destination
+    * @param    len     bytes wanted, offset + len never exceeds length()
+    * @return   bytes copied
+    */
+    virtual uint16_t read(uint16_t offset, uint8_t *buf, uint16_t len) = 0;
+};
+
+/**
+ * A single NFC Forum URI record whose URI is the concatenation of a fixed
+ * base and a suffix (e.g. a per-session token). Neither string is copied,
+ * both must stay valid while the provider is in use.
+ */
+class NdefUriProvider : public NdefProvider {
+public:
+    NdefUriProvider() : prefix(0), base(""), suffix(""), baseLen(0), suffixLen(0) {}
+
+    /**
+    * @param    uriPrefix   NDEF_URIPREFIX_* code replacing the start of the URI
+    * @param    uriBase     URI without the abbreviated prefix
+    * @param    uriSuffix   appended to uriBase, may be 0
+    */
+    void setUri(uint8_t uriPrefix, const char *uriBase, const char *uriSuffix = 0);
+
+    uint16_t length();
+    uint16_t read(uint16_t offset, uint8_t *buf, uint16_t len);
+
+private:
+    uint8_t prefix;
+    const char *base;
+    const char *suffix;
+    uint16_t baseLen;
+    uint16_t suffixLen;
+
+    uint8_t headerLength();
+    uint8_t headerByte(uint8_t i);
+};
+
+#endif // __NDEF_PROVIDER_H__
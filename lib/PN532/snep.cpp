@@ -2,7 +2,9 @@
 #include "snep.h"
 #include "PN532_debug.h"
 
-int8_t SNEP::write(const uint8_t *buf, uint8_t len, uint16_t timeout)
+#include <string.h>
+
+int8_t SNEP::connect(uint16_t timeout)
 {
 	if (0 >= llcp.activate(timeout)) {
 		DMSG("failed to activate PN532 as a target\n");
@@ -14,93 +16,333 @@ int8_t SNEP::write(const uint8_t *buf, uint8_t len, uint16_t timeout)
 		return -2;
 	}
 
-	// response a success SNEP message
-	headerBuf[0] = SNEP_DEFAULT_VERSION;
-	headerBuf[1] = SNEP_REQUEST_PUT;
-	headerBuf[2] = 0;
-	headerBuf[3] = 0;
-	headerBuf[4] = 0;
-	headerBuf[5] = len;
-	if (0 >= llcp.write(headerBuf, 6, buf, len)) {
-		return -3;
+	initiator = true;
+	return 1;
+}
+
+int8_t SNEP::accept(uint16_t timeout)
+{
+	if (0 >= llcp.activate(timeout)) {
+		DMSG("failed to activate PN532 as a target\n");
+		return -1;
+	}
+
+	if (0 >= llcp.waitForConnection(timeout)) {
+		DMSG("failed to set up a connection\n");
+		return -2;
+	}
+
+	initiator = false;
+	return 1;
+}
+
+int8_t SNEP::close(uint16_t timeout)
+{
+	if (initiator) {
+		return llcp.disconnect(timeout);
+	}
+	return llcp.waitForDisconnection(timeout);
+}
+
+int8_t SNEP::put(const uint8_t *buf, uint16_t len)
+{
+	int8_t status = sendMessage(SNEP_REQUEST_PUT, buf, len);
+	if (0 >= status) {
+		return status;
 	}
 
 	uint8_t rbuf[16];
-	if (6 > llcp.read(rbuf, sizeof(rbuf))) {
+	if (SNEP_HEADER_SIZE > llcp.read(rbuf, sizeof(rbuf))) {
 		return -4;
 	}
 
 	// check SNEP version
-	if (SNEP_DEFAULT_VERSION != rbuf[0]) {
+	if ((SNEP_DEFAULT_VERSION >> 4) != (rbuf[0] >> 4)) {
 		DMSG("The received SNEP message's major version is different\n");
 		// To-do: send Unsupported Version response
 		return -4;
 	}
 
-	// expect a put request
+	// expect a success response
 	if (SNEP_RESPONSE_SUCCESS != rbuf[1]) {
 		DMSG("Expect a success response\n");
 		return -4;
 	}
 
-	llcp.disconnect(timeout);
+	return 1;
+}
+
+int16_t SNEP::get(const uint8_t *request, uint16_t rlen, uint8_t *buf, uint16_t len)
+{
+	// the length must fit in the return value
+	if (len > 0x7FFF) {
+		len = 0x7FFF;
+	}
+
+	// a GET request starts with the acceptable length of the response
+	uint8_t acceptable[4] = {0, 0, (uint8_t)(len >> 8), (uint8_t)len};
+
+	int8_t status = sendMessage(SNEP_REQUEST_GET, request, rlen, acceptable, sizeof(acceptable));
+	if (0 >= status) {
+		return status;
+	}
+
+	return receiveMessage(SNEP_RESPONSE_SUCCESS, buf, len, 0);
+}
+
+int16_t SNEP::receive(uint8_t *buf, uint16_t len)
+{
+	// the length must fit in the return value
+	if (len > 0x7FFF) {
+		len = 0x7FFF;
+	}
+
+	int32_t length = receiveMessage(SNEP_REQUEST_PUT, buf, len, 0);
+	if (0 > length) {
+		return length;
+	}
+
+	respond(SNEP_RESPONSE_SUCCESS);
+
+	return length;
+}
+
+int16_t SNEP::serve(uint8_t *buf, uint16_t len, uint8_t *request)
+{
+	uint8_t code;
+
+	// the length must fit in the return value
+	if (len > 0x7FFF) {
+		len = 0x7FFF;
+	}
+
+	int32_t length = receiveMessage(SNEP_REQUEST_PUT, buf, len, 0, &code);
+	if (0 > length) {
+		return length;
+	}
+	if (request) {
+		*request = code;
+	}
+
+	if (SNEP_REQUEST_PUT == code) {
+		respond(SNEP_RESPONSE_SUCCESS);
+		return length;
+	}
+
+	if (SNEP_REQUEST_GET != code) {
+		DMSG("Unsupported SNEP request\n");
+		respond(SNEP_RESPONSE_NOT_IMPLEMENTED);
+		return -4;
+	}
+
+	// a GET request is the acceptable response length followed by an NDEF message
+	if (4 > length) {
+		respond(SNEP_RESPONSE_BAD_REQUEST);
+		return -4;
+	}
+	uint32_t acceptable = ((uint32_t)buf[0] << 24) + ((uint32_t)buf[1] << 16) + (buf[2] << 8) + buf[3];
+
+	NdefProvider *provider = getHandler ? getHandler(buf + 4, length - 4) : 0;
+	if (!provider) {
+		respond(getHandler ? SNEP_RESPONSE_NOT_FOUND : SNEP_RESPONSE_NOT_IMPLEMENTED);
+		return 0;
+	}
+
+	provider->open();
+	uint16_t size = provider->length();
+	if (size > acceptable) {
+		respond(SNEP_RESPONSE_EXCESS_DATA);
+		return 0;
+	}
+
+	int8_t status = sendMessage(SNEP_RESPONSE_SUCCESS, 0, size, 0, 0, provider);
+	if (0 >= status) {
+		return status;
+	}
+
+	return 0;
+}
+
+int8_t SNEP::write(const uint8_t *buf, uint16_t len, uint16_t timeout)
+{
+	int8_t status = connect(timeout);
+	if (0 >= status) {
+		return status;
+	}
+
+	status = put(buf, len);
+	if (0 >= status) {
+		return status;
+	}
+
+	close(timeout);
 
 	return 1;
 }
 
-int16_t SNEP::read(uint8_t *buf, uint8_t len, uint16_t timeout)
+int16_t SNEP::read(uint8_t *buf, uint16_t len, uint16_t timeout)
 {
-	if (0 >= llcp.activate(timeout)) {
-		DMSG("failed to activate PN532 as a target\n");
-		return -1;
+	int8_t status = accept(timeout);
+	if (0 >= status) {
+		return status;
 	}
 
-	if (0 >= llcp.waitForConnection(timeout)) {
-		DMSG("failed to set up a connection\n");
-		return -2;
+	return receive(buf, len);
+}
+
+int32_t SNEP::read(SNEPSink sink, uint16_t timeout)
+{
+	int8_t status = accept(timeout);
+	if (0 >= status) {
+		return status;
+	}
+
+	int32_t length = receiveMessage(SNEP_REQUEST_PUT, 0, 0, sink);
+	if (0 > length) {
+		return length;
+	}
+
+	respond(SNEP_RESPONSE_SUCCESS);
+
+	return length;
+}
+
+bool SNEP::respond(uint8_t code)
+{
+	headerBuf[0] = SNEP_DEFAULT_VERSION;
+	headerBuf[1] = code;
+	headerBuf[2] = 0;
+	headerBuf[3] = 0;
+	headerBuf[4] = 0;
+	headerBuf[5] = 0;
+	return llcp.write(headerBuf, SNEP_HEADER_SIZE);
+}
+
+int8_t SNEP::sendMessage(uint8_t code, const uint8_t *buf, uint32_t len, const uint8_t *prefix, uint8_t plen,
+						 NdefProvider *provider)
+{
+	uint8_t chunk[LLCP_FRAME_MIU];		// fragment read from the provider
+	uint16_t miu = llcp.getRemoteMIU();
+	uint8_t hlen = SNEP_HEADER_SIZE + plen;
+	uint16_t n = len < (uint32_t)(miu - hlen) ? len : miu - hlen;
+	uint32_t total = plen + len;
+
+	headerBuf[0] = SNEP_DEFAULT_VERSION;
+	headerBuf[1] = code;
+	headerBuf[2] = total >> 24;
+	headerBuf[3] = total >> 16;
+	headerBuf[4] = total >> 8;
+	headerBuf[5] = total;
+	if (plen) {
+		memcpy(headerBuf + SNEP_HEADER_SIZE, prefix, plen);
+	}
+	if (provider) {
+		provider->read(0, chunk, n);
+		buf = chunk;
+	}
+	if (!llcp.write(headerBuf, hlen, buf, n)) {
+		return -3;
 	}
 
-	uint16_t status = llcp.read(buf, len);
-	if (6 > status) {
+	if (n == len) {
+		return 1;
+	}
+
+	// the receiver answers the first fragment with Continue or Reject
+	uint8_t rbuf[16];
+	if (SNEP_HEADER_SIZE > llcp.read(rbuf, sizeof(rbuf))) {
 		return -3;
 	}
 
+	uint8_t proceed = (code & 0x80) ? SNEP_REQUEST_CONTINUE : SNEP_RESPONSE_CONTINUE;
+	if (proceed != rbuf[1]) {
+		DMSG("The fragmented SNEP message is rejected\n");
+		return -5;
+	}
+
+	for (uint32_t offset = n; offset < len; offset += n) {
+		n = (len - offset) < miu ? (len - offset) : miu;
+		const uint8_t *data = buf + offset;
+		if (provider) {
+			provider->read(offset, chunk, n);
+			data = chunk;
+		}
+		if (!llcp.write(0, 0, data, n)) {
+			return -3;
+		}
+	}
+
+	return 1;
+}
+
+int32_t SNEP::receiveMessage(uint8_t expect, uint8_t *buf, uint16_t len, SNEPSink sink, uint8_t *code)
+{
+	uint8_t frag[SNEP_FRAGMENT_SIZE + 3];	// + LLCP I PDU header
+
+	int16_t status = llcp.read(frag, sizeof(frag));
+	if (SNEP_HEADER_SIZE > status) {
+		return -3;
+	}
 
 	// check SNEP version
-	if (SNEP_DEFAULT_VERSION != buf[0]) {
+	if ((SNEP_DEFAULT_VERSION >> 4) != (frag[0] >> 4)) {
 		DMSG("The received SNEP message's major version is different\n");
 		// To-do: send Unsupported Version response
 		return -4;
 	}
 
-	// expect a put request
-	if (SNEP_REQUEST_PUT != buf[1]) {
-		DMSG("Expect a put request\n");
+	// with code given, any request (or any response) is taken and reported
+	if (code ? ((expect ^ frag[1]) & 0x80) : (expect != frag[1])) {
+		DMSG("Unexpected SNEP request or response\n");
 		return -4;
 	}
+	if (code) {
+		*code = frag[1];
+	}
 
-	// check message's length
-	uint32_t length = (buf[2] << 24) + (buf[3] << 16) + (buf[4] << 8) + buf[5];
-	// length should not be more than 244 (header + body < 255, header = 6 + 3 + 2)
-	if (length > (status - 6)) {
-		DMSG("The SNEP message is too large: "); 
-        DMSG_INT(length);
-        DMSG_INT(status - 6);
-		DMSG("\n");
+	uint32_t length = ((uint32_t)frag[2] << 24) + ((uint32_t)frag[3] << 16) + (frag[4] << 8) + frag[5];
+	uint16_t n = status - SNEP_HEADER_SIZE;
+	if (n > length) {
+		DMSG("The SNEP message is longer than its header says\n");
 		return -4;
 	}
-	for (uint8_t i = 0; i < length; i++) {
-		buf[i] = buf[i + 6];
+
+	// a request is answered with a response code and vice versa
+	bool request = !(expect & 0x80);
+	bool accept = sink ? sink(frag + SNEP_HEADER_SIZE, n, 0, length) : (length <= len);
+	if (!accept) {
+		DMSG("The SNEP message is too large: ");
+		DMSG_INT(length);
+		DMSG("\n");
+		respond(request ? SNEP_RESPONSE_REJECT : SNEP_REQUEST_REJECT);
+		return -5;
+	}
+	if (!sink) {
+		memcpy(buf, frag + SNEP_HEADER_SIZE, n);
 	}
 
-	// response a success SNEP message
-	headerBuf[0] = SNEP_DEFAULT_VERSION;
-	headerBuf[1] = SNEP_RESPONSE_SUCCESS;
-	headerBuf[2] = 0;
-	headerBuf[3] = 0;
-	headerBuf[4] = 0;
-	headerBuf[5] = 0;
-	llcp.write(headerBuf, 6);
+	if (n < length && !respond(request ? SNEP_RESPONSE_CONTINUE : SNEP_REQUEST_CONTINUE)) {
+		return -3;
+	}
+
+	for (uint32_t offset = n; offset < length; offset += n) {
+		status = llcp.read(frag, sizeof(frag));
+		if (0 > status) {
+			return -3;
+		}
+
+		n = status;
+		if (n > length - offset) {
+			DMSG("The SNEP fragment overruns the message\n");
+			return -4;
+		}
+
+		if (sink) {
+			sink(frag, n, offset, length);
+		} else {
+			memcpy(buf + offset, frag, n);
+		}
+	}
 
 	return length;
 }
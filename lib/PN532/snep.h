@@ -1,26 +1,133 @@
 
-
 #ifndef __SNEP_H__
 #define __SNEP_H__
 
 #include "llcp.h"
+#include "ndef_provider.h"
 
 #define SNEP_DEFAULT_VERSION	0x10	// Major: 1, Minor: 0
 
+#define SNEP_REQUEST_CONTINUE	0x00
 #define SNEP_REQUEST_PUT		0x02
 #define SNEP_REQUEST_GET		0x01
+#define SNEP_REQUEST_REJECT		0x7F
 
+#define SNEP_RESPONSE_CONTINUE	0x80
 #define SNEP_RESPONSE_SUCCESS	0x81
+#define SNEP_RESPONSE_NOT_FOUND			0xC0
+#define SNEP_RESPONSE_EXCESS_DATA		0xC1
+#define SNEP_RESPONSE_BAD_REQUEST		0xC2
+#define SNEP_RESPONSE_NOT_IMPLEMENTED	0xE0
 #define SNEP_RESPONSE_REJECT	0xFF
 
+#define SNEP_HEADER_SIZE		6
+#define SNEP_FRAGMENT_SIZE		LLCP_DEFAULT_MIU	// largest fragment the peer sends us
+
+/**
+ * Receives a SNEP message piece by piece instead of into one buffer.
+ * @param    data    next fragment of the information field
+ * @param    len     length of the fragment
+ * @param    offset  position of the fragment in the message, 0 for the first
+ * @param    total   length of the whole message
+ * @return   false to refuse the message, only honoured for the first fragment
+ */
+typedef bool (*SNEPSink)(const uint8_t *data, uint16_t len, uint32_t offset, uint32_t total);
+
+/**
+ * Answers a GET request.
+ * @param    request NDEF message of the request, identifying what is wanted
+ * @param    len     length of the request
+ * @return   provider streaming the response, 0 when there is nothing to serve
+ */
+typedef NdefProvider *(*SNEPGetHandler)(const uint8_t *request, uint16_t len);
+
 class SNEP {
 public:
 	SNEP(PN532Interface &interface) : llcp(interface) {
 		headerBuf = llcp.getHeaderBuffer(&headerBufLen);
+		initiator = false;
+		getHandler = 0;
 	};
 
+	/*
+	 * Session: connect() or accept() once per tap, then any number of put(),
+	 * get() or receive() calls over the same link, then close(). The one-shot
+	 * write() and read() below are built from these.
+	 */
+
+	/**
+    * @brief    activate as a target and connect to the peer's SNEP server
+    * @param    timeout max time to wait, 0 means no timeout
+    * @return   >0      success
+    *			=0      timeout
+    *           <0      failed
+    */
+    int8_t connect(uint16_t timeout = 0);
+
 	/**
-    * @brief    write a SNEP packet, the packet should be less than (255 - 2 - 3) bytes
+    * @brief    activate as a target and wait for the peer to connect to our SNEP server
+    * @param    timeout max time to wait, 0 means no timeout
+    * @return   >0      success
+    *			=0      timeout
+    *           <0      failed
+    */
+    int8_t accept(uint16_t timeout = 0);
+
+	/**
+    * @brief    send a PUT request over a connect()ed session and wait for Success
+    * @return   >0      success
+    *           <0      failed
+    */
+    int8_t put(const uint8_t *buf, uint16_t len);
+
+	/**
+    * @brief    send a GET request over a connect()ed session
+    * @param    request NDEF message identifying what to get
+    * @param    rlen    length of request
+    * @param    buf     the buffer to contain the response, its length is the
+    *                   acceptable length announced to the server
+    * @param    len     lenght of the buffer
+    * @return   >=0     length of the response
+    *           <0      failed
+    */
+    int16_t get(const uint8_t *request, uint16_t rlen, uint8_t *buf, uint16_t len);
+
+	/**
+    * @brief    wait for a PUT request over an accept()ed session and answer it
+    * @param    buf     the buffer to contain the packet
+    * @param    len     lenght of the buffer
+    * @return   >=0     length of the packet
+    *           <0      failed
+    */
+    int16_t receive(uint8_t *buf, uint16_t len);
+
+	/**
+    * @brief    answer GET requests in serve() from handler
+    */
+    void setGetHandler(SNEPGetHandler handler) {
+        getHandler = handler;
+    };
+
+	/**
+    * @brief    wait for one request over an accept()ed session and answer it.
+    *           A PUT is stored in buf, a GET is answered from the handler set
+    *           with setGetHandler() and its response streamed fragment by fragment
+    * @param    buf     the buffer to contain the PUT packet or the GET request
+    * @param    len     lenght of the buffer
+    * @param    request if given, receives the request code
+    * @return   >=0     length of the PUT packet, 0 after a GET
+    *           <0      failed
+    */
+    int16_t serve(uint8_t *buf, uint16_t len, uint8_t *request = 0);
+
+	/**
+    * @brief    end the session, disconnecting a connect()ed one or waiting for
+    *           the peer to disconnect an accept()ed one
+    */
+    int8_t close(uint16_t timeout = 0);
+
+	/**
+    * @brief    write a SNEP packet, fragmented when it does not fit in one LLCP packet
     * @param    buf     the buffer to contain the packet
     * @param    len     lenght of the buffer
     * @param    timeout max time to wait, 0 means no timeout
@@ -28,22 +135,39 @@ public:
     *			=0      timeout
     *           <0      failed
     */
-    int8_t write(const uint8_t *buf, uint8_t len, uint16_t timeout = 0);
+    int8_t write(const uint8_t *buf, uint16_t len, uint16_t timeout = 0);
 
     /**
-    * @brief    read a SNEP packet, the packet will be less than (255 - 2 - 3) bytes
+    * @brief    read a SNEP packet, fragments are reassembled into buf. A message
+    *           longer than len is rejected
     * @param    buf     the buffer to contain the packet
     * @param    len     lenght of the buffer
     * @param    timeout max time to wait, 0 means no timeout
     * @return   >=0     length of the packet 
     *           <0      failed
     */
-    int16_t read(uint8_t *buf, uint8_t len, uint16_t timeout = 0);
+    int16_t read(uint8_t *buf, uint16_t len, uint16_t timeout = 0);
+
+    /**
+    * @brief    read a SNEP packet of any length, passing each fragment to sink
+    * @param    sink    called for every fragment in order
+    * @param    timeout max time to wait, 0 means no timeout
+    * @return   >=0     length of the packet 
+    *           <0      failed
+    */
+    int32_t read(SNEPSink sink, uint16_t timeout = 0);
 
 private:
 	LLCP llcp;
 	uint8_t *headerBuf;
 	uint8_t headerBufLen;
+	bool initiator;
+	SNEPGetHandler getHandler;
+
+    int32_t receiveMessage(uint8_t expect, uint8_t *buf, uint16_t len, SNEPSink sink, uint8_t *code = 0);
+    int8_t sendMessage(uint8_t code, const uint8_t *buf, uint32_t len, const uint8_t *prefix = 0, uint8_t plen = 0,
+                       NdefProvider *provider = 0);
+    bool respond(uint8_t code);
 };
 
 #endif // __SNEP_H__
@@ -1,12 +1,15 @@
 
 #include "PN532_HSU.h"
 #include "PN532_debug.h"
+#include "PN532_trace.h"
 
+static const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
 
 PN532_HSU::PN532_HSU(HardwareSerial &serial)
 {
     _serial = &serial;
     command = 0;
+    _abort = false;
 }
 
 void PN532_HSU::begin()
@@ -58,35 +61,49 @@ int8_t PN532_HSU::writeCommand(const uint8_t *header, uint8_t hlen, const uint8_
     _serial->write(PN532_HOSTTOPN532);
     uint8_t sum = PN532_HOSTTOPN532;    // sum of TFI + DATA
 
-    DMSG("\nWrite: ");
-    
     _serial->write(header, hlen);
     for (uint8_t i = 0; i < hlen; i++) {
         sum += header[i];
-
-        DMSG_HEX(header[i]);
     }
 
     _serial->write(body, blen);
     for (uint8_t i = 0; i < blen; i++) {
         sum += body[i];
-
-        DMSG_HEX(body[i]);
     }
     
     uint8_t checksum = ~sum + 1;            // checksum of TFI + DATA
     _serial->write(checksum);
     _serial->write(PN532_POSTAMBLE);
 
+    PN532_TRACE(PN532_TRACE_TX, command, 0, header, hlen, body, blen);
+
     return readAckFrame();
 }
 
+void IRAM_ATTR PN532_HSU::abort()
+{
+    _abort = true;
+}
+
+void PN532_HSU::clearAbort()
+{
+    _abort = false;
+}
+
 int16_t PN532_HSU::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
+{
+    int16_t status = readFrame(buf, len, timeout);
+    if (status == PN532_TIMEOUT) {
+        cancel();
+    }
+    PN532_TRACE(PN532_TRACE_RX, command, status < 0 ? status : 0, buf, status < 0 ? 0 : status);
+    return status;
+}
+
+int16_t PN532_HSU::readFrame(uint8_t buf[], uint8_t len, uint16_t timeout)
 {
     uint8_t tmp[3];
     
-    DMSG("\nRead:  ");
-    
     /** Frame Preamble and Start Code */
     if(receive(tmp, 3, timeout)<=0){
         return PN532_TIMEOUT;
@@ -142,29 +159,49 @@ int16_t PN532_HSU::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
 
 int8_t PN532_HSU::readAckFrame()
 {
-    const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
     uint8_t ackBuf[sizeof(PN532_ACK)];
     
-    DMSG("\nAck: ");
-    
     if( receive(ackBuf, sizeof(PN532_ACK), PN532_ACK_WAIT_TIME) <= 0 ){
-        DMSG("Timeout\n");
+        DMSG("Ack timeout\n");
+        cancel();
+        PN532_TRACE(PN532_TRACE_ACK, command, PN532_TIMEOUT);
         return PN532_TIMEOUT;
     }
     
     if( memcmp(ackBuf, PN532_ACK, sizeof(PN532_ACK)) ){
-        DMSG("Invalid\n");
+        DMSG("Invalid ack\n");
+        PN532_TRACE(PN532_TRACE_ACK, command, PN532_INVALID_ACK, ackBuf, sizeof(ackBuf));
         return PN532_INVALID_ACK;
     }
+    PN532_TRACE(PN532_TRACE_ACK, command, 0);
     return 0;
 }
 
+/**
+    @brief cancel the command the PN532 is executing after a wait for it
+           failed. An ACK frame from the host aborts it, then whatever part
+           of a response was already on the way is read and dropped.
+*/
+void PN532_HSU::cancel()
+{
+    _serial->write(PN532_ACK, sizeof(PN532_ACK));
+    unsigned long quiet = millis();
+    while (millis() - quiet < PN532_HSU_CANCEL_QUIET) {
+        if (_serial->read() >= 0) {
+            quiet = millis();
+        } else {
+            delay(1);
+        }
+    }
+}
+
 /**
     @brief receive data .
     @param buf --> return value buffer.
            len --> length expect to receive.
            timeout --> time of reveiving
     @retval number of received bytes, 0 means no data received.
+            PN532_TIMEOUT after abort().
 */
 int8_t PN532_HSU::receive(uint8_t *buf, int len, uint16_t timeout)
 {
@@ -178,7 +215,13 @@ int8_t PN532_HSU::receive(uint8_t *buf, int len, uint16_t timeout)
       ret = _serial->read();
       if (ret >= 0) {
         break;
-     }
+      }
+      if (_abort) {
+        _abort = false;
+        DMSG("Aborted\n");
+        return PN532_TIMEOUT;
+      }
+      delay(1);   // let other tasks on this core run while the PN532 is busy
     } while((timeout == 0) || ((millis()- start_millis ) < timeout));
     
     if (ret < 0) {
@@ -189,7 +232,6 @@ int8_t PN532_HSU::receive(uint8_t *buf, int len, uint16_t timeout)
         }
     }
     buf[read_bytes] = (uint8_t)ret;
-    DMSG_HEX(ret);
     read_bytes++;
   }
   return read_bytes;
@@ -8,6 +8,7 @@
 #define PN532_HSU_DEBUG
 
 #define PN532_HSU_READ_TIMEOUT						(1000)
+#define PN532_HSU_CANCEL_QUIET                      (3)     // ms without a byte after a cancel
 
 class PN532_HSU : public PN532Interface {
 public:
@@ -17,12 +18,23 @@ public:
     void wakeup();
     virtual int8_t writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
     int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout);
+
+    // Ends the wait for the PN532 at once, safe from an interrupt. The command
+    // in progress is cancelled and fails with PN532_TIMEOUT. An abort while no
+    // command waits ends the next wait instead, unless clearAbort() drops it.
+    // Any wait that times out cancels its command too, so a target turning up
+    // late cannot answer the old command in place of the next one's ACK.
+    void abort();
+    void clearAbort();
     
 private:
     HardwareSerial* _serial;
     uint8_t command;
+    volatile bool _abort;
     
     int8_t readAckFrame();
+    void cancel();
+    int16_t readFrame(uint8_t buf[], uint8_t len, uint16_t timeout);
     
     int8_t receive(uint8_t *buf, int len, uint16_t timeout=PN532_HSU_READ_TIMEOUT);
 };
@@ -0,0 +1,245 @@
+
+#include "PN532_SPI.h"
+#include "PN532_debug.h"
+#include "PN532_trace.h"
+
+#define STATUS_READ     2
+#define DATA_WRITE      1
+#define DATA_READ       3
+
+PN532_SPI::PN532_SPI(SPIClass &spi, uint8_t ss, uint8_t irq)
+#ifdef PN532_SPI_HW_LSBFIRST
+    : _settings(PN532_SPI_CLOCK, LSBFIRST, SPI_MODE0)
+#else
+    : _settings(PN532_SPI_CLOCK, MSBFIRST, SPI_MODE0)
+#endif
+{
+    command = 0;
+    _spi = &spi;
+    _ss  = ss;
+    _irq = irq;
+#ifdef ESP32
+    _ready = NULL;
+#endif
+}
+
+#ifdef ESP32
+static void IRAM_ATTR onReady(void *arg)
+{
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR((SemaphoreHandle_t)arg, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+#endif
+
+void PN532_SPI::begin()
+{
+    pinMode(_ss, OUTPUT);
+    digitalWrite(_ss, HIGH);
+    if (_irq != PN532_SPI_NO_IRQ) {
+        pinMode(_irq, INPUT);
+#ifdef ESP32
+        if (_ready == NULL) {
+            _ready = xSemaphoreCreateBinary();
+            attachInterruptArg(_irq, onReady, _ready, FALLING);
+        }
+#endif
+    }
+
+    _spi->begin();
+}
+
+void PN532_SPI::wakeup()
+{
+    // only a sleeping PN532 needs SS held low for a while
+    select();
+    delay(2);
+    deselect();
+}
+
+int8_t PN532_SPI::writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    command = header[0];
+    writeFrame(header, hlen, body, blen);
+    PN532_TRACE(PN532_TRACE_TX, command, 0, header, hlen, body, blen);
+
+    if (!waitReady(PN532_ACK_WAIT_TIME)) {
+        DMSG("Time out when waiting for ACK\n");
+        PN532_TRACE(PN532_TRACE_ACK, command, PN532_TIMEOUT);
+        return PN532_TIMEOUT;
+    }
+    if (readAckFrame()) {
+        DMSG("Invalid ACK\n");
+        PN532_TRACE(PN532_TRACE_ACK, command, PN532_INVALID_ACK);
+        return PN532_INVALID_ACK;
+    }
+    PN532_TRACE(PN532_TRACE_ACK, command, 0);
+    return 0;
+}
+
+int16_t PN532_SPI::readResponse(uint8_t buf[], uint8_t len, uint16_t timeout)
+{
+    if (!waitReady(timeout)) {
+        PN532_TRACE(PN532_TRACE_RX, command, PN532_TIMEOUT);
+        return PN532_TIMEOUT;
+    }
+
+    select();
+
+    int16_t result;
+    do {
+        write(DATA_READ);
+
+        if (0x00 != read()      ||       // PREAMBLE
+                0x00 != read()  ||       // STARTCODE1
+                0xFF != read()           // STARTCODE2
+           ) {
+
+            result = PN532_INVALID_FRAME;
+            break;
+        }
+
+        uint8_t length = read();
+        if (0 != (uint8_t)(length + read()) || length < 2) {   // checksum of length, TFI and command included
+            result = PN532_INVALID_FRAME;
+            break;
+        }
+
+        uint8_t cmd = command + 1;               // response command
+        if (PN532_PN532TOHOST != read() || (cmd) != read()) {
+            result = PN532_INVALID_FRAME;
+            break;
+        }
+
+        length -= 2;
+        if (length > len) {
+            for (uint8_t i = 0; i < length; i++) {
+                read();                          // drain message
+            }
+            DMSG("\nNot enough space\n");
+            read();
+            read();
+            result = PN532_NO_SPACE;  // not enough space
+            break;
+        }
+
+        uint8_t sum = PN532_PN532TOHOST + cmd;
+        for (uint8_t i = 0; i < length; i++) {
+            buf[i] = read();
+            sum += buf[i];
+        }
+
+        uint8_t checksum = read();
+        if (0 != (uint8_t)(sum + checksum)) {
+            DMSG("checksum is not ok\n");
+            result = PN532_INVALID_FRAME;
+            break;
+        }
+        read();         // POSTAMBLE
+
+        result = length;
+    } while (0);
+
+    deselect();
+
+    PN532_TRACE(PN532_TRACE_RX, command, result < 0 ? result : 0, buf, result < 0 ? 0 : result);
+
+    return result;
+}
+
+bool PN532_SPI::isReady()
+{
+    if (_irq != PN532_SPI_NO_IRQ) {
+        return LOW == digitalRead(_irq);
+    }
+
+    select();
+    write(STATUS_READ);
+    uint8_t status = read() & 1;
+    deselect();
+    return status;
+}
+
+/**
+    @brief wait until the PN532 has a frame to read.
+    @param timeout in ms, 0 waits for ever.
+    @retval true if ready, false on timeout.
+*/
+bool PN532_SPI::waitReady(uint16_t timeout)
+{
+#ifdef ESP32
+    if (_irq != PN532_SPI_NO_IRQ) {
+        xSemaphoreTake(_ready, 0);      // an edge of an earlier frame
+        if (LOW == digitalRead(_irq)) {
+            return true;
+        }
+        TickType_t ticks = timeout > 0 ? pdMS_TO_TICKS(timeout) + 1 : portMAX_DELAY;
+        return pdTRUE == xSemaphoreTake(_ready, ticks);
+    }
+#endif
+
+    unsigned long start = micros();
+    unsigned long limit = (unsigned long)timeout * 1000;
+    while (!isReady()) {
+        unsigned long waited = micros() - start;
+        if (timeout > 0 && waited >= limit) {
+            return false;
+        }
+        if (waited < PN532_SPI_SPIN_US) {
+            delayMicroseconds(PN532_SPI_POLL_US);
+        } else {
+            delay(1);
+        }
+    }
+    return true;
+}
+
+void PN532_SPI::writeFrame(const uint8_t *header, uint8_t hlen, const uint8_t *body, uint8_t blen)
+{
+    select();
+
+    write(DATA_WRITE);
+    write(PN532_PREAMBLE);
+    write(PN532_STARTCODE1);
+    write(PN532_STARTCODE2);
+
+    uint8_t length = hlen + blen + 1;   // length of data field: TFI + DATA
+    write(length);
+    write(~length + 1);                 // checksum of length
+
+    write(PN532_HOSTTOPN532);
+    uint8_t sum = PN532_HOSTTOPN532;    // sum of TFI + DATA
+
+    for (uint8_t i = 0; i < hlen; i++) {
+        write(header[i]);
+        sum += header[i];
+    }
+    for (uint8_t i = 0; i < blen; i++) {
+        write(body[i]);
+        sum += body[i];
+    }
+
+    uint8_t checksum = ~sum + 1;        // checksum of TFI + DATA
+    write(checksum);
+    write(PN532_POSTAMBLE);
+
+    deselect();
+}
+
+int8_t PN532_SPI::readAckFrame()
+{
+    const uint8_t PN532_ACK[] = {0, 0, 0xFF, 0, 0xFF, 0};
+
+    uint8_t ackBuf[sizeof(PN532_ACK)];
+
+    select();
+    write(DATA_READ);
+
+    for (uint8_t i = 0; i < sizeof(PN532_ACK); i++) {
+        ackBuf[i] = read();
+    }
+
+    deselect();
+
+    return memcmp(ackBuf, PN532_ACK, sizeof(PN532_ACK));
+}
@@ -0,0 +1,77 @@
+
+#ifndef __PN532_SPI_H__
+#define __PN532_SPI_H__
+
+#include <SPI.h>
+#include "PN532Interface.h"
+
+#define PN532_SPI_CLOCK                 (5000000)  // Hz, PN532 maximum
+#define PN532_SPI_NO_IRQ                (0xFF)
+
+// A wait polls every PN532_SPI_POLL_US for its first PN532_SPI_SPIN_US, where
+// ACKs and quick responses arrive, then every ms so the core is not held
+// through a long card poll. With the IRQ pin the ESP32 sleeps on its edge.
+#define PN532_SPI_POLL_US               (20)
+#define PN532_SPI_SPIN_US               (2000)
+
+// The PN532 shifts LSB first. Bytes are reversed in software and the bus is
+// kept MSB first, so sharing it with an MSB-first device (the TFT) never
+// depends on the controller honouring LSBFIRST. Define
+// PN532_SPI_HW_LSBFIRST to let the SPI peripheral do the reversal instead.
+
+class PN532_SPI : public PN532Interface {
+public:
+    /**
+    * @param    spi     bus shared with other devices, transactions are used
+    * @param    ss      chip select pin
+    * @param    irq     PN532 IRQ pin, PN532_SPI_NO_IRQ to poll the status byte
+    */
+    PN532_SPI(SPIClass &spi, uint8_t ss, uint8_t irq = PN532_SPI_NO_IRQ);
+
+    void begin();
+    void wakeup();
+    virtual int8_t writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout);
+
+private:
+    SPIClass* _spi;
+    SPISettings _settings;
+    uint8_t _ss;
+    uint8_t _irq;
+    uint8_t command;
+#ifdef ESP32
+    SemaphoreHandle_t _ready;           // given by the IRQ pin's falling edge
+#endif
+
+    bool isReady();
+    bool waitReady(uint16_t timeout);
+    void writeFrame(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0);
+    int8_t readAckFrame();
+
+    void select() {
+        _spi->beginTransaction(_settings);
+        digitalWrite(_ss, LOW);
+    };
+
+    void deselect() {
+        digitalWrite(_ss, HIGH);
+        _spi->endTransaction();
+    };
+
+    inline void write(uint8_t data) {
+#ifndef PN532_SPI_HW_LSBFIRST
+        REVERSE_BITS_ORDER(data);
+#endif
+        _spi->transfer(data);
+    };
+
+    inline uint8_t read() {
+        uint8_t data = _spi->transfer(0);
+#ifndef PN532_SPI_HW_LSBFIRST
+        REVERSE_BITS_ORDER(data);
+#endif
+        return data;
+    };
+};
+
+#endif
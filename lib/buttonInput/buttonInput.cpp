@@ -0,0 +1,87 @@
+// buttonInput.cpp
+// debounced push button read from a GPIO interrupt, with long press detection
+
+// include Arduino.h for attachInterruptArg(), digitalRead() and millis()
+#include <Arduino.h>
+#include <buttonInput.h>
+
+buttonInput::buttonInput(uint8_t pin, uint8_t activeLevel) {
+  this->pin = pin;
+  this->activeLevel = activeLevel;
+  handler = 0;
+  context = 0;
+  pressed = false;
+  lastEdge = 0;
+  pressTime = 0;
+  ignored = 0;
+  pending = false;
+  pendingTime = 0;
+}
+
+void buttonInput::begin(buttonHandler handler, void *context) {
+  this->handler = handler;
+  this->context = context;
+  pinMode(pin, INPUT);
+  pressed = digitalRead(pin) == activeLevel;
+  lastEdge = millis();
+  pressTime = lastEdge;
+  pending = false;
+  attachInterruptArg(pin, isr, this, CHANGE);
+}
+
+void buttonInput::end() {
+  detachInterrupt(pin);
+}
+
+bool buttonInput::isPressed() const {
+  return pressed;
+}
+
+uint32_t buttonInput::bounces() const {
+  return ignored;
+}
+
+void IRAM_ATTR buttonInput::isr(void *arg) {
+  buttonInput *button = (buttonInput *)arg;
+  uint32_t now = millis();
+  bool level = digitalRead(button->pin) == button->activeLevel;
+
+  if (now - button->lastEdge < BUTTON_DEBOUNCE_MS) {
+    // bounce, remember whether the pin ended up changed in case no edge follows in the window
+    if (level != button->pressed) {
+      button->ignored++;
+    }
+    button->pending = level != button->pressed;
+    button->pendingTime = now;
+    return;
+  }
+
+  if (button->pending) {
+    button->pending = false;
+    if (!button->pressed && level == button->pressed) {
+      // pressed again inside the window of a release and released by now: the
+      // release was a bounce outlasting the window, do not report a second press
+      button->ignored++;
+      button->lastEdge = now;
+      return;
+    }
+    // the pin stayed changed past the window, that change happened first
+    button->change(!button->pressed, button->pendingTime);
+  }
+  if (level != button->pressed) {
+    button->change(level, now);
+  }
+}
+
+void IRAM_ATTR buttonInput::change(bool level, uint32_t time) {
+  pressed = level;
+  lastEdge = time;
+  if (level) {
+    pressTime = time;
+    if (handler) {
+      handler(BUTTON_PRESS, time, context);
+    }
+  } else if (time - pressTime >= BUTTON_LONG_PRESS_MS && handler) {
+    handler(BUTTON_LONG_PRESS, time, context);
+  }
+}
@@ -0,0 +1,95 @@
+// buttonInput.h
+// debounced push button read from a GPIO interrupt, with long press detection
+
+#ifndef BUTTON_INPUT_H
+#define BUTTON_INPUT_H
+
+#include <stdint.h>
+
+// edges this soon after the last accepted one are contact bounce
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS 30
+#endif
+
+// a press held at least this long is reported as BUTTON_LONG_PRESS on release
+#ifndef BUTTON_LONG_PRESS_MS
+#define BUTTON_LONG_PRESS_MS 2000
+#endif
+
+// events passed to the buttonHandler
+#define BUTTON_PRESS      0  // pressed, reported on the first edge
+#define BUTTON_LONG_PRESS 1  // released after BUTTON_LONG_PRESS_MS or more
+
+/**
+  Called from the interrupt, keep it short and only use ISR safe calls,
+  e.g. push to an eventRing whose notify hook uses vTaskNotifyGiveFromISR()
+  @param event BUTTON_PRESS or BUTTON_LONG_PRESS
+  @param time millis() of the edge
+*/
+typedef void (*buttonHandler)(uint8_t event, uint32_t time, void *context);
+
+/**************
+  **buttonInput** replaces polling digitalRead() of a button from loop().
+
+  Create one per button and start it once, usually in setup()<br>
+  <code>buttonInput cancelButton(CANCEL_BUTTON_PIN);</code><br>
+  <code>cancelButton.begin(onCancel);</code><br>
+  Every edge of the pin raises an interrupt. The first edge that changes the
+  state is taken at once, so a press is reported within microseconds, and
+  edges during the following BUTTON_DEBOUNCE_MS are ignored as bounce. If the
+  pin was last seen changed inside that window, e.g. a tap shorter than the
+  window, the change is settled on the next edge with the time it was seen,
+  before that edge itself is taken, so no press or release is lost. A press
+  seen inside the window of a release and gone by that next edge is taken
+  for a bounce that outlasted the window, not for a second press.<br>
+
+  The handler is only called from the interrupt, so it is the single
+  producer of whatever it feeds.
+****************************************************************************************/
+class buttonInput {
+  public:
+
+    /**
+      @param pin GPIO of the button
+      @param activeLevel level of the pin while pressed
+    */
+    buttonInput(uint8_t pin, uint8_t activeLevel = 1);
+
+    /**
+      Configure the pin and attach the interrupt
+    */
+    void begin(buttonHandler handler, void *context = 0);
+
+    /**
+      Detach the interrupt, no more events are reported
+    */
+    void end();
+
+    /**
+      Is the button held, after debouncing. A change inside the debounce
+      window only shows once the next edge settled it.
+    */
+    bool isPressed() const;
+
+    /**
+      Edges ignored as contact bounce since begin()
+    */
+    uint32_t bounces() const;
+
+  private:
+    static void isr(void *arg);
+    void change(bool level, uint32_t time);
+
+    uint8_t pin;
+    uint8_t activeLevel;
+    buttonHandler handler;
+    void *context;
+    volatile bool pressed;
+    volatile uint32_t lastEdge;
+    volatile uint32_t pressTime;
+    volatile uint32_t ignored;
+    volatile bool pending;        // the last ignored edge left the pin changed
+    volatile uint32_t pendingTime;
+};
+
+#endif
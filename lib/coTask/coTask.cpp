@@ -0,0 +1,73 @@
+// coTask.cpp
+// stackless cooperative tasks written as straight-line code, in the style of protothreads
+
+// include Arduino.h for millis() and micros()
+#include <Arduino.h>
+#include <coTask.h>
+
+coScheduler::coScheduler() {
+  taskCount = 0;
+}
+
+/**
+   Register a task, it runs from the next run()
+*/
+int8_t coScheduler::add(const char *name, coTaskFunction function) {
+  if (taskCount >= CO_SCHEDULER_SIZE) {
+    return -1;
+  }
+  coTask &task = tasks[taskCount];
+  task.name = name;
+  task.function = function;
+  task.line = 0;
+  task.sleeping = false;
+  task.wakeAt = 0;
+  task.calls = 0;
+  task.runMicros = 0;
+  task.maxMicros = 0;
+  return taskCount++;
+}
+
+/**
+   Run each task that is not asleep once
+*/
+void coScheduler::run() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    coTask &task = tasks[i];
+    if (task.sleeping) {
+      if ((long)(millis() - task.wakeAt) < 0) {
+        continue;
+      }
+      task.sleeping = false;
+    }
+
+    unsigned long start = micros();
+    task.function(&task);
+    uint32_t elapsed = micros() - start;
+
+    task.calls++;
+    task.runMicros += elapsed;
+    if (elapsed > task.maxMicros) {
+      task.maxMicros = elapsed;
+    }
+  }
+}
+
+uint8_t coScheduler::count() {
+  return taskCount;
+}
+
+const coTask *coScheduler::get(int8_t id) {
+  if (id < 0 || id >= taskCount) {
+    return 0;
+  }
+  return &tasks[id];
+}
+
+void coScheduler::resetStats() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    tasks[i].calls = 0;
+    tasks[i].runMicros = 0;
+    tasks[i].maxMicros = 0;
+  }
+}
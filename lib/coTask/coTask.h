@@ -0,0 +1,102 @@
+// coTask.h
+// stackless cooperative tasks written as straight-line code, in the style of protothreads
+
+#ifndef CO_TASK_H
+#define CO_TASK_H
+
+#include <stdint.h>
+
+// maximum number of tasks added with add()
+#ifndef CO_SCHEDULER_SIZE
+#define CO_SCHEDULER_SIZE 8
+#endif
+
+// task function results
+#define TASK_WAITING 0  // blocked in TASK_AWAIT(), TASK_YIELD() or TASK_SLEEP()
+#define TASK_ENDED   1  // reached TASK_END(), it starts again from TASK_BEGIN() on the next run
+
+struct coTask;
+typedef uint8_t (*coTaskFunction)(coTask *task);
+
+/**************
+  **coTask** lets a flow that waits on events be written top to bottom instead
+  of as a state machine, e.g.<br>
+  <code>uint8_t blink(coTask *task) {<br>
+  &nbsp; TASK_BEGIN(task);<br>
+  &nbsp; while (true) {<br>
+  &nbsp; &nbsp; TASK_AWAIT(task, buttonPressed());<br>
+  &nbsp; &nbsp; digitalWrite(LED, HIGH);<br>
+  &nbsp; &nbsp; TASK_SLEEP(task, 500);<br>
+  &nbsp; &nbsp; digitalWrite(LED, LOW);<br>
+  &nbsp; }<br>
+  &nbsp; TASK_END(task);<br>
+  }</code><br>
+
+  Each wait saves the line to resume at and returns to the scheduler, so:<br>
+  - local variables do not keep their value across a wait, use globals or statics<br>
+  - a wait must not sit inside a switch() statement of the task's own<br>
+  - the condition of TASK_AWAIT() is re-evaluated on every pass of coScheduler::run(),
+    keep it short or bound how long it may block
+****************************************************************************************/
+struct coTask {
+  const char *name;
+  coTaskFunction function;
+  uint16_t line;          // where to resume, 0 at TASK_BEGIN()
+  bool sleeping;          // in TASK_SLEEP(), not run before wakeAt
+  unsigned long wakeAt;   // millis()
+  uint32_t calls;         // times the function was run
+  uint32_t runMicros;     // total time spent in the function
+  uint32_t maxMicros;     // longest single run
+};
+
+#define TASK_BEGIN(task)          switch ((task)->line) { case 0:
+
+#define TASK_END(task)            } (task)->line = 0; return TASK_ENDED
+
+#define TASK_YIELD(task)          do { (task)->line = __LINE__; return TASK_WAITING; case __LINE__:; } while (0)
+
+#define TASK_AWAIT(task, cond)    do { (task)->line = __LINE__; case __LINE__: if (!(cond)) return TASK_WAITING; } while (0)
+
+#define TASK_SLEEP(task, ms)      do { (task)->wakeAt = millis() + (ms); (task)->sleeping = true; TASK_YIELD(task); } while (0)
+
+/**************
+  **coScheduler** runs every task once per run(), skipping sleeping ones, and
+  keeps the time spent in each so it is known where loop() goes.
+****************************************************************************************/
+class coScheduler {
+  public:
+
+    coScheduler();
+
+    /**
+      Register a task, it runs from the next run()
+      @param name for reports, not copied
+      @return task id, -1 if all CO_SCHEDULER_SIZE tasks are in use
+    */
+    int8_t add(const char *name, coTaskFunction function);
+
+    /**
+      Run each task that is not asleep once, call this every loop
+    */
+    void run();
+
+    /**
+      Number of tasks added
+    */
+    uint8_t count();
+
+    /**
+      A task and its run time counters, 0 if id is out of range
+    */
+    const coTask *get(int8_t id);
+
+    /**
+      Clear the run time counters of all tasks
+    */
+    void resetStats();
+
+  private:
+    coTask tasks[CO_SCHEDULER_SIZE];
+    uint8_t taskCount;
+};
+#endif
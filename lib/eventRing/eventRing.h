@@ -0,0 +1,134 @@
+// eventRing.h
+// fixed capacity, lock-free ring passing typed events from one task to another
+
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdint.h>
+#include <atomic>
+
+// push() may run in an interrupt, so on the ESP32 it must not sit in flash
+#ifdef ESP32
+#include <esp_attr.h>
+#define EVENT_RING_IRAM IRAM_ATTR
+#else
+#define EVENT_RING_IRAM
+#endif
+
+// called by push() after an event was added, e.g. to give a task notification
+typedef void (*eventNotify)(void *context);
+
+// called by pop() while the ring is empty, returns false once timeout ms passed
+typedef bool (*eventWait)(void *context, uint32_t timeout);
+
+/**************
+  **eventRing** carries events of type T from exactly one producer task to
+  exactly one consumer task without locks, heap or copies through a queue
+  handle.
+
+  Declare the ring with a power of two capacity<br>
+  <code>eventRing&lt;ItemClassified, 8&gt; items;</code><br>
+  the producer calls <code>items.push(event);</code> and the consumer
+  <code>items.pop(&amp;event);</code>. A full ring drops the new event and
+  counts it in dropped(), the producer never waits.<br>
+
+  The producer owns head and the consumer owns tail, each only reads the
+  other's index, so the acquire/release pair is all the synchronisation
+  needed, on one core or across both.<br>
+
+  setNotify() and setWait() hook the ring to the consumer's way of sleeping,
+  e.g. xTaskNotifyGive() and ulTaskNotifyTake(). Several rings read by the
+  same task may share one notification.
+****************************************************************************************/
+template <typename T, uint16_t SIZE>
+class eventRing {
+  public:
+
+    eventRing() : head(0), tail(0), lost(0), notify(0), wait(0), notifyContext(0), waitContext(0) {
+      static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "eventRing size must be a power of two");
+    }
+
+    /**
+      Set the hook push() calls after adding an event, producer side
+    */
+    void setNotify(eventNotify hook, void *context = 0) {
+      notify = hook;
+      notifyContext = context;
+    }
+
+    /**
+      Set the hook pop() calls to sleep while the ring is empty, consumer side
+    */
+    void setWait(eventWait hook, void *context = 0) {
+      wait = hook;
+      waitContext = context;
+    }
+
+    /**
+      Add an event, only from the producer task or interrupt. Kept in IRAM,
+      a notify hook called from an interrupt must be IRAM_ATTR too
+      @return true if added, false if the ring was full and the event dropped
+    */
+    EVENT_RING_IRAM bool push(const T &event) {
+      uint32_t h = head.load(std::memory_order_relaxed);
+      if (h - tail.load(std::memory_order_acquire) >= SIZE) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      ring[h & (SIZE - 1)] = event;
+      head.store(h + 1, std::memory_order_release);
+      if (notify) {
+        notify(notifyContext);
+      }
+      return true;
+    }
+
+    /**
+      Take the oldest event, only from the consumer task
+      @param timeout in ms to wait through the wait hook when empty, 0 to return at once.
+      Only wait here when no other ring shares the consumer's notification, a
+      wake-up meant for another ring would be taken by this one
+      @return true if an event was copied to event
+    */
+    bool pop(T *event, uint32_t timeout = 0) {
+      uint32_t t = tail.load(std::memory_order_relaxed);
+      while (t == head.load(std::memory_order_acquire)) {
+        if (timeout == 0 || !wait || !wait(waitContext, timeout)) {
+          return false;
+        }
+      }
+      *event = ring[t & (SIZE - 1)];
+      tail.store(t + 1, std::memory_order_release);
+      return true;
+    }
+
+    /**
+      Number of events waiting, exact from either side at the time of the call
+    */
+    uint16_t count() const {
+      return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    bool isEmpty() const {
+      return count() == 0;
+    }
+
+    /**
+      Number of events dropped because the ring was full
+    */
+    uint32_t dropped() const {
+      return lost.load(std::memory_order_relaxed);
+    }
+
+  private:
+    T ring[SIZE];
+    std::atomic<uint32_t> head;   // next slot to write, owned by the producer
+    std::atomic<uint32_t> tail;   // next slot to read, owned by the consumer
+    std::atomic<uint32_t> lost;
+    eventNotify notify;
+    eventWait wait;
+    void *notifyContext;
+    void *waitContext;
+};
+
+#endif
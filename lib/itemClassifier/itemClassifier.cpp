@@ -0,0 +1,106 @@
+// itemClassifier.cpp
+// decides what was inserted from the filtered sensor waveforms over the insertion window
+
+#include <itemClassifier.h>
+
+// drop below the baseline relative to the calibrated depth, 0 when above the baseline
+static uint16_t relativeDepth(int32_t baseline, int32_t level, int32_t calibrated) {
+  int32_t drop = baseline - level;
+  if (drop <= 0) return 0;
+  if (calibrated <= 0) calibrated = 1;
+  int32_t depth = (drop << ITEM_Q_SHIFT) / calibrated;
+  return depth > 0xFFFF ? 0xFFFF : depth;
+}
+
+itemFeatureExtractor::itemFeatureExtractor() {
+  reset();
+}
+
+void itemFeatureExtractor::reset() {
+  window.frames = 0;
+  window.irDepth = 0;
+  window.metalDepth = 0;
+  window.irRise = 0;
+  window.metalRise = 0;
+  window.metalCoverage = 0;
+  metalFrames = 0;
+}
+
+void itemFeatureExtractor::add(const sensorFilter &filter) {
+  const sensorCalibration &calibration = filter.calibration();
+  uint16_t ir = relativeDepth(filter.irBaseline(), filter.ir(), (int32_t)calibration.irIdle - calibration.irObject);
+  uint16_t metal = relativeDepth(filter.metalBaseline(), filter.metal(),
+                                 (int32_t)calibration.metalIdle - calibration.metalMetal);
+
+  bool irRisen = window.irDepth >= ITEM_Q_ONE * 7 / 8;
+  bool metalRisen = window.metalDepth >= ITEM_Q_ONE / 2;
+
+  if (window.frames < 0xFFFF) {
+    window.frames++;
+  }
+  if (ir > window.irDepth) {
+    window.irDepth = ir;
+  }
+  if (metal > window.metalDepth) {
+    window.metalDepth = metal;
+  }
+  if (!irRisen) {
+    window.irRise = window.frames;
+  }
+  if (!metalRisen) {
+    window.metalRise = window.frames;
+  }
+  if (metal >= ITEM_Q_ONE / 2 && metalFrames < 0xFFFF) {
+    metalFrames++;
+  }
+  window.metalCoverage = ((uint32_t)metalFrames << ITEM_Q_SHIFT) / window.frames;
+}
+
+uint16_t itemFeatureExtractor::frames() const {
+  return window.frames;
+}
+
+const itemFeatures &itemFeatureExtractor::features() const {
+  return window;
+}
+
+treeClassifier::treeClassifier(const itemTreeNode *nodes, uint8_t count) {
+  this->nodes = nodes;
+  this->count = count;
+}
+
+treeClassifier::treeClassifier() {
+  nodes = ITEM_TREE;
+  count = ITEM_TREE_COUNT;
+}
+
+itemClass treeClassifier::classify(const itemFeatures &features) const {
+  const uint16_t values[] = {features.frames, features.irDepth, features.metalDepth,
+                             features.irRise, features.metalRise, features.metalCoverage};
+  itemClass result = {MATERIAL_UNKNOWN, 0};
+
+  uint8_t i = 0;
+  while (i < count) {
+    const itemTreeNode &node = nodes[i];
+    if (node.feature == FEATURE_LEAF) {
+      result.material = (itemMaterial)node.material;
+      result.confidence = node.confidence;
+      break;
+    }
+    if (node.feature >= FEATURE_LEAF) break;
+    uint8_t next = values[node.feature] < node.threshold ? node.below : node.above;
+    if (next <= i) break;  // a table not checked by itemTreeValid() must not loop
+    i = next;
+  }
+  return result;
+}
+
+const char *itemMaterialName(itemMaterial material) {
+  switch (material) {
+    case MATERIAL_CAN:     return "can";
+    case MATERIAL_OTHER:   return "other";
+    case MATERIAL_FOIL:    return "foil";
+    case MATERIAL_PARTIAL: return "partial";
+    default:               return "unknown";
+  }
+}
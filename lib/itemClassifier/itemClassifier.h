@@ -0,0 +1,161 @@
+// itemClassifier.h
+// decides what was inserted from the filtered sensor waveforms over the insertion window
+
+#ifndef ITEM_CLASSIFIER_H
+#define ITEM_CLASSIFIER_H
+
+#include <stdint.h>
+#include <sensorFilter.h>
+
+// depths and coverage are fixed point, ITEM_Q_ONE is the full calibrated depth
+#define ITEM_Q_SHIFT 10
+#define ITEM_Q_ONE   (1 << ITEM_Q_SHIFT)
+
+enum itemMaterial {
+  MATERIAL_UNKNOWN = 0,
+  MATERIAL_CAN,       // accepted
+  MATERIAL_OTHER,     // no metal, e.g. a plastic bottle
+  MATERIAL_FOIL,      // thin or intermittent metal, e.g. foil wrapped or crumpled
+  MATERIAL_PARTIAL,   // not inserted far enough to tell, classify again later
+};
+
+/**
+  Shape of the filtered waveforms from the moment an object appeared.
+  Depths are the drop below the idle baseline, relative to the calibrated
+  depth of the channel, ITEM_Q_ONE when it dropped as far as at calibration.
+*/
+struct itemFeatures {
+  uint16_t frames;         // frames in the window
+  uint16_t irDepth;        // deepest IR drop
+  uint16_t metalDepth;     // deepest metal drop
+  uint16_t irRise;         // frames until the IR drop reached 7/8 of the calibrated depth, frames if never
+  uint16_t metalRise;      // frames until the metal drop reached half the calibrated depth, frames if never
+  uint16_t metalCoverage;  // part of the window the metal drop was past half, ITEM_Q_ONE for all of it
+};
+
+struct itemClass {
+  itemMaterial material;
+  uint8_t confidence;      // percent
+};
+
+/**************
+  **itemFeatureExtractor** measures itemFeatures from a sensorFilter.
+
+  Call <code>extractor.add(filter);</code> for every frame while
+  filter.objectPresent(), then take <code>extractor.features()</code> and
+  <code>extractor.reset();</code> before the next item. All arithmetic is
+  integer.
+****************************************************************************************/
+class itemFeatureExtractor {
+  public:
+
+    itemFeatureExtractor();
+
+    void reset();
+
+    /**
+      Add the current filtered levels of one frame
+    */
+    void add(const sensorFilter &filter);
+
+    uint16_t frames() const;
+
+    const itemFeatures &features() const;
+
+  private:
+    itemFeatures window;
+    uint16_t metalFrames;
+};
+
+/**
+  Pluggable decision on the features of one insertion window
+*/
+class itemClassifier {
+  public:
+    virtual ~itemClassifier() {}
+    virtual itemClass classify(const itemFeatures &features) const = 0;
+};
+
+// features a tree node compares, in itemFeatures order
+enum itemFeature {
+  FEATURE_FRAMES = 0,
+  FEATURE_IR_DEPTH,
+  FEATURE_METAL_DEPTH,
+  FEATURE_IR_RISE,
+  FEATURE_METAL_RISE,
+  FEATURE_METAL_COVERAGE,
+  FEATURE_LEAF,
+};
+
+/**
+  One node of a decision tree. An inner node goes to below when the feature
+  is less than threshold and to above otherwise, a leaf (FEATURE_LEAF) gives
+  material and confidence.
+*/
+struct itemTreeNode {
+  uint8_t feature;
+  uint16_t threshold;
+  uint8_t below;
+  uint8_t above;
+  uint8_t material;
+  uint8_t confidence;
+};
+
+/**************
+  **treeClassifier** walks a decision tree held in a constant table, from
+  node 0 to a leaf, a handful of integer compares. The default table
+  ITEM_TREE is hand-set from the calibrated levels and is meant to be
+  retuned against recorded sensor traces.
+****************************************************************************************/
+class treeClassifier : public itemClassifier {
+  public:
+    treeClassifier(const itemTreeNode *nodes, uint8_t count);
+    treeClassifier();
+
+    itemClass classify(const itemFeatures &features) const override;
+
+  private:
+    const itemTreeNode *nodes;
+    uint8_t count;
+};
+
+constexpr itemTreeNode ITEM_TREE[] = {
+    /* 0 */ {FEATURE_IR_DEPTH, ITEM_Q_ONE / 2, 1, 2, 0, 0},        // sensorFilter's object threshold
+    /* 1 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_PARTIAL, 70},
+    /* 2 */ {FEATURE_METAL_DEPTH, ITEM_Q_ONE / 4, 3, 6, 0, 0},
+    /* 3 */ {FEATURE_IR_DEPTH, ITEM_Q_ONE * 3 / 4, 4, 5, 0, 0},    // no metal yet, a can may still be on its way in
+    /* 4 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_PARTIAL, 60},
+    /* 5 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_OTHER, 90},
+    /* 6 */ {FEATURE_METAL_COVERAGE, ITEM_Q_ONE / 2, 7, 10, 0, 0}, // metal seen only in passing
+    /* 7 */ {FEATURE_IR_DEPTH, ITEM_Q_ONE * 3 / 4, 8, 9, 0, 0},    // or a can still coming into the coil
+    /* 8 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_PARTIAL, 60},
+    /* 9 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_FOIL, 60},
+    /* 10 */ {FEATURE_METAL_DEPTH, ITEM_Q_ONE / 2, 11, 12, 0, 0},  // thin metal, shallow drop
+    /* 11 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_FOIL, 70},
+    /* 12 */ {FEATURE_METAL_RISE, 15, 13, 14, 0, 0},               // a can fills the coil at once
+    /* 13 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_CAN, 95},
+    /* 14 */ {FEATURE_LEAF, 0, 0, 0, MATERIAL_CAN, 75},
+};
+
+constexpr uint8_t ITEM_TREE_COUNT = sizeof(ITEM_TREE) / sizeof(ITEM_TREE[0]);
+
+// every inner node points further down the table, so a walk always ends on a leaf
+constexpr bool itemTreeValid(const itemTreeNode *nodes, uint8_t count, uint8_t i)
+{
+    return i >= count
+        ? true
+        : (nodes[i].feature == FEATURE_LEAF
+            ? nodes[i].confidence <= 100
+            : nodes[i].feature < FEATURE_LEAF && nodes[i].below > i && nodes[i].above > i &&
+              nodes[i].below < count && nodes[i].above < count) &&
+          itemTreeValid(nodes, count, i + 1);
+}
+
+static_assert(itemTreeValid(ITEM_TREE, ITEM_TREE_COUNT, 0), "ITEM_TREE must only point down to valid nodes");
+
+/**
+  Human readable material, for logs
+*/
+const char *itemMaterialName(itemMaterial material);
+
+#endif
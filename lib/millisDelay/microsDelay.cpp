@@ -0,0 +1,164 @@
+// microsDelay.cpp
+// microsecond companion to millisDelay, on a 64 bit tick that does not roll over
+
+#include <microsDelay.h>
+
+#ifdef ESP32
+#include <esp_timer.h>
+
+uint64_t microsTicks() {
+  return esp_timer_get_time();
+}
+#else
+#include <time.h>
+
+uint64_t microsTicks() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+#endif
+
+microsDelay::microsDelay() {
+  running = false; // not running on start
+  startTime = 0; // not started yet
+  finishNow = false; // do not finish early
+  us_delay = 0;
+  resetLateness();
+}
+
+/**
+   Start a delay of this many microseconds
+   @param delay in microseconds, 0 means justFinished() will return true on first call
+*/
+void microsDelay::start(uint64_t delay) {
+  us_delay = delay;
+  startTime = microsTicks();
+  running = true;
+  finishNow = false; // do not finish early
+}
+
+/**
+   Stop the delay
+   justFinished() will now never return true
+   until after start(),restart() or repeat() called again
+*/
+void microsDelay::stop() {
+  running = false;
+  finishNow = false; // do not finish early
+}
+
+/**
+   repeat()
+   Do same delay again but allow for a possible delay in calling justFinished()
+*/
+void microsDelay::repeat() {
+  startTime = startTime + us_delay;
+  running = true;
+  finishNow = false; // do not finish early
+}
+
+/**
+   restart()
+   Start the same delay again starting from now
+   Note: use repeat() when justFinished() returns true, if you want a regular repeating delay
+*/
+void microsDelay::restart() {
+  start(us_delay);
+}
+
+/**
+   Force delay to end now
+*/
+void microsDelay::finish() {
+  finishNow = true; // finish early
+}
+
+/**
+  Has the delay ended/expired or has finish() been called?
+  justFinished() returns true just once when delay first exceeded or the first time it is called after finish() called
+*/
+bool microsDelay::justFinished() {
+  if (!running) {
+    return false;
+  }
+  if (finishNow) { // finished early, nothing to measure
+    stop();
+    return true;
+  }
+  uint64_t elapsed = microsTicks() - startTime;
+  if (elapsed < us_delay) {
+    return false;
+  }
+  uint64_t late = elapsed - us_delay;
+  lastLate = late > 0xFFFFFFFFULL ? 0xFFFFFFFFUL : (uint32_t)late;
+  if (lastLate > maxLate) {
+    maxLate = lastLate;
+  }
+  totalLate += lastLate;
+  count++;
+  stop();
+  return true;
+}
+
+/**
+  Is the delay running, i.e. justFinished() will return true at some time in the future
+*/
+bool microsDelay::isRunning() {
+  return running;
+}
+
+/**
+  Returns the last time this delay was started, in us, by calling start(), repeat() or restart()
+  Returns 0 if it has never been started
+*/
+uint64_t microsDelay::getStartTime() {
+  return startTime;
+}
+
+/**
+  How many us remaining until delay finishes
+  Returns 0 if justFinished() returned true or stop() called
+*/
+uint64_t microsDelay::remaining() {
+  if (running) {
+    uint64_t elapsed = microsTicks() - startTime;
+    if (finishNow || elapsed >= us_delay) {  // check if delay exceeded already but justFinished() has not been called yet
+      return 0;
+    } else {
+      return us_delay - elapsed;
+    }
+  } else { // not running. stop() called or justFinished() returned true
+    return 0;
+  }
+}
+
+/**
+  The delay in us set in start
+*/
+uint64_t microsDelay::delay() {
+  return us_delay;
+}
+
+uint32_t microsDelay::lateness() {
+  return lastLate;
+}
+
+uint32_t microsDelay::maxLateness() {
+  return maxLate;
+}
+
+uint32_t microsDelay::meanLateness() {
+  return count ? (uint32_t)(totalLate / count) : 0;
+}
+
+uint32_t microsDelay::expiries() {
+  return count;
+}
+
+void microsDelay::resetLateness() {
+  lastLate = 0;
+  maxLate = 0;
+  totalLate = 0;
+  count = 0;
+}
@@ -0,0 +1,125 @@
+// microsDelay.h
+// microsecond companion to millisDelay, on a 64 bit tick that does not roll over
+
+#ifndef MICROS_DELAY_H
+#define MICROS_DELAY_H
+
+#include <stdint.h>
+
+/**
+  Microseconds since boot as a 64 bit count, esp_timer on the ESP32 and
+  CLOCK_MONOTONIC on a host build. It does not roll over in practice, unlike
+  the 32 bit micros() which wraps every 71 minutes.
+*/
+uint64_t microsTicks();
+
+/**************
+  **microsDelay** is millisDelay with microsecond delays, for sensor sampling
+  and pulse shaping below one millisecond. It has the same start(), repeat(),
+  restart(), finish() and justFinished() rules, see millisDelay.h.<br>
+
+  It also measures how late each expiry was seen: every time justFinished()
+  returns true for an expired delay, the time between the deadline and that
+  call is recorded. A growing lateness means loop() is not coming round
+  often enough for this delay.
+****************************************************************************************/
+class microsDelay {
+  public:
+
+    microsDelay();
+
+    /**
+      Start a delay of this many microseconds
+      @param delay in microseconds, 0 means justFinished() return true on first call
+    */
+    void start(uint64_t delay);
+
+    /**
+       Stop the delay
+       justFinished() will now never return true
+       until after start(),restart() or repeat() called again
+    */
+    void stop();
+
+    /**
+      repeat()
+      Do same delay again but allow for a possible delay in calling justFinished()
+    */
+    void repeat();
+
+    /**
+      restart()
+      Start the same delay again starting from now
+      Note: use repeat() when justFinished() returns true, if you want a regular repeating delay
+    */
+    void restart();
+
+    /**
+       Force delay to end now
+    */
+    void finish();
+
+    /**
+      Has the delay ended/expired or has finish() been called?
+      justFinished() returns true just once when delay first exceeded or the first time it is called after finish() called
+    */
+    bool justFinished();
+
+    /**
+      Is the delay running, i.e. justFinished() will return true at some time in the future
+    */
+    bool isRunning();
+
+    /**
+      Returns the last time this delay was started, in us, by calling start(), repeat() or restart()
+      Returns 0 if it has never been started
+    */
+    uint64_t getStartTime();
+
+    /**
+      How many us remaining until delay finishes
+      Returns 0 if finished or stopped
+    */
+    uint64_t remaining();
+
+    /**
+      The delay set in start
+    */
+    uint64_t delay();
+
+    /**
+      How late, in us, justFinished() saw the last expiry
+    */
+    uint32_t lateness();
+
+    /**
+      Largest lateness seen since the last resetLateness()
+    */
+    uint32_t maxLateness();
+
+    /**
+      Average lateness since the last resetLateness(), 0 if nothing expired yet
+    */
+    uint32_t meanLateness();
+
+    /**
+      Number of expiries measured since the last resetLateness()
+    */
+    uint32_t expiries();
+
+    /**
+      Clear the lateness statistics
+    */
+    void resetLateness();
+
+  private:
+    uint64_t us_delay;
+    uint64_t startTime;
+    bool running; // true if delay running false when ended
+    bool finishNow; // true if finish() called to finish delay early, false after justFinished() returns true
+    uint32_t lastLate;
+    uint32_t maxLate;
+    uint64_t totalLate;
+    uint32_t count;
+};
+#endif
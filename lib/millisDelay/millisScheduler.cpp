@@ -0,0 +1,147 @@
+// millisScheduler.cpp
+// runs callbacks from a set of timers in deadline order, with the same timing rules as millisDelay
+
+// include Arduino.h for millis()
+#include <Arduino.h>
+#include <millisScheduler.h>
+
+millisScheduler::millisScheduler() {
+  timerCount = 0;
+  heapCount = 0;
+}
+
+/**
+   Register a timer, it is not running until start() is called
+*/
+int16_t millisScheduler::add(millisCallback callback, unsigned long period) {
+  if (timerCount >= MILLIS_SCHEDULER_SIZE) {
+    return -1;
+  }
+  Timer &timer = timers[timerCount];
+  timer.callback = callback;
+  timer.period = period;
+  timer.deadline = 0;
+  timer.position = -1;
+  return timerCount++;
+}
+
+/**
+   Start or restart a timer, its first expiry is this many milliseconds from now
+*/
+void millisScheduler::start(int16_t id, unsigned long delay) {
+  if (id < 0 || id >= timerCount) {
+    return;
+  }
+  remove(id);
+  timers[id].deadline = millis() + delay;
+  place(heapCount, id);
+  heapCount++;
+  siftUp(heapCount - 1);
+}
+
+/**
+   Stop a timer, its callback will not be called until start() is called again
+*/
+void millisScheduler::stop(int16_t id) {
+  if (id < 0 || id >= timerCount) {
+    return;
+  }
+  remove(id);
+}
+
+/**
+   Is the timer running, i.e. its callback will be called at some time in the future
+*/
+bool millisScheduler::isRunning(int16_t id) {
+  return id >= 0 && id < timerCount && timers[id].position >= 0;
+}
+
+/**
+   Call the callbacks of all timers due at the millis() read on entry
+*/
+void millisScheduler::run() {
+  unsigned long ms = millis(); // also runs timers started or re-armed in this pass that are due by ms
+  while (heapCount > 0) {
+    int16_t id = heap[0];
+    Timer &timer = timers[id];
+    if ((long)(ms - timer.deadline) < 0) {
+      return; // earliest timer is not due yet
+    }
+    if (timer.period > 0) {
+      timer.deadline += timer.period; // same as millisDelay::repeat(), no drift
+      siftDown(0);
+    } else {
+      remove(id);
+    }
+    timer.callback();
+  }
+}
+
+/**
+   How many ms until the earliest running timer is due
+*/
+unsigned long millisScheduler::nextDeadline() {
+  if (heapCount == 0) {
+    return MILLIS_SCHEDULER_IDLE;
+  }
+  long ms = (long)(timers[heap[0]].deadline - millis()); // rollover safe
+  return ms > 0 ? ms : 0;
+}
+
+bool millisScheduler::before(int16_t a, int16_t b) {
+  return (long)(timers[a].deadline - timers[b].deadline) < 0;
+}
+
+void millisScheduler::place(uint16_t position, int16_t id) {
+  heap[position] = id;
+  timers[id].position = position;
+}
+
+void millisScheduler::siftUp(uint16_t position) {
+  int16_t id = heap[position];
+  while (position > 0) {
+    uint16_t parent = (position - 1) / 2;
+    if (!before(id, heap[parent])) {
+      break;
+    }
+    place(position, heap[parent]);
+    position = parent;
+  }
+  place(position, id);
+}
+
+void millisScheduler::siftDown(uint16_t position) {
+  int16_t id = heap[position];
+  while (true) {
+    uint16_t child = 2 * position + 1;
+    if (child >= heapCount) {
+      break;
+    }
+    if (child + 1 < heapCount && before(heap[child + 1], heap[child])) {
+      child++;
+    }
+    if (!before(heap[child], id)) {
+      break;
+    }
+    place(position, heap[child]);
+    position = child;
+  }
+  place(position, id);
+}
+
+void millisScheduler::remove(int16_t id) {
+  int16_t position = timers[id].position;
+  if (position < 0) {
+    return;
+  }
+  timers[id].position = -1;
+  heapCount--;
+  if (position == heapCount) {
+    return;
+  }
+  // move the last timer into the gap and restore the heap order around it
+  int16_t moved = heap[heapCount];
+  place(position, moved);
+  siftDown(position);
+  siftUp(timers[moved].position);
+}
@@ -0,0 +1,104 @@
+// millisScheduler.h
+// runs callbacks from a set of timers in deadline order, with the same timing rules as millisDelay
+
+#ifndef MILLIS_SCHEDULER_H
+#define MILLIS_SCHEDULER_H
+
+#include <stdint.h>
+
+// maximum number of timers added with add(), at most 32767
+#ifndef MILLIS_SCHEDULER_SIZE
+#define MILLIS_SCHEDULER_SIZE 16
+#endif
+
+#if MILLIS_SCHEDULER_SIZE > 32767
+#error "MILLIS_SCHEDULER_SIZE must fit a timer id"
+#endif
+
+// nextDeadline() when no timer is running
+#define MILLIS_SCHEDULER_IDLE 0xFFFFFFFFUL
+
+typedef void (*millisCallback)();
+
+/**************
+  **millisScheduler** replaces a set of millisDelay instances polled from loop().
+
+  Register each timer once, usually in setup(), then start and stop it by id<br>
+  <code>int16_t blinkTimer = scheduler.add(blink, 1000);</code><br>
+  <code>scheduler.start(blinkTimer, 1000);</code><br>
+  and call <code>scheduler.run();</code> every loop. run() calls the callbacks of
+  the timers that are due, earliest deadline first.<br>
+
+  A timer added with a period repeats like millisDelay::repeat(): the next
+  deadline is the previous deadline plus the period, so a late run() does not
+  make it drift. A run() late by several periods calls it once for each, back
+  to back. A timer added without a period runs once per start().<br>
+
+  Running timers are kept in a binary min-heap on their deadline, so run()
+  and nextDeadline() only look at the earliest one.
+****************************************************************************************/
+class millisScheduler {
+  public:
+
+    millisScheduler();
+
+    /**
+      Register a timer, it is not running until start() is called
+      @param callback called from run() each time the timer expires
+      @param period in milliseconds between expiries, 0 for a one-shot timer
+      @return timer id, -1 if all MILLIS_SCHEDULER_SIZE timers are in use
+    */
+    int16_t add(millisCallback callback, unsigned long period = 0);
+
+    /**
+      Start or restart a timer, its first expiry is this many milliseconds from now
+      @param delay in milliseconds, 0 means the callback runs on the next run(), or
+                   later in the current one when called from a callback
+    */
+    void start(int16_t id, unsigned long delay);
+
+    /**
+      Stop a timer, its callback will not be called until start() is called again
+    */
+    void stop(int16_t id);
+
+    /**
+      Is the timer running, i.e. its callback will be called at some time in the future
+    */
+    bool isRunning(int16_t id);
+
+    /**
+      Call the callbacks of all timers due at the millis() read on entry
+      Callbacks may start and stop any timer, including their own. A timer they
+      start or a period they re-arm that is due by that same millis() runs in
+      this pass too. A callback restarting its own timer with delay 0 is called
+      again and again until millis() moves on
+    */
+    void run();
+
+    /**
+      How many ms until the earliest running timer is due
+      Returns 0 if one is already due, MILLIS_SCHEDULER_IDLE if no timer is running
+    */
+    unsigned long nextDeadline();
+
+  private:
+    struct Timer {
+      millisCallback callback;
+      unsigned long period;
+      unsigned long deadline;
+      int16_t position; // index in heap, -1 when stopped
+    };
+
+    Timer timers[MILLIS_SCHEDULER_SIZE];
+    int16_t heap[MILLIS_SCHEDULER_SIZE]; // timer ids, earliest deadline first
+    uint16_t timerCount;
+    uint16_t heapCount;
+
+    bool before(int16_t a, int16_t b);
+    void place(uint16_t position, int16_t id);
+    void siftUp(uint16_t position);
+    void siftDown(uint16_t position);
+    void remove(int16_t id);
+};
+#endif
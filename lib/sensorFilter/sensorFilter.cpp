@@ -0,0 +1,219 @@
+// sensorFilter.cpp
+// turns raw IR and metal sensor frames into a debounced ObjectPresent / IsMetal state
+
+#include <sensorFilter.h>
+
+#ifdef ESP32
+#include <Preferences.h>
+#endif
+
+#define SENSOR_CAL_NAMESPACE "sensor"
+#define SENSOR_CAL_KEY       "calibration"
+
+static const sensorCalibration defaultCalibration = {2000, 400, 900, 100};
+
+// a depth of 0 or less would never detect anything
+static bool hasDepth(const sensorCalibration &calibration) {
+  return calibration.irObject < calibration.irIdle && calibration.metalMetal < calibration.metalIdle;
+}
+
+sensorFilter::sensorFilter() {
+  levels = defaultCalibration;
+  calRemaining = 0;
+  calAccepted = true;
+  reset();
+}
+
+void sensorFilter::setCalibration(const sensorCalibration &calibration) {
+  levels = calibration;
+  reset();
+}
+
+const sensorCalibration &sensorFilter::calibration() const {
+  return levels;
+}
+
+void sensorFilter::reset() {
+  windowIndex = 0;
+  windowCount = 0;
+  irAcc = 0;
+  metalAcc = 0;
+  irBaseAcc = (int32_t)levels.irIdle << SENSOR_FILTER_BASELINE_SHIFT;
+  metalBaseAcc = (int32_t)levels.metalIdle << SENSOR_FILTER_BASELINE_SHIFT;
+  present = false;
+  metalPresent = false;
+}
+
+uint16_t sensorFilter::median(const uint16_t *window) const {
+  uint16_t sorted[SENSOR_FILTER_MEDIAN];
+  for (uint8_t i = 0; i < SENSOR_FILTER_MEDIAN; i++) {
+    // insertion sort, the window is tiny
+    uint8_t j = i;
+    while (j > 0 && sorted[j - 1] > window[i]) {
+      sorted[j] = sorted[j - 1];
+      j--;
+    }
+    sorted[j] = window[i];
+  }
+  return sorted[SENSOR_FILTER_MEDIAN / 2];
+}
+
+bool sensorFilter::update(uint16_t rawIr, uint16_t rawMetal) {
+  irWindow[windowIndex] = rawIr;
+  metalWindow[windowIndex] = rawMetal;
+  windowIndex = (windowIndex + 1) % SENSOR_FILTER_MEDIAN;
+
+  if (windowCount < SENSOR_FILTER_MEDIAN) {
+    // start the IIR from the first frames instead of ramping up from 0
+    windowCount++;
+    irAcc = (int32_t)rawIr << SENSOR_FILTER_IIR_SHIFT;
+    metalAcc = (int32_t)rawMetal << SENSOR_FILTER_IIR_SHIFT;
+    return false;
+  }
+
+  irAcc += median(irWindow) - (irAcc >> SENSOR_FILTER_IIR_SHIFT);
+  metalAcc += median(metalWindow) - (metalAcc >> SENSOR_FILTER_IIR_SHIFT);
+  int32_t irLevel = irAcc >> SENSOR_FILTER_IIR_SHIFT;
+  int32_t metalLevel = metalAcc >> SENSOR_FILTER_IIR_SHIFT;
+
+  if (calRemaining > 0) {
+    calIrSum += irLevel;
+    calMetalSum += metalLevel;
+    if (--calRemaining == 0) {
+      finishCalibration();
+    }
+  }
+
+  // thresholds sit halfway down the calibrated depth below the baseline
+  int32_t irDepth = (int32_t)levels.irIdle - levels.irObject;
+  int32_t metalDepth = (int32_t)levels.metalIdle - levels.metalMetal;
+  int32_t irThreshold = (irBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT) - irDepth / 2;
+  int32_t metalThreshold = (metalBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT) - metalDepth / 2;
+  int32_t irHysteresis = irDepth >> SENSOR_FILTER_HYSTERESIS_SHIFT;
+  int32_t metalHysteresis = metalDepth >> SENSOR_FILTER_HYSTERESIS_SHIFT;
+
+  bool wasPresent = present;
+  bool wasMetal = metalPresent;
+
+  // entering at the threshold keeps the calibrated switch point, the hysteresis is on the way out
+  present = present ? irLevel < irThreshold + irHysteresis
+                    : irLevel < irThreshold;
+  metalPresent = metalPresent ? metalLevel < metalThreshold + metalHysteresis
+                              : metalLevel < metalThreshold;
+
+  // baselines only follow the idle level, never an item held short of the threshold
+  bool irIdle = !present && irLevel > (irBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT) - irHysteresis;
+  bool metalIdle = !metalPresent && metalLevel > (metalBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT) - metalHysteresis;
+  if (irIdle && calRemaining == 0) {
+    irBaseAcc += irLevel - (irBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT);
+    if (metalIdle) {
+      metalBaseAcc += metalLevel - (metalBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT);
+    }
+  }
+
+  return present != wasPresent || isMetal() != (wasPresent && wasMetal);
+}
+
+bool sensorFilter::objectPresent() const {
+  return present;
+}
+
+bool sensorFilter::isMetal() const {
+  return present && metalPresent;
+}
+
+uint16_t sensorFilter::ir() const {
+  return irAcc >> SENSOR_FILTER_IIR_SHIFT;
+}
+
+uint16_t sensorFilter::metal() const {
+  return metalAcc >> SENSOR_FILTER_IIR_SHIFT;
+}
+
+uint16_t sensorFilter::irBaseline() const {
+  return irBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT;
+}
+
+uint16_t sensorFilter::metalBaseline() const {
+  return metalBaseAcc >> SENSOR_FILTER_BASELINE_SHIFT;
+}
+
+void sensorFilter::calibrate(uint8_t point, uint16_t frames) {
+  calPoint = point;
+  calFrames = frames > 0 ? frames : 1;
+  calRemaining = calFrames;
+  calIrSum = 0;
+  calMetalSum = 0;
+}
+
+bool sensorFilter::isCalibrating() const {
+  return calRemaining > 0;
+}
+
+bool sensorFilter::calibrationAccepted() const {
+  return calAccepted;
+}
+
+void sensorFilter::finishCalibration() {
+  uint16_t ir = calIrSum / calFrames;
+  uint16_t metal = calMetalSum / calFrames;
+  sensorCalibration measured = levels;
+  switch (calPoint) {
+    case SENSOR_CAL_IDLE:
+      measured.irIdle = ir;
+      measured.metalIdle = metal;
+      break;
+    case SENSOR_CAL_OBJECT:
+      measured.irObject = ir;
+      break;
+    case SENSOR_CAL_METAL:
+      measured.metalMetal = metal;
+      break;
+  }
+  calAccepted = hasDepth(measured);
+  if (!calAccepted) {
+    return;
+  }
+  levels = measured;
+  if (calPoint == SENSOR_CAL_IDLE) {
+    irBaseAcc = (int32_t)ir << SENSOR_FILTER_BASELINE_SHIFT;
+    metalBaseAcc = (int32_t)metal << SENSOR_FILTER_BASELINE_SHIFT;
+  }
+}
+
+bool loadCalibration(sensorCalibration *calibration) {
+#ifdef ESP32
+  Preferences preferences;
+  if (!preferences.begin(SENSOR_CAL_NAMESPACE, true)) {
+    return false;
+  }
+  sensorCalibration stored;
+  bool found = preferences.getBytes(SENSOR_CAL_KEY, &stored, sizeof(stored)) == sizeof(stored);
+  preferences.end();
+  if (!found || !hasDepth(stored)) {
+    return false;
+  }
+  *calibration = stored;
+  return true;
+#else
+  (void)calibration;
+  return false;
+#endif
+}
+
+bool saveCalibration(const sensorCalibration &calibration) {
+  if (!hasDepth(calibration)) {
+    return false;
+  }
+#ifdef ESP32
+  Preferences preferences;
+  if (!preferences.begin(SENSOR_CAL_NAMESPACE, false)) {
+    return false;
+  }
+  bool saved = preferences.putBytes(SENSOR_CAL_KEY, &calibration, sizeof(calibration)) == sizeof(calibration);
+  preferences.end();
+  return saved;
+#else
+  return false;
+#endif
+}
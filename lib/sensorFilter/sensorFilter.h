@@ -0,0 +1,151 @@
+// sensorFilter.h
+// turns raw IR and metal sensor frames into a debounced ObjectPresent / IsMetal state
+
+#ifndef SENSOR_FILTER_H
+#define SENSOR_FILTER_H
+
+#include <stdint.h>
+
+// frames in the median window, odd
+#define SENSOR_FILTER_MEDIAN 5
+
+// IIR smoothing after the median, alpha = 1 / 2^shift
+#ifndef SENSOR_FILTER_IIR_SHIFT
+#define SENSOR_FILTER_IIR_SHIFT 2
+#endif
+
+// idle baseline tracking, alpha = 1 / 2^shift, about two minutes at one frame per ms
+#ifndef SENSOR_FILTER_BASELINE_SHIFT
+#define SENSOR_FILTER_BASELINE_SHIFT 17
+#endif
+
+// hysteresis above a threshold, as a fraction 1 / 2^shift of the calibrated depth
+#define SENSOR_FILTER_HYSTERESIS_SHIFT 3
+
+// calibration points, see calibrate()
+#define SENSOR_CAL_IDLE   0  // nothing inserted
+#define SENSOR_CAL_OBJECT 1  // a non-metal item held in front of the sensors
+#define SENSOR_CAL_METAL  2  // a can held in front of the sensors
+
+/**
+  Filtered sensor levels of one device, kept in NVS by saveCalibration().
+  The defaults put the thresholds where the fixed ones were, IR 1200 and metal 500.
+*/
+struct sensorCalibration {
+  uint16_t irIdle;      // IR with nothing inserted
+  uint16_t irObject;    // IR with an item inserted, lower than irIdle
+  uint16_t metalIdle;   // metal sensor without a can
+  uint16_t metalMetal;  // metal sensor with a can, lower than metalIdle
+};
+
+/**************
+  **sensorFilter** is the stage between the sampled frames and the item decision.
+
+  Each channel goes through a median of the last SENSOR_FILTER_MEDIAN frames,
+  which removes single spikes, then a first order IIR. While nothing is
+  inserted the idle level of each channel is tracked slowly, so drift from
+  temperature, ambient IR or ageing moves the baseline instead of the
+  decision. A level more than the hysteresis below the baseline is taken for
+  an item on its way in and does not move the baseline.<br>
+
+  An object is present when the IR level drops below the baseline by half of
+  the calibrated idle to object depth, and a can when the metal level drops by
+  half of its calibrated depth. Each stays present until the level is back
+  above its threshold by 1 / 2^SENSOR_FILTER_HYSTERESIS_SHIFT of the depth,
+  so a level sitting on a threshold does not chatter.<br>
+
+  Call <code>filter.update(ir, metal);</code> for every frame, then read
+  objectPresent() and isMetal().
+****************************************************************************************/
+class sensorFilter {
+  public:
+
+    sensorFilter();
+
+    /**
+      Use these levels, the baselines restart from the idle levels
+    */
+    void setCalibration(const sensorCalibration &calibration);
+
+    const sensorCalibration &calibration() const;
+
+    /**
+      Forget the filter history, the next frame starts it again
+    */
+    void reset();
+
+    /**
+      Filter one frame
+      @return true if objectPresent() or isMetal() changed
+    */
+    bool update(uint16_t ir, uint16_t metal);
+
+    bool objectPresent() const;
+
+    /**
+      A can is present, never true without objectPresent()
+    */
+    bool isMetal() const;
+
+    // filtered levels and their idle baselines
+    uint16_t ir() const;
+    uint16_t metal() const;
+    uint16_t irBaseline() const;
+    uint16_t metalBaseline() const;
+
+    /**
+      Average the filtered levels over the next frames into one calibration point.
+      The levels of the other points are kept, so idle, object and metal can be
+      measured in any order.
+      @param point SENSOR_CAL_IDLE, SENSOR_CAL_OBJECT or SENSOR_CAL_METAL
+      @param frames to average over
+    */
+    void calibrate(uint8_t point, uint16_t frames);
+
+    /**
+      Is a calibration point being measured
+    */
+    bool isCalibrating() const;
+
+    /**
+      Was the last measured point kept. A point leaving an object or metal
+      level at or above its idle level is dropped, the previous levels stay.
+    */
+    bool calibrationAccepted() const;
+
+  private:
+    uint16_t median(const uint16_t *window) const;
+    void finishCalibration();
+
+    sensorCalibration levels;
+    uint16_t irWindow[SENSOR_FILTER_MEDIAN];
+    uint16_t metalWindow[SENSOR_FILTER_MEDIAN];
+    uint8_t windowIndex;
+    uint8_t windowCount;
+    int32_t irAcc;          // IIR state, scaled by 2^SENSOR_FILTER_IIR_SHIFT
+    int32_t metalAcc;
+    int32_t irBaseAcc;      // baselines, scaled by 2^SENSOR_FILTER_BASELINE_SHIFT
+    int32_t metalBaseAcc;
+    bool present;
+    bool metalPresent;
+    uint8_t calPoint;
+    uint16_t calRemaining;
+    uint16_t calFrames;
+    uint32_t calIrSum;
+    uint32_t calMetalSum;
+    bool calAccepted;
+};
+
+/**
+  Read this device's calibration from NVS
+  @return false if none was saved, calibration is left unchanged
+*/
+bool loadCalibration(sensorCalibration *calibration);
+
+/**
+  Write this device's calibration to NVS, it survives a reboot
+  @return false if it was not written, or has an object or metal level at or above its idle level
+*/
+bool saveCalibration(const sensorCalibration &calibration);
+
+#endif
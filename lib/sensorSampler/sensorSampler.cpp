@@ -0,0 +1,142 @@
+// sensorSampler.cpp
+// samples two ADC1 channels continuously through DMA and hands averaged frames to another task
+
+#include <sensorSampler.h>
+
+#ifdef ESP32
+#include <driver/adc.h>
+#endif
+
+// bytes taken from the DMA buffer per poll(), 2 bytes per conversion
+#define SENSOR_SAMPLER_CHUNK 256
+
+sensorSampler::sensorSampler() : produced(0), overflows(0) {
+  irChannel = 0;
+  metalChannel = 0;
+  rate = SENSOR_SAMPLER_RATE;
+  average = SENSOR_SAMPLER_AVERAGE;
+  irSum = 0;
+  metalSum = 0;
+  irCount = 0;
+  metalCount = 0;
+}
+
+bool sensorSampler::begin(uint8_t irChannel, uint8_t metalChannel, uint32_t rate, uint16_t average) {
+  this->irChannel = irChannel;
+  this->metalChannel = metalChannel;
+  this->rate = rate;
+  this->average = average > 0 ? average : 1;
+
+#ifdef ESP32
+  adc_digi_init_config_t init = {};
+  init.max_store_buf_size = SENSOR_SAMPLER_CHUNK * 16;
+  init.conv_num_each_intr = SENSOR_SAMPLER_CHUNK;
+  init.adc1_chan_mask = (1 << irChannel) | (1 << metalChannel);
+  init.adc2_chan_mask = 0;
+  if (adc_digi_initialize(&init) != ESP_OK) {
+    return false;
+  }
+
+  // same 12 bit range as analogRead() with its default 11 dB attenuation
+  adc_digi_pattern_config_t pattern[2] = {};
+  pattern[0].atten = ADC_ATTEN_DB_11;
+  pattern[0].channel = irChannel;
+  pattern[0].unit = 0;
+  pattern[0].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+  pattern[1] = pattern[0];
+  pattern[1].channel = metalChannel;
+
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = 1;  // required on the ESP32
+  config.conv_limit_num = 250;
+  config.pattern_num = 2;
+  config.adc_pattern = pattern;
+  config.sample_freq_hz = rate;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_digi_controller_configure(&config) != ESP_OK) {
+    adc_digi_deinitialize();
+    return false;
+  }
+
+  return adc_digi_start() == ESP_OK;
+#else
+  return false;
+#endif
+}
+
+uint16_t sensorSampler::poll(uint32_t timeout) {
+  uint32_t before = produced.load(std::memory_order_relaxed);
+
+#ifdef ESP32
+  uint8_t chunk[SENSOR_SAMPLER_CHUNK];
+  uint32_t length = 0;
+  esp_err_t err = adc_digi_read_bytes(chunk, sizeof(chunk), &length, timeout);
+  if (err == ESP_ERR_INVALID_STATE) {
+    // the driver dropped conversions, the data returned is still valid
+    overflows.fetch_add(1, std::memory_order_relaxed);
+  } else if (err != ESP_OK) {
+    return 0;
+  }
+
+  for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+    adc_digi_output_data_t *out = (adc_digi_output_data_t *)&chunk[i];
+    add(out->type1.channel, out->type1.data);
+  }
+#endif
+
+  return produced.load(std::memory_order_relaxed) - before;
+}
+
+void sensorSampler::add(uint8_t channel, uint16_t value) {
+  if (channel == irChannel) {
+    irSum += value;
+    irCount++;
+  } else if (channel == metalChannel) {
+    metalSum += value;
+    metalCount++;
+  } else {
+    return;
+  }
+
+  if (irCount < average || metalCount < average) {
+    return;
+  }
+
+  sensorFrame frame;
+  frame.index = produced.load(std::memory_order_relaxed);
+  frame.ir = irSum / irCount;
+  frame.metal = metalSum / metalCount;
+  ring.push(frame);  // counted in dropped() when full
+  produced.store(frame.index + 1, std::memory_order_relaxed);
+
+  irSum = 0;
+  metalSum = 0;
+  irCount = 0;
+  metalCount = 0;
+}
+
+bool sensorSampler::read(sensorFrame *frame) {
+  return ring.pop(frame);
+}
+
+void sensorSampler::setNotify(eventNotify notify, void *context) {
+  ring.setNotify(notify, context);
+}
+
+uint32_t sensorSampler::framePeriod() const {
+  // each frame averages `average` conversions of both channels
+  return (uint64_t)average * 2 * 1000000UL / rate;
+}
+
+uint32_t sensorSampler::frames() const {
+  return produced.load(std::memory_order_relaxed);
+}
+
+uint32_t sensorSampler::dropped() const {
+  return ring.dropped();
+}
+
+uint32_t sensorSampler::overruns() const {
+  return overflows.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,118 @@
+// sensorSampler.h
+// samples two ADC1 channels continuously through DMA and hands averaged frames to another task
+
+#ifndef SENSOR_SAMPLER_H
+#define SENSOR_SAMPLER_H
+
+#include <stdint.h>
+#include <atomic>
+#include <eventRing.h>
+
+// conversions per second over both channels, 20 kHz is the ESP32 DMA minimum
+#ifndef SENSOR_SAMPLER_RATE
+#define SENSOR_SAMPLER_RATE 20000
+#endif
+
+// conversions of each channel averaged into one frame
+#ifndef SENSOR_SAMPLER_AVERAGE
+#define SENSOR_SAMPLER_AVERAGE 10
+#endif
+
+// frames buffered between the sampling task and the reader, a power of two
+#ifndef SENSOR_SAMPLER_FRAMES
+#define SENSOR_SAMPLER_FRAMES 64
+#endif
+
+/**
+  One averaged reading of both channels, 12 bit like analogRead()
+*/
+struct sensorFrame {
+  uint32_t index;   // frames since begin(), time is index * framePeriod()
+  uint16_t ir;
+  uint16_t metal;
+};
+
+/**************
+  **sensorSampler** replaces analogRead() of the IR and metal sensors.
+
+  begin() starts the ADC1 digital controller converting both channels in turn
+  at a fixed rate into the driver's DMA buffer, without the CPU. One task
+  calls <code>sampler.poll(timeout);</code> in a loop, it blocks until a DMA
+  chunk is ready, averages each channel over SENSOR_SAMPLER_AVERAGE
+  conversions and pushes the frames to a ring. Another task takes them with
+  <code>sampler.read(&amp;frame);</code>.<br>
+
+  With the defaults each channel is converted at 10 kHz and a frame is
+  produced every millisecond.<br>
+
+  analogRead() must not be used on ADC1 while the sampler runs.
+****************************************************************************************/
+class sensorSampler {
+  public:
+
+    sensorSampler();
+
+    /**
+      Configure and start continuous conversion
+      @param irChannel ADC1 channel of the IR sensor, digitalPinToAnalogChannel(36) = 0
+      @param metalChannel ADC1 channel of the metal sensor, digitalPinToAnalogChannel(39) = 3
+      @return false if the ADC driver refused the configuration or this is not an ESP32
+    */
+    bool begin(uint8_t irChannel, uint8_t metalChannel,
+               uint32_t rate = SENSOR_SAMPLER_RATE, uint16_t average = SENSOR_SAMPLER_AVERAGE);
+
+    /**
+      Take one DMA chunk and push the frames it completes, only from the sampling task
+      @param timeout in ms to wait for the chunk
+      @return number of frames pushed
+    */
+    uint16_t poll(uint32_t timeout);
+
+    /**
+      Take the oldest frame, only from the reading task
+      @return true if a frame was copied to frame
+    */
+    bool read(sensorFrame *frame);
+
+    /**
+      Set a hook called after frames were pushed, e.g. to notify the reading task
+    */
+    void setNotify(eventNotify notify, void *context = 0);
+
+    /**
+      Microseconds between two frames
+    */
+    uint32_t framePeriod() const;
+
+    /**
+      Frames produced since begin()
+    */
+    uint32_t frames() const;
+
+    /**
+      Frames lost because the reader fell behind
+    */
+    uint32_t dropped() const;
+
+    /**
+      Times the DMA buffer overflowed because poll() was not called often enough
+    */
+    uint32_t overruns() const;
+
+  private:
+    void add(uint8_t channel, uint16_t value);
+
+    eventRing<sensorFrame, SENSOR_SAMPLER_FRAMES> ring;
+    uint8_t irChannel;
+    uint8_t metalChannel;
+    uint32_t rate;
+    uint16_t average;
+    uint32_t irSum;
+    uint32_t metalSum;
+    uint16_t irCount;
+    uint16_t metalCount;
+    std::atomic<uint32_t> produced;
+    std::atomic<uint32_t> overflows;
+};
+
+#endif
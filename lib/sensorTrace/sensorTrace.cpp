@@ -0,0 +1,119 @@
+// sensorTrace.cpp
+// records sampled sensor frames as compact delta-encoded blocks for offline replay
+
+#include <sensorTrace.h>
+#include <string.h>
+
+// bytes before data in a sent block
+#define SENSOR_TRACE_HEADER offsetof(sensorTraceBlock, data)
+
+// largest encoding of one frame, two 2 byte differences
+#define SENSOR_TRACE_FRAME_MAX 4
+
+static uint8_t putDelta(uint8_t *out, int16_t delta) {
+  uint16_t zigzag = (uint16_t)(delta << 1) ^ (uint16_t)(delta >> 15);
+  if (zigzag < 0x80) {
+    out[0] = zigzag;
+    return 1;
+  }
+  out[0] = 0x80 | (zigzag & 0x7F);
+  out[1] = zigzag >> 7;
+  return 2;
+}
+
+static uint8_t getDelta(const uint8_t *in, size_t len, int16_t *delta) {
+  if (len < 1) return 0;
+  uint16_t zigzag = in[0] & 0x7F;
+  uint8_t used = 1;
+  if (in[0] & 0x80) {
+    if (len < 2) return 0;
+    zigzag |= (uint16_t)in[1] << 7;
+    used = 2;
+  }
+  *delta = (int16_t)(zigzag >> 1) ^ -(int16_t)(zigzag & 1);
+  return used;
+}
+
+sensorTrace::sensorTrace() {
+  block.count = 0;
+  lastIr = 0;
+  lastMetal = 0;
+}
+
+void sensorTrace::start(const sensorFrame &frame) {
+  block.index = frame.index;
+  block.count = 1;
+  block.ir = frame.ir;
+  block.metal = frame.metal;
+  block.length = 0;
+  lastIr = frame.ir;
+  lastMetal = frame.metal;
+}
+
+void sensorTrace::record(const sensorFrame &frame) {
+  if (block.count > 0 && (frame.index != block.index + block.count ||
+                          block.length + SENSOR_TRACE_FRAME_MAX > SENSOR_TRACE_DATA)) {
+    flush();
+  }
+  if (block.count == 0) {
+    start(frame);
+    return;
+  }
+
+  block.length += putDelta(&block.data[block.length], frame.ir - lastIr);
+  block.length += putDelta(&block.data[block.length], frame.metal - lastMetal);
+  block.count++;
+  lastIr = frame.ir;
+  lastMetal = frame.metal;
+}
+
+void sensorTrace::flush() {
+  if (block.count == 0) return;
+  ring.push(block);  // counted in dropped() when full
+  block.count = 0;
+}
+
+bool sensorTrace::pop(sensorTraceBlock *block) {
+  return ring.pop(block);
+}
+
+uint32_t sensorTrace::dropped() const {
+  return ring.dropped();
+}
+
+size_t sensorTrace::size(const sensorTraceBlock &block) {
+  return SENSOR_TRACE_HEADER + block.length;
+}
+
+uint16_t sensorTrace::decode(const uint8_t *data, size_t len, sensorFrame *frames, uint16_t max) {
+  sensorTraceBlock header;
+  if (len < SENSOR_TRACE_HEADER || max == 0) return 0;
+  memcpy(&header, data, SENSOR_TRACE_HEADER);
+  if (header.count == 0 || header.length > len - SENSOR_TRACE_HEADER) return 0;
+
+  const uint8_t *in = data + SENSOR_TRACE_HEADER;
+  size_t left = header.length;
+  frames[0].index = header.index;
+  frames[0].ir = header.ir;
+  frames[0].metal = header.metal;
+
+  uint16_t n = 1;
+  while (n < header.count && n < max) {
+    int16_t irDelta;
+    int16_t metalDelta;
+    uint8_t used = getDelta(in, left, &irDelta);
+    if (used == 0) return 0;
+    in += used;
+    left -= used;
+    used = getDelta(in, left, &metalDelta);
+    if (used == 0) return 0;
+    in += used;
+    left -= used;
+
+    frames[n].index = header.index + n;
+    frames[n].ir = frames[n - 1].ir + irDelta;
+    frames[n].metal = frames[n - 1].metal + metalDelta;
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,97 @@
+// sensorTrace.h
+// records sampled sensor frames as compact delta-encoded blocks for offline replay
+
+#ifndef SENSOR_TRACE_H
+#define SENSOR_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sensorSampler.h>
+
+// blocks buffered between the recording and the sending task, a power of two
+#ifndef SENSOR_TRACE_BLOCKS
+#define SENSOR_TRACE_BLOCKS 8
+#endif
+
+// encoded bytes per block, the whole block is 256 bytes
+#define SENSOR_TRACE_DATA 244
+
+/**
+  Consecutive frames of one recording. The first frame is kept as is, every
+  following frame as the zigzag encoded difference of each channel to the
+  previous frame, one byte for a difference within +-63 and two bytes up to
+  +-4095. Sent as the header plus length bytes of data, little-endian, so a
+  dump taken on the ESP32 can be read back as-is on a Linux host.
+*/
+struct sensorTraceBlock {
+  uint32_t index;   // sensorFrame index of the first frame, time is index * framePeriod()
+  uint16_t count;   // frames in the block
+  uint16_t ir;      // first frame
+  uint16_t metal;
+  uint16_t length;  // bytes of data used
+  uint8_t data[SENSOR_TRACE_DATA];
+};
+
+/**************
+  **sensorTrace** keeps the raw frames the item decisions were made on.
+
+  The recording task calls <code>trace.record(frame);</code> for each frame,
+  frames with consecutive indices share a block until it is full, a gap starts
+  a new one. <code>trace.flush();</code> hands over a partly filled block, e.g.
+  when a session ends. Another task takes finished blocks with
+  <code>trace.pop(&amp;block);</code> and sends sensorTrace::size(block) bytes
+  of it. When that task falls behind new blocks are dropped and counted, the
+  recording task never waits.<br>
+
+  decode() turns a received block back into frames, it has no dependency on
+  the ESP32 so the same code reads traces on a host.
+****************************************************************************************/
+class sensorTrace {
+  public:
+
+    sensorTrace();
+
+    /**
+      Add a frame, only from the recording task
+    */
+    void record(const sensorFrame &frame);
+
+    /**
+      Hand over the block being filled, only from the recording task
+    */
+    void flush();
+
+    /**
+      Take the oldest finished block, only from the sending task
+      @return true if a block was copied to block
+    */
+    bool pop(sensorTraceBlock *block);
+
+    /**
+      Blocks lost because the sending task fell behind
+    */
+    uint32_t dropped() const;
+
+    /**
+      Bytes of the block to send or store, the header and the used data
+    */
+    static size_t size(const sensorTraceBlock &block);
+
+    /**
+      Decode a block as sent, e.g. read back from an MQTT dump
+      @param data block bytes, at least the header
+      @param frames receives up to max frames
+      @return number of frames decoded, 0 if the block is malformed
+    */
+    static uint16_t decode(const uint8_t *data, size_t len, sensorFrame *frames, uint16_t max);
+
+  private:
+    void start(const sensorFrame &frame);
+
+    sensorTraceBlock block;
+    uint16_t lastIr;
+    uint16_t lastMetal;
+    eventRing<sensorTraceBlock, SENSOR_TRACE_BLOCKS> ring;
+};
+
+#endif
@@ -0,0 +1,200 @@
+// servoMotion.cpp
+// steps a hobby servo along a speed limited profile and models where the horn really is
+
+#include <servoMotion.h>
+#include <math.h>
+
+#ifdef ESP32
+#include <Preferences.h>
+#endif
+
+#define SERVO_MODEL_NAMESPACE "servo"
+#define SERVO_MODEL_KEY       "model"
+
+// the model is at the target when this close, in degrees
+#define SERVO_MOTION_TOLERANCE 0.5f
+
+servoMotion::servoMotion(servoWrite write, uint16_t angle) {
+  this->write = write;
+  profile = SERVO_PROFILE_TRAPEZOID;
+  speed = SERVO_MOTION_SPEED;
+  accel = SERVO_MOTION_ACCEL;
+  rate = SERVO_MOTION_RATE;
+  deadTime = SERVO_MOTION_DEAD_TIME;
+  goal = angle;
+  from = angle;
+  duration = 0;
+  cmd = angle;
+  velocity = 0;
+  modelled = angle;
+  written = angle;
+  moving = false;
+  started = false;
+  resting = true;
+  moveStart = 0;
+  lastUpdate = 0;
+  travel = 0;
+}
+
+void servoMotion::begin() {
+  write(written);
+}
+
+void servoMotion::setSpeed(float speed, float accel) {
+  this->speed = speed > 0 ? speed : 1;
+  this->accel = accel > 0 ? accel : 1;
+}
+
+void servoMotion::setProfile(uint8_t profile) {
+  this->profile = profile;
+}
+
+void servoMotion::setModel(float rate, uint16_t deadTime) {
+  this->rate = rate > 0 ? rate : 1;
+  this->deadTime = deadTime;
+}
+
+void servoMotion::moveTo(uint16_t angle) {
+  if (angle == goal && moving) return;
+  if ((angle > cmd) != (goal > cmd)) {
+    velocity = 0;  // turning back, the trapezoid starts again from rest
+  }
+  resting = !moving;
+  goal = angle;
+  from = cmd;
+  moving = true;
+  started = false;
+
+  // smoothstep peaks at 1.5 times the mean speed and 6 d / T^2 acceleration
+  float distance = fabsf(goal - from);
+  float bySpeed = 1.5f * distance / speed;
+  float byAccel = sqrtf(6.0f * distance / accel);
+  duration = bySpeed > byAccel ? bySpeed : byAccel;
+}
+
+void servoMotion::update(uint32_t now) {
+  if (!moving) {
+    lastUpdate = now;
+    return;
+  }
+  if (!started) {
+    // the move starts on the first step after moveTo()
+    started = true;
+    moveStart = now;
+    lastUpdate = now;
+  }
+  float dt = (now - lastUpdate) / 1000.0f;
+  lastUpdate = now;
+
+  float remaining = goal - cmd;
+  if (profile == SERVO_PROFILE_SCURVE) {
+    float u = duration > 0 ? (now - moveStart) / 1000.0f / duration : 1;
+    if (u >= 1) {
+      cmd = goal;
+    } else {
+      cmd = from + (goal - from) * u * u * (3 - 2 * u);
+    }
+  } else if (fabsf(remaining) > 0) {
+    // accelerate, hold the speed limit, or brake to stop at the target
+    float braking = sqrtf(2 * accel * fabsf(remaining));
+    velocity += accel * dt;
+    if (velocity > speed) velocity = speed;
+    if (velocity > braking) velocity = braking;
+    float step = velocity * dt;
+    if (step >= fabsf(remaining)) {
+      cmd = goal;
+      velocity = 0;
+    } else {
+      cmd += remaining > 0 ? step : -step;
+    }
+  }
+
+  uint16_t angle = (uint16_t)lroundf(cmd);
+  if (angle != written) {
+    written = angle;
+    write(angle);
+  }
+
+  // the horn follows the command after the dead time, if it was at rest, no
+  // faster than its rate
+  if (!resting || now - moveStart >= deadTime) {
+    float lag = cmd - modelled;
+    float limit = rate * dt;
+    if (fabsf(lag) <= limit) {
+      modelled = cmd;
+    } else {
+      modelled += lag > 0 ? limit : -limit;
+    }
+  }
+
+  if (cmd == goal && fabsf(goal - modelled) <= SERVO_MOTION_TOLERANCE) {
+    modelled = goal;
+    moving = false;
+    travel = now - moveStart;
+  }
+}
+
+uint16_t servoMotion::target() const {
+  return goal;
+}
+
+float servoMotion::command() const {
+  return cmd;
+}
+
+float servoMotion::position() const {
+  return modelled;
+}
+
+bool servoMotion::isMoving() const {
+  return moving;
+}
+
+bool servoMotion::isAt(uint16_t angle) const {
+  return !moving && goal == angle;
+}
+
+uint32_t servoMotion::lastTravel() const {
+  return travel;
+}
+
+static bool isPlausible(const servoModel &model) {
+  return model.rate > 0 && model.rate <= SERVO_MODEL_MAX_RATE && model.deadTime <= SERVO_MODEL_MAX_DEAD_TIME;
+}
+
+bool loadServoModel(servoModel *model) {
+#ifdef ESP32
+  Preferences preferences;
+  if (!preferences.begin(SERVO_MODEL_NAMESPACE, true)) {
+    return false;
+  }
+  servoModel stored;
+  bool found = preferences.getBytes(SERVO_MODEL_KEY, &stored, sizeof(stored)) == sizeof(stored);
+  preferences.end();
+  if (!found || !isPlausible(stored)) {
+    return false;
+  }
+  *model = stored;
+  return true;
+#else
+  (void)model;
+  return false;
+#endif
+}
+
+bool saveServoModel(const servoModel &model) {
+  if (!isPlausible(model)) {
+    return false;
+  }
+#ifdef ESP32
+  Preferences preferences;
+  if (!preferences.begin(SERVO_MODEL_NAMESPACE, false)) {
+    return false;
+  }
+  bool saved = preferences.putBytes(SERVO_MODEL_KEY, &model, sizeof(model)) == sizeof(model);
+  preferences.end();
+  return saved;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,153 @@
+// servoMotion.h
+// steps a hobby servo along a speed limited profile and models where the horn really is
+
+#ifndef SERVO_MOTION_H
+#define SERVO_MOTION_H
+
+#include <stdint.h>
+
+// profiles for setProfile()
+#define SERVO_PROFILE_TRAPEZOID 0  // constant acceleration up to the speed limit and back down
+#define SERVO_PROFILE_SCURVE    1  // smoothstep in time, no step in acceleration at the ends
+
+// default commanded profile, degrees per second and per second squared. The
+// speed is the horn's own rate, so the trapezoid never commands more than the
+// servo gives, and each ramp takes 50 ms, two or three steps of 20 ms. 180
+// degrees then take 400 ms like a jump, see tools/intake_sim.cpp
+#define SERVO_MOTION_SPEED 450
+#define SERVO_MOTION_ACCEL 9000
+
+// default timing model of the servo itself, see setModel(). Typical of a
+// hobby servo, not measured on this gate, until saveServoModel() keeps a
+// measured one
+#define SERVO_MOTION_RATE      450  // degrees per second the horn turns at most
+#define SERVO_MOTION_DEAD_TIME 20   // ms from a new command to the horn moving, one PWM frame
+
+/**
+  Timing model of one servo, kept in NVS by saveServoModel()
+*/
+struct servoModel {
+  float rate;         // degrees per second the horn turns at most
+  uint16_t deadTime;  // ms from a new command to the horn moving
+};
+
+// limits of a measured model, anything beyond is a mistimed sweep
+#define SERVO_MODEL_MAX_RATE      3000
+#define SERVO_MODEL_MAX_DEAD_TIME 200
+
+// angle in degrees written to the servo, e.g. a call to Servo::write()
+typedef void (*servoWrite)(uint16_t angle);
+
+/**************
+  **servoMotion** replaces jumps of a servo from one angle to another.
+
+  moveTo() sets a target and update(millis()), called at a fixed step from a
+  timer (every 20 ms matches the servo PWM frame), writes the next angle of
+  the profile. The servo gives no position feedback, so the physical angle is
+  modelled: the horn follows the commanded angle after a dead time, at no
+  more than its own slew rate. isMoving() and isAt() use the model, so a
+  caller can go on the moment the horn is really there instead of after a
+  fixed worst-case delay.<br>
+
+  To calibrate the model, time a full sweep commanded in one jump and set the
+  rate to the angle over that time, and the dead time to the delay before the
+  horn starts to turn. saveServoModel() keeps it for the next boot.
+****************************************************************************************/
+class servoMotion {
+  public:
+
+    /**
+      @param write called with each new angle
+      @param angle where the servo is now, it is written by begin()
+    */
+    servoMotion(servoWrite write, uint16_t angle);
+
+    /**
+      Write the start angle, the model takes the horn to be there
+    */
+    void begin();
+
+    /**
+      Speed limit and acceleration of the commanded profile
+    */
+    void setSpeed(float speed, float accel);
+
+    void setProfile(uint8_t profile);
+
+    /**
+      Timing model of the servo
+      @param rate degrees per second the horn turns at most
+      @param deadTime ms from a new command to the horn moving
+    */
+    void setModel(float rate, uint16_t deadTime);
+
+    /**
+      Start moving to this angle from wherever the command is now
+    */
+    void moveTo(uint16_t angle);
+
+    /**
+      Advance the profile and the model, call at a fixed step
+      @param now millis()
+    */
+    void update(uint32_t now);
+
+    uint16_t target() const;
+
+    // commanded and modelled angle
+    float command() const;
+    float position() const;
+
+    /**
+      Is the horn still turning according to the model
+    */
+    bool isMoving() const;
+
+    /**
+      Has the horn come to rest at this angle according to the model
+    */
+    bool isAt(uint16_t angle) const;
+
+    /**
+      ms from the first update() after moveTo(), when the profile starts to be
+      written, until the modelled horn was at the target, of the last
+      completed move. moveTo() itself may come up to one step earlier.
+    */
+    uint32_t lastTravel() const;
+
+  private:
+    servoWrite write;
+    uint8_t profile;
+    float speed;
+    float accel;
+    float rate;
+    uint16_t deadTime;
+
+    uint16_t goal;
+    float from;           // command when the move started, S-curve
+    float duration;       // seconds of the S-curve
+    float cmd;
+    float velocity;       // of the trapezoid, degrees per second
+    float modelled;
+    uint16_t written;
+    bool moving;
+    bool started;         // update() has run since moveTo()
+    bool resting;         // the horn was at rest at moveTo(), the dead time applies
+    uint32_t moveStart;
+    uint32_t lastUpdate;
+    uint32_t travel;
+};
+
+/**
+  Read this device's servo model from NVS
+  @return false if none was saved, model is left unchanged
+*/
+bool loadServoModel(servoModel *model);
+
+/**
+  Write this device's servo model to NVS, it survives a reboot
+  @return false if it was not written, or is out of SERVO_MODEL_MAX_RATE or SERVO_MODEL_MAX_DEAD_TIME
+*/
+bool saveServoModel(const servoModel &model);
+
+#endif
@@ -6,13 +6,26 @@
 #include <ESP32Servo.h>
 #include <PN532.h>
 #include <PN532_HSU.h>
+#include <PN532_trace.h>
+#include <emulatetag.h>
+#include <ndef_provider.h>
 #include <PubSubClient.h>
 #include <SPI.h>
 #include <ShiftRegister74HC595.h>
 #include <SoftwareSerial.h>
 #include <WiFi.h>
+#include <buttonInput.h>
+#include <coTask.h>
+#include <eventRing.h>
+#include <itemClassifier.h>
+#include <microsDelay.h>
 #include <millisDelay.h>
+#include <millisScheduler.h>
 #include <qrcode.h>
+#include <sensorFilter.h>
+#include <sensorSampler.h>
+#include <sensorTrace.h>
+#include <servoMotion.h>
 
 // Input PIN
 #define IR_SENSOR_PIN 36
@@ -56,6 +69,10 @@ const int mqtt_port = 1883;
 
 const String topicTrigger = "revend/trigger";
 const String topicAction = "revend/action/" + String(token);
+const String topicTrace = "revend/trace/" + String(token);
+const String topicStats = "revend/stats/" + String(token);
+const String topicCalibrate = "revend/calibrate/" + String(token);
+const String topicSensorTrace = "revend/sensor_trace/" + String(token);
 
 // declare the enum for the state
 enum RevendStep {
@@ -71,80 +88,364 @@ enum RevendState {
   STATE_SUCCESS_REGISTER = 3,
 };
 
-// Current Data
+// Current Data, owned by the NFC task
 struct CurrentData {
   RevendStep Step;
   RevendState State;
   String Identity;
   int PointSuccess;
   int PointFailed;
-  int CountIsSuccess;
-  int CountIsFailed;
-  bool IsSet;
   String Link;
 };
 
 CurrentData current;
 
-struct ActionDataResponse {
+const size_t LINK_SIZE = 192;
+
+// Events for the session, each kind has its own ring from the task producing it
+struct BackendReply {
+  RevendStep Step;
   RevendState State;
-  String Link;
+  char Link[LINK_SIZE];
 };
 
-struct ActionResponse {
-  RevendStep Step;
-  ActionDataResponse Data;
+struct ItemClassified {
+  bool IsMetal;
+};
+
+struct ButtonPressed {
+  unsigned long Time;
+  bool IsLong;  // held for BUTTON_LONG_PRESS_MS, reported on release
+};
+
+// Sensor and gate calibration, sent on topicCalibrate as {"command": n}
+enum CalibrationCommand {
+  CALIBRATE_IDLE = SENSOR_CAL_IDLE,      // measure with nothing inserted
+  CALIBRATE_OBJECT = SENSOR_CAL_OBJECT,  // measure with a non-metal item held in place
+  CALIBRATE_METAL = SENSOR_CAL_METAL,    // measure with a can held in place
+  CALIBRATE_SAVE = 3,                    // keep the measured levels in NVS
+  CALIBRATE_GATE_SWEEP = 4,              // jump the gate open and back to time the horn, outside a session
+  CALIBRATE_GATE_MODEL = 5,              // with "rate" and "dead_time" of the timed sweep, kept in NVS
+};
+
+struct CalibrationRequest {
+  CalibrationCommand Command;
+  float Rate;         // CALIBRATE_GATE_MODEL, degrees per second
+  uint16_t DeadTime;  // CALIBRATE_GATE_MODEL, ms
+};
+
+// Screens for the UI task
+enum UiCommandType {
+  UI_WELCOME = 0,  // welcome message after Delay, then every WELCOME_DELAY
+  UI_TEXT = 1,
+  UI_COUNTER = 2,
+  UI_QRCODE = 3,
+  UI_LOADING = 4,  // animated until the next screen
+};
+
+struct UiCommand {
+  UiCommandType Type;
+  unsigned long Delay;   // UI_WELCOME
+  int Success;           // UI_COUNTER
+  int Failed;            // UI_COUNTER
+  char Text[LINK_SIZE];  // UI_TEXT, UI_QRCODE, UI_LOADING
+};
+
+// Trigger messages for the network task to publish
+struct OutMessage {
+  char Payload[256];
 };
 
 void welcomeMessage();
-void readByStep();
-void callbackAction(ActionResponse res);
+void netTask(void *param);
+void nfcTask(void *param);
+void sensorTask(void *param);
+void uiTask(void *param);
+uint8_t runSession(coTask *task);
+void takeSessionEvents();
+void notifySession(void *context);
+void notifySessionFromISR(void *context);
+void showScreen(UiCommandType type, const String &text = "", unsigned long delay = 0);
+void showCounter();
+void publishTrigger(const String &res);
+void renderScreen(const UiCommand &cmd);
+void countItem(bool isMetal);
+bool canCancel();
+bool cancelByButton();
+void showDeviceInfo();
+void samplerTask(void *param);
+void readSensor(const sensorFrame &frame);
+void takeCalibration();
+void onCancelButton(uint8_t event, uint32_t time, void *context);
+void openServo();
+void closeServo();
+void stepGate();
+void writeGate(uint16_t angle);
+void sweepGate();
+void endGateSweep();
+void setGateModel(float rate, uint16_t deadTime);
+void chuteCleared();
+void callbackAction(const BackendReply &reply);
 void callbackMQTT(char *topic, byte *payload, unsigned int length);
 void clearScreen();
 void drawProgressBar();
 void displayCenteredText(String text, uint8_t textSize);
 void displayCenteredTextX(String text, uint8_t textSize, int16_t yPos);
 void displayQRCode(String text);
-String readRFIDAndNFC();
-void updateCounter();
+bool cardTapped(uint16_t timeout);
+bool actionReceived();
+bool sessionInterrupted();
+bool tagWindowOver();
+bool readerWindowOver();
+String readRFIDAndNFC(uint16_t timeout = 1000);
+void updateCounter(int success, int failed);
 void sendTriggerCancelRequest();
 void sendTriggerCheckUser();
 void sendTriggerSendStatus();
+void publishTrace();
+void flushTrace();
+void publishTraceBatch();
+void publishSensorTrace();
+void requestStats();
+void takeNfcStats();
+void takeSensorStats(uint32_t sensingMillis);
+void publishStats();
+void publishStatsDoc(const DynamicJsonDocument &doc);
+void publishCommandStats(const char *pn532, const PN532Stats &stats);
 
 Adafruit_ST7789 tft = Adafruit_ST7789(TFT_CS, TFT_DC, TFT_RST);
 ShiftRegister74HC595<1> sr(DATA_PIN, CLOCK_PIN, LATCH_PIN);
 PN532_HSU pn532shu(Serial1);
 PN532 nfc(pn532shu);
 SoftwareSerial softwareSerial(SS_RX_PIN, SS_TX_PIN);
+EmulateTag emulateTag(pn532shu);
 DFRobotDFPlayerMini dfPlayer;
 Servo servo;
 
+// Registration link served to phones tapping the reader, as the backend sent it
+class RegisterLinkProvider : public NdefUriProvider {
+ public:
+  void setLink(const String &link) {
+    prefix = NDEF_URIPREFIX_NONE;
+    base = link;
+    if (link.startsWith("https://")) {
+      prefix = NDEF_URIPREFIX_HTTPS;
+      base = link.substring(8);
+    } else if (link.startsWith("http://")) {
+      prefix = NDEF_URIPREFIX_HTTP;
+      base = link.substring(7);
+    }
+    // the scheme only moves into the prefix byte, the phone rebuilds the same link
+    setUri(prefix, base.c_str());
+  }
+
+ private:
+  uint8_t prefix = NDEF_URIPREFIX_NONE;
+  String base;
+};
+
+RegisterLinkProvider registerLink;
+
 WiFiClient espClient;
 PubSubClient client(espClient);
 
 int dotIndex = 0;
-bool isLoading = false;
 String loadingText = "Loading...";
-bool isOpenServo = false;
 
 unsigned long previousMillis = 0;
 const long interval = 100;
 
+// FreeRTOS tasks. Network and NFC share core 0 with the WiFi stack, the item
+// decision and the screen run on core 1; a higher number is a higher priority,
+// so a slow redraw never holds up the sensor or an MQTT keepalive.
+const BaseType_t NET_CORE = 0;
+const UBaseType_t NET_PRIORITY = 3;
+const BaseType_t NFC_CORE = 0;
+const UBaseType_t NFC_PRIORITY = 2;
+const BaseType_t SENSOR_CORE = 1;
+const UBaseType_t SENSOR_PRIORITY = 4;
+const BaseType_t SAMPLER_CORE = 1;
+const UBaseType_t SAMPLER_PRIORITY = 5;
+const BaseType_t UI_CORE = 1;
+const UBaseType_t UI_PRIORITY = 1;
+const uint32_t TASK_STACK = 8192;
+
+// Session events reach the NFC task through lock-free rings, each push gives
+// the task a notification so it sleeps while nothing happens
+eventRing<BackendReply, 4> replies;     // net task -> NFC task
+eventRing<ItemClassified, 8> items;     // sensor task -> NFC task
+eventRing<ButtonPressed, 4> buttons;    // button interrupt -> NFC task
+TaskHandle_t sessionTask = NULL;
+
+// Cancel button, debounced in its interrupt
+buttonInput cancelButton(CANCEL_BUTTON_PIN, HIGH);
+
+// Longest the NFC task sleeps while only waiting for session events
+const unsigned long SESSION_IDLE_WAIT = 1000;
+
+// Bounded queues for screens and published messages, a full queue drops
+const UBaseType_t UI_QUEUE_LENGTH = 4;
+const UBaseType_t OUTBOX_LENGTH = 8;
+QueueHandle_t uiQueue;
+QueueHandle_t outbox;
+
+// Longest the network and UI tasks sleep when there is nothing queued
+const unsigned long NET_PERIOD = 10;
+
+// The NFC task runs the session as a cooperative task, keeping its run time
+coScheduler tasks;
+
+// Set when the server answers or pushes a step, taken by the session
+bool actionPending = false;
+
+// Set by the NFC task while cancelByButton() would end a session, read by the
+// button interrupt, so a press outside a session leaves the PN532 alone
+volatile bool cancellable = false;
+
+// Set by the session while items are being inserted, read by the sensor task
+volatile bool sensing = false;
+
+// Timers of each task, run in deadline order
+millisScheduler netTimers;
+millisScheduler sensorTimers;
+millisScheduler uiTimers;
+
 const unsigned long LOADING_DELAY = 100;
-millisDelay loadingDelay;
+int16_t loadingTimer;
 
 const unsigned long WELCOME_DELAY = 6000;
-millisDelay welcomeDelay;
+int16_t welcomeTimer;
 
-const int WAITING_COUNTER_SENSOR_DELAY = 2;
-const unsigned long SENSOR_DELAY = 250;
-millisDelay sensorDelay;
+// IR and metal sensors sampled by ADC1 DMA, one averaged frame per millisecond
+sensorSampler sampler;
 
-const unsigned long BLINK_DELAY = 1000;
-millisDelay blinkDelay;
+// Median, IIR, idle baseline and hysteresis over the frames, owned by the sensor task
+sensorFilter filter;
+eventRing<CalibrationRequest, 4> calibrations;  // net task -> sensor task
 
-const unsigned long SERVO_WAITING_DELAY = 400;
-millisDelay servoDelay;
+// Raw frames of each session, sent as they fill up so a misclassification
+// report can be replayed offline
+sensorTrace sensorRecorder;
+
+// Frames a calibration point is averaged over
+const uint16_t CALIBRATION_FRAMES = 1000;
+
+// Frames from the moment an object appears until it is classified
+const uint16_t CLASSIFY_FRAMES = 30;
+
+// Windows an item may stay partial before it is rejected, it is not going in any further
+const uint8_t PARTIAL_WINDOWS = 4;
+
+// Waveform features of the item in front of the sensors and the decision on
+// them, owned by the sensor task
+itemFeatureExtractor features;
+treeClassifier defaultClassifier;
+itemClassifier *classifier = &defaultClassifier;
+
+// Intake stages of the item in front of the sensors. The next item is sensed
+// as soon as the chute clears, while the gate and the status report of the
+// previous one are still in progress.
+enum IntakeStage {
+  INTAKE_EMPTY = 0,        // chute clear, waiting for an object
+  INTAKE_CLASSIFYING = 1,  // object present, collecting its features
+  INTAKE_DECIDED = 2,      // decided, waiting for it to drop or be taken back
+};
+
+IntakeStage intakeStage = INTAKE_DECIDED;
+uint32_t intakeAppeared;    // frame index the object appeared at
+uint8_t intakePartials;     // windows classified partial so far
+itemMaterial intakeLogged;  // last result printed for this item
+
+// Counted by the sensor task, published with the stats
+struct IntakeStats {
+  uint32_t Items;
+  uint32_t SensingMillis;     // time items could be inserted
+  uint32_t DecideFramesSum;   // from an object appearing to its decision
+  uint32_t DecideFramesMax;
+  uint32_t ClearMillisSum;    // from a decision to the chute clearing
+  uint32_t Cleared;
+  uint32_t FellThrough;       // gone undecided while the gate was open or closing
+};
+
+IntakeStats intakeStats;
+bool intakeDecided = false;  // INTAKE_DECIDED was reached by a decision
+unsigned long intakeDecidedAt;
+
+// The gate opens for an accepted can and closes SERVO_CLEAR_DELAY after the
+// chute clears, at most SERVO_HOLD_DELAY after it is open. An unclassified
+// object arriving while it is open closes it at once. The servo is stepped
+// along a profile every SERVO_STEP and has no position feedback, so open and
+// closed are taken from the timing model of servoMotion. An item over the
+// gate drops once it is open wider than GATE_HOLD_ANGLE.
+const uint16_t GATE_OPEN_ANGLE = 0;
+const uint16_t GATE_CLOSED_ANGLE = 180;
+const uint16_t GATE_HOLD_ANGLE = 90;
+const unsigned long GATE_SWEEP_HOLD = 1000;  // open this long in a calibration sweep
+const unsigned long SERVO_STEP = 20;
+const unsigned long SERVO_HOLD_DELAY = 250;
+const unsigned long SERVO_CLEAR_DELAY = 150;
+int16_t servoTimer;
+int16_t gateTimer;
+int16_t sweepTimer;
+servoMotion gate(writeGate, GATE_CLOSED_ANGLE);
+bool gateCalibrated = false;  // the servo model was measured, not the defaults
+bool gateOpen = false;
+unsigned long gateOpenedAt;
+
+// The sensor task wakes this often to take the sampled frames, the cancel
+// button and its timers
+const unsigned long SENSOR_TASK_PERIOD = 5;
+
+// Longest the sampling task waits for a DMA chunk
+const unsigned long SAMPLER_WAIT = 100;
+
+// Longest a card poll may block the session before queued events are taken
+const uint16_t READER_POLL = 200;
+
+// While registering the PN532 alternates between emulating a tag with the
+// registration link and polling for the user's card
+const unsigned long REGISTER_TAG_WINDOW = 700;
+const unsigned long REGISTER_READER_WINDOW = 300;
+const uint16_t REGISTER_TAG_POLL = 50;
+const uint16_t REGISTER_READER_POLL = 100;
+millisDelay registerRoleDelay;
+
+// Full batches of PN532 trace records are sent on every net pass, the rest
+// every TRACE_DELAY, so the ring holds less than a batch between passes
+const unsigned long TRACE_DELAY = 1000;
+const int TRACE_BATCH = 8;
+int16_t traceTimer;
+
+const unsigned long STATS_DELAY = 60000;
+int16_t statsTimer;
+
+// Follows the sensor task's vTaskDelayUntil() schedule, its lateness is how
+// late the task woke up
+const uint64_t SENSOR_PROBE_DELAY = SENSOR_TASK_PERIOD * 1000;
+microsDelay sensorProbe;
+
+// Counters are copied and reset by the task updating them when the net task
+// asks, and handed over through these rings to be published
+struct NfcStatsSnapshot {
+  PN532Stats Reader;
+  PN532Stats Target;           // the EmulateTag instance
+  coTask Tasks[CO_SCHEDULER_SIZE];
+  uint8_t TaskCount;
+};
+
+struct SensorStatsSnapshot {
+  uint32_t Wakeups;
+  uint32_t LateMeanMicros;
+  uint32_t LateMaxMicros;
+  IntakeStats Intake;          // since boot, with the open session up to the snapshot
+  uint32_t GateTravelMillis;
+  bool GateCalibrated;
+};
+
+volatile bool nfcStatsWanted = false;
+volatile bool sensorStatsWanted = false;
+eventRing<NfcStatsSnapshot, 2> nfcStats;        // NFC task -> net task
+eventRing<SensorStatsSnapshot, 2> sensorStats;  // sensor task -> net task
 
 void setup() {
   Serial.begin(115200);
@@ -158,11 +459,29 @@ void setup() {
   displayCenteredText("Booting...", DEFAULT_TEXT_SIZE);
 
   Serial.println(F("Configuring Pins..."));
-  pinMode(CANCEL_BUTTON_PIN, INPUT);
   pinMode(IR_SENSOR_PIN, INPUT);
   pinMode(METAL_SENSOR_PIN, INPUT);
+  if (!sampler.begin(digitalPinToAnalogChannel(IR_SENSOR_PIN), digitalPinToAnalogChannel(METAL_SENSOR_PIN))) {
+    Serial.println("ADC sampler error!");
+  }
+  sensorCalibration calibration;
+  if (loadCalibration(&calibration)) {
+    filter.setCalibration(calibration);
+    Serial.printf("Sensor calibration: IR %u/%u, metal %u/%u\n", calibration.irIdle, calibration.irObject,
+                  calibration.metalIdle, calibration.metalMetal);
+  } else {
+    Serial.println("Sensor not calibrated, using default levels");
+  }
+  servoModel model;
+  if (loadServoModel(&model)) {
+    gate.setModel(model.rate, model.deadTime);
+    gateCalibrated = true;
+    Serial.printf("Gate model: %.0f deg/s, %u ms dead time\n", model.rate, model.deadTime);
+  } else {
+    Serial.println("Gate not calibrated, using the default servo model");
+  }
   servo.attach(SERVO_PIN);
-  servo.write(180);
+  gate.begin();
 
   softwareSerial.begin(9600);
   Serial.println(F("Initializing DFPlayer ... (May take 3~5 seconds)"));
@@ -220,6 +539,7 @@ void setup() {
   clearScreen();
   displayCenteredText("Connecting MQTT...", DEFAULT_TEXT_SIZE);
   client.setServer(mqtt_broker, mqtt_port);
+  client.setBufferSize(512);
   client.setCallback(callbackMQTT);
   while (!client.connected()) {
     String client_id = "revend-";
@@ -234,180 +554,531 @@ void setup() {
 
   Serial.println("MQTT connected");
   client.subscribe(topicAction.c_str());
+  client.subscribe(topicCalibrate.c_str());
+
+  replies.setNotify(notifySession);
+  items.setNotify(notifySession);
+  buttons.setNotify(notifySessionFromISR);
+  cancelButton.begin(onCancelButton);
+  uiQueue = xQueueCreate(UI_QUEUE_LENGTH, sizeof(UiCommand));
+  outbox = xQueueCreate(OUTBOX_LENGTH, sizeof(OutMessage));
+
+  welcomeTimer = uiTimers.add(welcomeMessage, WELCOME_DELAY);
+  loadingTimer = uiTimers.add(drawProgressBar, LOADING_DELAY);
+  servoTimer = sensorTimers.add(closeServo);
+  gateTimer = sensorTimers.add(stepGate, SERVO_STEP);
+  sweepTimer = sensorTimers.add(endGateSweep);
+  traceTimer = netTimers.add(flushTrace, TRACE_DELAY);
+  statsTimer = netTimers.add(requestStats, STATS_DELAY);
+
+  netTimers.start(traceTimer, TRACE_DELAY);
+  netTimers.start(statsTimer, STATS_DELAY);
+  sensorTimers.start(gateTimer, SERVO_STEP);
+
+  tasks.add("session", runSession);
+
+  showScreen(UI_WELCOME);
+
+  xTaskCreatePinnedToCore(netTask, "net", TASK_STACK, NULL, NET_PRIORITY, NULL, NET_CORE);
+  xTaskCreatePinnedToCore(nfcTask, "nfc", TASK_STACK, NULL, NFC_PRIORITY, &sessionTask, NFC_CORE);
+  xTaskCreatePinnedToCore(samplerTask, "sampler", TASK_STACK, NULL, SAMPLER_PRIORITY, NULL, SAMPLER_CORE);
+  xTaskCreatePinnedToCore(sensorTask, "sensor", TASK_STACK, NULL, SENSOR_PRIORITY, NULL, SENSOR_CORE);
+  xTaskCreatePinnedToCore(uiTask, "ui", TASK_STACK, NULL, UI_PRIORITY, NULL, UI_CORE);
+}
 
-  welcomeDelay.start(WELCOME_DELAY);
-  loadingDelay.start(LOADING_DELAY);
-  blinkDelay.start(BLINK_DELAY);
+void loop() {
+  // all the work is done by the tasks started in setup()
+  vTaskDelete(NULL);
+}
 
-  welcomeMessage();
+// MQTT keepalive, incoming actions and everything published
+void netTask(void *param) {
+  while (true) {
+    client.loop();
+    netTimers.run();
+    publishTrace();
+    publishSensorTrace();
+    publishStats();
+
+    unsigned long wait = netTimers.nextDeadline();
+    OutMessage msg;
+    if (xQueueReceive(outbox, &msg, pdMS_TO_TICKS(wait < NET_PERIOD ? wait : NET_PERIOD)) == pdTRUE) {
+      if (!client.publish(topicTrigger.c_str(), msg.Payload)) {
+        Serial.println("Trigger not sent");
+      }
+    }
+  }
 }
 
-void loop() {
-  client.loop();
-
-  if (isLoading) {
-    drawProgressBar();
-  }
-
-  if (welcomeDelay.justFinished()) {
-    welcomeDelay.repeat();
-    welcomeMessage();
-  }
-
-  int cancelButton = digitalRead(CANCEL_BUTTON_PIN);
-  if (cancelButton == HIGH && current.Step != STEP_CANCEL && current.Identity != "") {
-    current.Step = STEP_CANCEL;
-    clearScreen();
-    displayCenteredText("Exiting", DEFAULT_TEXT_SIZE);
-    Serial.println("Exiting button pressed");
-    sendTriggerCancelRequest();
-    sr.setAllLow();
-    current.Identity = "";
-    current.PointSuccess = 0;
-    current.PointFailed = 0;
-    current.CountIsSuccess = 0;
-    current.CountIsFailed = 0;
-    welcomeDelay.repeat();
-  }
-
-  readByStep();
-
-  if (servoDelay.justFinished() || isOpenServo) {
-    isOpenServo = false;
-    static bool isBack = true;
-    if (isBack) {
-      servo.write(0);
-      servoDelay.start(SERVO_WAITING_DELAY);
-      isBack = false;
-    } else {
-      servo.write(180);
-      servoDelay.stop();
-      isBack = true;
+// The PN532 and the session flow, the only task touching current
+void nfcTask(void *param) {
+  while (true) {
+    takeSessionEvents();
+    cancellable = canCancel();
+    if (nfcStatsWanted) {
+      nfcStatsWanted = false;
+      takeNfcStats();
     }
+    tasks.run();
+    // while items are inserted the session only reacts to events, otherwise
+    // it goes straight back to polling the PN532
+    ulTaskNotifyTake(pdTRUE, sensing ? pdMS_TO_TICKS(SESSION_IDLE_WAIT) : 1);
   }
 }
 
-void welcomeMessage() {
-  Serial.println("Welcome Revend");
-  clearScreen();
-  displayCenteredText("Revend", DEFAULT_TEXT_SIZE);
-  //? voice selamat datang
-  //? voice silahkan tempelkan kartu anda
+// Blocks on the ADC DMA buffer and turns conversions into frames
+void samplerTask(void *param) {
+  while (true) {
+    sampler.poll(SAMPLER_WAIT);
+  }
 }
 
-void readSensor() {
-  Serial.print("Read sensor: ");
-  int irSensor = analogRead(IR_SENSOR_PIN);
-  int metalSensor = analogRead(METAL_SENSOR_PIN);
-  Serial.print(irSensor);
-  Serial.print(" - ");
-  Serial.println(metalSensor);
-  bool hasObject = irSensor < 1200;
-  bool isMetal = metalSensor < 500;
-  if (isMetal && hasObject) {
-    Serial.println("success botol kaleng!");
-    if (current.IsSet) return;
-    if (current.CountIsSuccess < WAITING_COUNTER_SENSOR_DELAY) {
-      current.CountIsSuccess++;
-      return;
+// Item decisions, the servo and the cancel button, woken at a fixed rate
+void sensorTask(void *param) {
+  bool wasSensing = false;
+  unsigned long sensingSince = 0;
+  // start on a tick, the probe is anchored just after it like every later wake
+  vTaskDelay(1);
+  TickType_t wake = xTaskGetTickCount();
+  sensorProbe.start(SENSOR_PROBE_DELAY);
+  while (true) {
+    if (sensorStatsWanted) {
+      sensorStatsWanted = false;
+      takeSensorStats(wasSensing ? millis() - sensingSince : 0);
     }
-    current.PointSuccess++;
-    current.IsSet = true;
-    sr.setAllLow();
-    sr.set(1, HIGH);
-    updateCounter();
-    sendTriggerSendStatus();
-    isOpenServo = true;
-    return;
+
+    if (sensing != wasSensing) {
+      wasSensing = sensing;
+      if (wasSensing) {
+        sensingSince = millis();
+      } else {
+        intakeStats.SensingMillis += millis() - sensingSince;
+      }
+      // an item already in the chute when sensing starts is not counted
+      intakeStage = INTAKE_DECIDED;
+      intakeDecided = false;
+      features.reset();
+      sr.setAllLow();
+      sensorRecorder.flush();
+    }
+    takeCalibration();
+    // frames are always filtered so the baselines keep tracking between sessions
+    sensorFrame frame;
+    while (sampler.read(&frame)) {
+      filter.update(frame.ir, frame.metal);
+      if (wasSensing) {
+        sensorRecorder.record(frame);
+        readSensor(frame);
+      }
+    }
+    sensorTimers.run();
+
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(SENSOR_TASK_PERIOD));
+    // a wake slightly ahead of the anchor is on time, it ends the probe unmeasured
+    if (!sensorProbe.justFinished()) {
+      sensorProbe.finish();
+      sensorProbe.justFinished();
+    }
+    sensorProbe.repeat();
   }
+}
 
-  if (hasObject && !isMetal) {
-    Serial.println("not kaleng!");
-    if (current.IsSet) return;
-    if (current.CountIsFailed < WAITING_COUNTER_SENSOR_DELAY) {
-      current.CountIsFailed++;
-      return;
+// The only task drawing on the TFT
+void uiTask(void *param) {
+  while (true) {
+    uiTimers.run();
+
+    // only the animations run here, with none of them running it sleeps until the next screen
+    unsigned long wait = uiTimers.nextDeadline();
+    TickType_t ticks = wait == MILLIS_SCHEDULER_IDLE ? portMAX_DELAY : pdMS_TO_TICKS(wait);
+    UiCommand cmd;
+    if (xQueueReceive(uiQueue, &cmd, ticks) == pdTRUE) {
+      renderScreen(cmd);
+    }
+  }
+}
+
+void takeSessionEvents() {
+  BackendReply reply;
+  while (replies.pop(&reply)) {
+    callbackAction(reply);
+  }
+  ItemClassified item;
+  while (items.pop(&item)) {
+    countItem(item.IsMetal);
+  }
+  // a long press is reported on release after its press, which may have
+  // just cancelled the session, leave the "Exiting" screen up then
+  static bool pressCancelled = false;
+  ButtonPressed button;
+  while (buttons.pop(&button)) {
+    if (!button.IsLong) {
+      pressCancelled = cancelByButton();
+      // a press between two waits must not end the next command instead
+      pn532shu.clearAbort();
+    } else if (!pressCancelled) {
+      showDeviceInfo();
     }
+  }
+}
+
+void notifySession(void *context) {
+  if (sessionTask != NULL) {
+    xTaskNotifyGive(sessionTask);
+  }
+}
+
+void IRAM_ATTR notifySessionFromISR(void *context) {
+  if (sessionTask != NULL) {
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(sessionTask, &woken);
+    portYIELD_FROM_ISR(woken);
+  }
+}
+
+void showScreen(UiCommandType type, const String &text, unsigned long delay) {
+  UiCommand cmd;
+  cmd.Type = type;
+  cmd.Delay = delay;
+  cmd.Success = current.PointSuccess;
+  cmd.Failed = current.PointFailed;
+  strlcpy(cmd.Text, text.c_str(), sizeof(cmd.Text));
+  if (xQueueSend(uiQueue, &cmd, 0) != pdTRUE) {
+    Serial.println("UI queue full, screen dropped");
+  }
+}
+
+void showCounter() {
+  showScreen(UI_COUNTER);
+}
+
+void publishTrigger(const String &res) {
+  OutMessage msg;
+  strlcpy(msg.Payload, res.c_str(), sizeof(msg.Payload));
+  if (xQueueSend(outbox, &msg, 0) != pdTRUE) {
+    Serial.println("Outbox full, trigger dropped");
+  }
+}
+
+void renderScreen(const UiCommand &cmd) {
+  uiTimers.stop(loadingTimer);
+  if (cmd.Type == UI_WELCOME) {
+    uiTimers.start(welcomeTimer, cmd.Delay);
+    return;
+  }
+
+  uiTimers.stop(welcomeTimer);
+  switch (cmd.Type) {
+    case UI_TEXT:
+      clearScreen();
+      displayCenteredText(cmd.Text, DEFAULT_TEXT_SIZE);
+      break;
+    case UI_COUNTER:
+      updateCounter(cmd.Success, cmd.Failed);
+      break;
+    case UI_QRCODE:
+      clearScreen();
+      displayQRCode(cmd.Text);
+      break;
+    case UI_LOADING:
+      clearScreen();
+      loadingText = cmd.Text;
+      uiTimers.start(loadingTimer, LOADING_DELAY);
+      break;
+    default:
+      break;
+  }
+}
+
+// Runs in the button interrupt, the buttons ring has no other producer.
+// A press in a session also ends the PN532 wait, so the nfc task takes it
+// within a tick instead of after the poll or tag window
+void IRAM_ATTR onCancelButton(uint8_t event, uint32_t time, void *context) {
+  ButtonPressed pressed;
+  pressed.Time = time;
+  pressed.IsLong = event == BUTTON_LONG_PRESS;
+  // before the push, so the abort is set by the time the nfc task takes the press
+  if (!pressed.IsLong && cancellable) {
+    pn532shu.abort();
+  }
+  buttons.push(pressed);
+}
+
+// A tapped card opened a session that was not cancelled since
+bool canCancel() {
+  return current.Step != STEP_CANCEL && current.Identity != "";
+}
+
+// Returns true if a session was cancelled
+bool cancelByButton() {
+  if (!canCancel()) return false;
+  current.Step = STEP_CANCEL;
+  sensing = false;
+  showScreen(UI_TEXT, "Exiting");
+  Serial.println("Exiting button pressed");
+  sendTriggerCancelRequest();
+  current.Identity = "";
+  current.PointSuccess = 0;
+  current.PointFailed = 0;
+  showScreen(UI_WELCOME, "", WELCOME_DELAY);
+  return true;
+}
+
+// A long press outside a session shows where to reach the device
+void showDeviceInfo() {
+  if (current.Identity != "") return;
+  showScreen(UI_TEXT, WiFi.localIP().toString());
+  showScreen(UI_WELCOME, "", WELCOME_DELAY);
+}
+
+void countItem(bool isMetal) {
+  if (current.Step != STEP_REVEND) return;
+  if (isMetal) {
+    current.PointSuccess++;
+  } else {
     current.PointFailed++;
-    current.IsSet = true;
-    sr.setAllLow();
-    sr.set(0, HIGH);
-    updateCounter();
-    sendTriggerSendStatus();
+  }
+  showCounter();
+  sendTriggerSendStatus();
+}
+
+// One user session: report tapped cards until the server answers, then
+// follow its answer until the session is cancelled or answered again
+uint8_t runSession(coTask *task) {
+  TASK_BEGIN(task);
+  while (true) {
+    TASK_AWAIT(task, actionReceived());
+    actionPending = false;
+
+    if (current.Step != STEP_AUTH || current.State == STATE_NONE) {
+      // a cancel or an empty answer has no screen of its own, end the loading one
+      if (current.Step != STEP_REVEND) showScreen(UI_WELCOME);
+      continue;
+    }
+
+    if (current.State == STATE_MUST_REGISTER) {
+      Serial.println("Must Register");
+      showScreen(UI_QRCODE, current.Link);
+      registerLink.setLink(current.Link);
+      emulateTag.setNdefProvider(&registerLink);
+      while (!sessionInterrupted()) {
+        registerRoleDelay.start(REGISTER_TAG_WINDOW);
+        TASK_AWAIT(task, tagWindowOver());
+        registerRoleDelay.start(REGISTER_READER_WINDOW);
+        TASK_AWAIT(task, readerWindowOver());
+      }
+      emulateTag.stop();
+      continue;
+    }
+
+    Serial.println(current.State == STATE_SUCCESS_REGISTER ? "Success Register" : "Already Registered");
+    //? voice selamat datang, selamat bergabung
+    //? voice silahkan ambil sampah anda
+    //? set state to pilih sampah
+    showCounter();
+    current.Step = STEP_REVEND;
+    sensing = true;
+    TASK_AWAIT(task, actionPending || current.Step != STEP_REVEND);
+    sensing = false;
+  }
+  TASK_END(task);
+}
+
+void writeGate(uint16_t angle) {
+  servo.write(angle);
+}
+
+// Open and close the gate in one jump each, bypassing the profile and the
+// model, so the horn can be timed, e.g. on video, for CALIBRATE_GATE_MODEL
+void sweepGate() {
+  if (sensing || gateOpen || gate.isMoving() || sensorTimers.isRunning(sweepTimer)) {
+    Serial.println("Gate sweep refused, the gate is in use");
     return;
   }
+  Serial.printf("Gate sweep: open now, closed in %lu ms\n", GATE_SWEEP_HOLD);
+  servo.write(GATE_OPEN_ANGLE);
+  sensorTimers.start(sweepTimer, GATE_SWEEP_HOLD);
+}
 
-  current.CountIsSuccess = 0;
-  current.CountIsFailed = 0;
-  current.IsSet = false;
-  Serial.println("not detected!");
+// back to where servoMotion last put the gate, in case a session started
+void endGateSweep() {
+  servo.write((uint16_t)(gate.command() + 0.5f));
+}
 
-  sr.setAllLow();
-  sr.set(2, HIGH);
+void setGateModel(float rate, uint16_t deadTime) {
+  servoModel model = {rate, deadTime};
+  if (!saveServoModel(model)) {
+    Serial.printf("Gate model %.0f deg/s, %u ms not saved!\n", rate, deadTime);
+    return;
+  }
+  gate.setModel(rate, deadTime);
+  gateCalibrated = true;
+  Serial.printf("Gate model saved: %.0f deg/s, %u ms dead time\n", rate, deadTime);
 }
 
-void readByStep() {
-  switch (current.Step) {
-    case STEP_AUTH:
-      switch (current.State) {
-        case STATE_ALREADY_REGISTERED:
-          if (current.IsSet) return;
-          Serial.println("Already Registered");
-          //? voice selamat datang, selamat bergabung
-          //? voice silahkan ambil sampah anda
-          //? set state to pilih sampah
-          clearScreen();
-          updateCounter();
-          current.Step = STEP_REVEND;
-          sensorDelay.start(SENSOR_DELAY);
-          break;
-        case STATE_MUST_REGISTER:
-          if (current.IsSet) return;
-          Serial.println("Must Register");
-          clearScreen();
-          displayQRCode(current.Link);
-          break;
-        case STATE_SUCCESS_REGISTER:
-          if (current.IsSet) return;
-          Serial.println("Success Register");
-          //? voice selamat datang, selamat bergabung
-          //? voice silahkan ambil sampah anda
-          //? set state to pilih sampah
-          clearScreen();
-          updateCounter();
-          current.Step = STEP_REVEND;
-          sensorDelay.start(SENSOR_DELAY);
-          break;
+// The hold timer starts once the gate is open, not when it was told to open
+void openServo() {
+  gate.moveTo(GATE_OPEN_ANGLE);
+  gateOpen = true;
+}
+
+void closeServo() {
+  gate.moveTo(GATE_CLOSED_ANGLE);
+  gateOpen = false;
+}
+
+void stepGate() {
+  bool opening = gate.isMoving() && gate.target() == GATE_OPEN_ANGLE;
+  gate.update(millis());
+  if (opening && gate.isAt(GATE_OPEN_ANGLE)) {
+    gateOpenedAt = millis();
+    if (!sensorTimers.isRunning(servoTimer)) {
+      sensorTimers.start(servoTimer, SERVO_HOLD_DELAY);
+    }
+  }
+}
+
+// The decided item has left the sensors, close the gate early behind a can
+void chuteCleared() {
+  intakeStats.ClearMillisSum += millis() - intakeDecidedAt;
+  intakeStats.Cleared++;
+  if (!gateOpen) return;
+  if (!gate.isAt(GATE_OPEN_ANGLE) || millis() - gateOpenedAt + SERVO_CLEAR_DELAY < SERVO_HOLD_DELAY) {
+    sensorTimers.start(servoTimer, SERVO_CLEAR_DELAY);
+  }
+}
+
+void welcomeMessage() {
+  Serial.println("Welcome Revend");
+  clearScreen();
+  displayCenteredText("Revend", DEFAULT_TEXT_SIZE);
+  //? voice selamat datang
+  //? voice silahkan tempelkan kartu anda
+}
+
+void readSensor(const sensorFrame &frame) {
+  bool present = filter.objectPresent();
+
+  switch (intakeStage) {
+    case INTAKE_EMPTY:
+      if (!present) return;
+      intakeStage = INTAKE_CLASSIFYING;
+      intakeAppeared = frame.index;
+      intakePartials = 0;
+      intakeLogged = MATERIAL_UNKNOWN;
+      features.reset();
+      if (gateOpen) {
+        // not known to be a can yet, it must not fall through
+        sensorTimers.stop(servoTimer);
+        closeServo();
       }
-      current.IsSet = true;
       break;
-    case STEP_REVEND:
-      if (sensorDelay.justFinished()) {
-        sensorDelay.repeat();
-        readSensor();
+
+    case INTAKE_CLASSIFYING:
+      if (present) break;
+      intakeStage = INTAKE_EMPTY;
+      if (gateOpen || gate.isMoving()) {
+        // dropped through the gate before it was accepted
+        intakeStats.FellThrough++;
+        Serial.println("fell through!");
+      } else {
+        // taken back before a decision
+        Serial.println("not detected!");
       }
-      break;
+      sr.setAllLow();
+      sr.set(2, HIGH);
+      return;
 
-    default:
-      String tagId = readRFIDAndNFC();
-      if (tagId != "" && current.Identity != tagId) {
-        current.Identity = tagId;
-        sendTriggerCheckUser();
+    case INTAKE_DECIDED:
+      if (present) return;
+      intakeStage = INTAKE_EMPTY;
+      if (intakeDecided) {
+        chuteCleared();
       }
-      break;
+      Serial.println("not detected!");
+      sr.setAllLow();
+      sr.set(2, HIGH);
+      return;
+  }
+
+  features.add(filter);
+  if (features.frames() < CLASSIFY_FRAMES) return;
+  if (!gateOpen && gate.position() < GATE_HOLD_ANGLE) return;  // decide once the gate holds it
+
+  itemClass result = classifier->classify(features.features());
+  features.reset();
+  if (result.material == MATERIAL_PARTIAL && ++intakePartials >= PARTIAL_WINDOWS) {
+    result.material = MATERIAL_OTHER;  // held short of the sensors, rejected
+  }
+  if (result.material != intakeLogged) {
+    intakeLogged = result.material;
+    Serial.printf("%s %u%%: %u - %u\n", itemMaterialName(result.material), result.confidence,
+                  filter.ir(), filter.metal());
+  }
+  if (result.material == MATERIAL_PARTIAL) {
+    // look again over the next window, the item may still be pushed in
+    return;
+  }
+
+  intakeStage = INTAKE_DECIDED;
+  intakeDecided = true;
+  intakeDecidedAt = millis();
+  uint32_t decideFrames = frame.index - intakeAppeared;
+  intakeStats.Items++;
+  intakeStats.DecideFramesSum += decideFrames;
+  if (decideFrames > intakeStats.DecideFramesMax) {
+    intakeStats.DecideFramesMax = decideFrames;
+  }
+
+  ItemClassified event;
+  event.IsMetal = result.material == MATERIAL_CAN;
+  sr.setAllLow();
+  if (event.IsMetal) {
+    sr.set(1, HIGH);
+    openServo();
+  } else {
+    sr.set(0, HIGH);
+  }
+  items.push(event);
+}
+
+void takeCalibration() {
+  static bool wasCalibrating = false;
+  if (wasCalibrating && !filter.isCalibrating()) {
+    const sensorCalibration &calibration = filter.calibration();
+    if (!filter.calibrationAccepted()) {
+      Serial.println("Calibration point rejected, object and metal levels must stay below idle");
+    }
+    Serial.printf("Calibrated: IR %u/%u, metal %u/%u\n", calibration.irIdle, calibration.irObject,
+                  calibration.metalIdle, calibration.metalMetal);
+  }
+  wasCalibrating = filter.isCalibrating();
+
+  CalibrationRequest request;
+  while (calibrations.pop(&request)) {
+    if (request.Command == CALIBRATE_SAVE) {
+      Serial.println(saveCalibration(filter.calibration()) ? "Calibration saved" : "Calibration not saved!");
+    } else if (request.Command == CALIBRATE_GATE_SWEEP) {
+      sweepGate();
+    } else if (request.Command == CALIBRATE_GATE_MODEL) {
+      setGateModel(request.Rate, request.DeadTime);
+    } else {
+      filter.calibrate(request.Command, CALIBRATION_FRAMES);
+      wasCalibrating = true;
+    }
   }
 }
 
-void updateCounter() {
+void updateCounter(int success, int failed) {
   clearScreen();
   tft.setTextColor(ST77XX_WHITE);
   displayCenteredTextX("Success", DEFAULT_TEXT_SIZE, 20);
   tft.setTextColor(ST77XX_GREEN);
-  displayCenteredTextX(String(current.PointSuccess), DEFAULT_COUNTER_SIZE, 50);
+  displayCenteredTextX(String(success), DEFAULT_COUNTER_SIZE, 50);
   tft.setTextColor(ST77XX_WHITE);
   displayCenteredTextX("Failed", DEFAULT_TEXT_SIZE, 140);
   tft.setTextColor(ST77XX_RED);
-  displayCenteredTextX(String(current.PointFailed), DEFAULT_COUNTER_SIZE, 170);
+  displayCenteredTextX(String(failed), DEFAULT_COUNTER_SIZE, 170);
   tft.setTextColor(ST77XX_WHITE);
 }
 
@@ -418,7 +1089,7 @@ void sendTriggerCancelRequest() {
   doc["data"]["identity"] = current.Identity;
   String res = "";
   serializeJson(doc, res);
-  client.publish(topicTrigger.c_str(), res.c_str());
+  publishTrigger(res);
   Serial.println("Send Trigger Cancel Request");
 }
 
@@ -429,7 +1100,7 @@ void sendTriggerCheckUser() {
   doc["data"]["identity"] = current.Identity;
   String res = "";
   serializeJson(doc, res);
-  client.publish(topicTrigger.c_str(), res.c_str());
+  publishTrigger(res);
   Serial.println("Send Trigger Check User");
 }
 
@@ -442,10 +1113,180 @@ void sendTriggerSendStatus() {
   doc["data"]["success"] = current.PointSuccess;
   String res = "";
   serializeJson(doc, res);
-  client.publish(topicTrigger.c_str(), res.c_str());
+  publishTrigger(res);
   Serial.println("Send Trigger Send Status");
 }
 
+void publishTrace() {
+  while (PN532Trace::count() >= TRACE_BATCH) {
+    publishTraceBatch();
+  }
+}
+
+void flushTrace() {
+  while (PN532Trace::count() > 0) {
+    publishTraceBatch();
+  }
+}
+
+void publishTraceBatch() {
+  PN532TraceRecord records[TRACE_BATCH];
+  int count = 0;
+  while (count < TRACE_BATCH && PN532Trace::pop(&records[count])) {
+    count++;
+  }
+  if (count > 0) {
+    client.publish(topicTrace.c_str(), (const uint8_t *)records, count * sizeof(PN532TraceRecord));
+  }
+}
+
+void publishSensorTrace() {
+  sensorTraceBlock block;
+  while (sensorRecorder.pop(&block)) {
+    client.publish(topicSensorTrace.c_str(), (const uint8_t *)&block, sensorTrace::size(block));
+  }
+}
+
+// Runs on the net task, the counters are taken by their own tasks
+void requestStats() {
+  nfcStatsWanted = true;
+  sensorStatsWanted = true;
+  notifySession(NULL);
+}
+
+// Runs on the NFC task, between PN532 commands and session runs
+void takeNfcStats() {
+  static NfcStatsSnapshot snapshot;
+  nfc.getStats(&snapshot.Reader);
+  emulateTag.getStats(&snapshot.Target);
+  snapshot.TaskCount = tasks.count();
+  for (uint8_t i = 0; i < snapshot.TaskCount; i++) {
+    snapshot.Tasks[i] = *tasks.get(i);
+  }
+  tasks.resetStats();
+  if (!nfcStats.push(snapshot)) {
+    Serial.println("Stats ring full, NFC stats dropped");
+  }
+}
+
+// Runs on the sensor task, between two wakes
+// @param sensingMillis of the session still open, not yet in intakeStats
+void takeSensorStats(uint32_t sensingMillis) {
+  SensorStatsSnapshot snapshot;
+  snapshot.Wakeups = sensorProbe.expiries();
+  snapshot.LateMeanMicros = sensorProbe.meanLateness();
+  snapshot.LateMaxMicros = sensorProbe.maxLateness();
+  sensorProbe.resetLateness();
+  snapshot.Intake = intakeStats;
+  snapshot.Intake.SensingMillis += sensingMillis;
+  snapshot.GateTravelMillis = gate.lastTravel();
+  snapshot.GateCalibrated = gateCalibrated;
+  if (!sensorStats.push(snapshot)) {
+    Serial.println("Stats ring full, sensor stats dropped");
+  }
+}
+
+// Throughput of the intake pipeline since boot, counted by the sensor task. A
+// message of its own, with the general sensor figures it would not fit the
+// 512 byte MQTT buffer
+void publishIntakeStats(const SensorStatsSnapshot &snapshot) {
+  const IntakeStats &stats = snapshot.Intake;
+  uint32_t framePeriod = sampler.framePeriod();
+  DynamicJsonDocument doc(384);
+  doc["device_id"] = String(token);
+  doc["intake_items"] = stats.Items;
+  doc["intake_items_per_min"] = stats.SensingMillis > 0 ? stats.Items * 60000.0 / stats.SensingMillis : 0;
+  doc["intake_decide_ms_mean"] = stats.Items > 0 ? stats.DecideFramesSum * framePeriod / 1000.0 / stats.Items : 0;
+  doc["intake_decide_ms_max"] = stats.DecideFramesMax * framePeriod / 1000;
+  doc["intake_clear_ms_mean"] = stats.Cleared > 0 ? (double)stats.ClearMillisSum / stats.Cleared : 0;
+  doc["intake_fell_through"] = stats.FellThrough;
+  // modelled, from the default servo model until the gate is calibrated
+  doc["gate_travel_ms"] = snapshot.GateTravelMillis;
+  doc["gate_calibrated"] = snapshot.GateCalibrated;
+  publishStatsDoc(doc);
+}
+
+// PubSubClient refuses a message longer than its buffer, or with no connection
+void publishStatsDoc(const DynamicJsonDocument &doc) {
+  String res = "";
+  serializeJson(doc, res);
+  if (!client.publish(topicStats.c_str(), res.c_str())) {
+    Serial.printf("Stats not sent, %u bytes\n", res.length());
+  }
+}
+
+// One message per command, and one with the commands past the table
+void publishCommandStats(const char *pn532, const PN532Stats &stats) {
+  for (uint8_t i = 0; i < stats.count; i++) {
+    const PN532CommandStats &cmd = stats.commands[i];
+    DynamicJsonDocument doc(640);
+    doc["device_id"] = String(token);
+    doc["pn532"] = pn532;
+    doc["command"] = cmd.command;
+    doc["success"] = cmd.success;
+    doc["ack_timeout"] = cmd.ackTimeout;
+    doc["invalid_ack"] = cmd.invalidAck;
+    doc["timeout"] = cmd.timeout;
+    doc["no_target"] = cmd.noTarget;
+    doc["invalid_frame"] = cmd.invalidFrame;
+    doc["no_space"] = cmd.noSpace;
+    doc["max_us"] = cmd.maxMicros;
+    JsonArray histogram = doc.createNestedArray("histogram");
+    for (uint8_t b = 0; b < PN532_STATS_BUCKETS; b++) {
+      histogram.add(cmd.histogram[b]);
+    }
+    publishStatsDoc(doc);
+  }
+
+  DynamicJsonDocument doc(128);
+  doc["device_id"] = String(token);
+  doc["pn532"] = pn532;
+  doc["untracked"] = stats.untracked;
+  publishStatsDoc(doc);
+}
+
+void publishStats() {
+  static NfcStatsSnapshot nfcSnapshot;
+  if (nfcStats.pop(&nfcSnapshot)) {
+    publishCommandStats("reader", nfcSnapshot.Reader);
+    publishCommandStats("target", nfcSnapshot.Target);
+
+    for (uint8_t i = 0; i < nfcSnapshot.TaskCount; i++) {
+      const coTask &task = nfcSnapshot.Tasks[i];
+      DynamicJsonDocument doc(256);
+      doc["device_id"] = String(token);
+      doc["task"] = task.name;
+      doc["calls"] = task.calls;
+      doc["run_us"] = task.runMicros;
+      doc["max_us"] = task.maxMicros;
+      publishStatsDoc(doc);
+    }
+    Serial.println("Send PN532 Stats");
+  }
+
+  SensorStatsSnapshot sensorSnapshot;
+  if (sensorStats.pop(&sensorSnapshot)) {
+    DynamicJsonDocument doc(512);
+    doc["device_id"] = String(token);
+    doc["sensor_wakeups"] = sensorSnapshot.Wakeups;
+    doc["sensor_late_mean_us"] = sensorSnapshot.LateMeanMicros;
+    doc["sensor_late_max_us"] = sensorSnapshot.LateMaxMicros;
+    doc["replies_dropped"] = replies.dropped();
+    doc["items_dropped"] = items.dropped();
+    doc["buttons_dropped"] = buttons.dropped();
+    doc["button_bounces"] = cancelButton.bounces();
+    doc["adc_frames"] = sampler.frames();
+    doc["adc_frames_dropped"] = sampler.dropped();
+    doc["adc_overruns"] = sampler.overruns();
+    doc["ir_baseline"] = filter.irBaseline();
+    doc["metal_baseline"] = filter.metalBaseline();
+    doc["sensor_trace_dropped"] = sensorRecorder.dropped();
+    doc["trace_dropped"] = PN532Trace::dropped();
+    publishStatsDoc(doc);
+    publishIntakeStats(sensorSnapshot);
+  }
+}
+
 void callbackMQTT(char *topic, byte *payload, unsigned int length) {
   if (String(topic) == topicAction) {
     String strRes = "";
@@ -454,38 +1295,51 @@ void callbackMQTT(char *topic, byte *payload, unsigned int length) {
     }
     DynamicJsonDocument doc(256);
     deserializeJson(doc, strRes);
-    ActionResponse res;
-    res.Step = doc["step"];
-    res.Data.State = doc["data"]["state"];
-    res.Data.Link = doc["data"]["link"].as<String>();
+    BackendReply reply;
+    reply.Step = doc["step"];
+    reply.State = doc["data"]["state"];
+    strlcpy(reply.Link, doc["data"]["link"].as<String>().c_str(), sizeof(reply.Link));
     Serial.println(doc["data"]["link"].as<String>());
-    callbackAction(res);
+    if (!replies.push(reply)) {
+      Serial.println("Reply ring full, action dropped");
+    }
     Serial.println(strRes);
     Serial.println("-----------------------");
+  } else if (String(topic) == topicCalibrate) {
+    DynamicJsonDocument doc(96);
+    if (deserializeJson(doc, payload, length)) return;
+    // checked as an int, the enum may be unsigned and a missing command must not read as idle
+    int command = doc["command"] | -1;
+    CalibrationRequest request;
+    request.Command = (CalibrationCommand)command;
+    request.Rate = doc["rate"] | 0.0f;
+    request.DeadTime = doc["dead_time"] | 0;
+    if (command < CALIBRATE_IDLE || command > CALIBRATE_GATE_MODEL || !calibrations.push(request)) {
+      Serial.println("Calibration request dropped");
+    }
   }
 }
 
-void callbackAction(ActionResponse res) {
-  switch (res.Step) {
+void callbackAction(const BackendReply &reply) {
+  emulateTag.stop();
+  actionPending = true;
+  switch (reply.Step) {
     case STEP_CANCEL:
       current.Step = STEP_CANCEL;
       current.State = STATE_NONE;
       current.Identity = "";
-      current.IsSet = false;
       current.Link = "";
       current.PointSuccess = 0;
       current.PointFailed = 0;
       break;
     case STEP_AUTH:
-      welcomeDelay.stop();
       current.Step = STEP_AUTH;
-      current.State = res.Data.State;
-      current.IsSet = false;
+      current.State = reply.State;
       current.Link = "";
       current.PointSuccess = 0;
       current.PointFailed = 0;
-      if (res.Data.State == STATE_MUST_REGISTER) {
-        current.Link = res.Data.Link;
+      if (reply.State == STATE_MUST_REGISTER) {
+        current.Link = reply.Link;
       }
       break;
     default:
@@ -496,25 +1350,21 @@ void callbackAction(ActionResponse res) {
 void drawProgressBar() {
   displayCenteredText(loadingText, DEFAULT_TEXT_SIZE);
 
-  if (loadingDelay.justFinished()) {
-    loadingDelay.repeat();
-
-    const int numDots = 10;
-    const int dotSpacing = 12;
-    const int dotSize = 5;
-    int totalWidth = numDots * (dotSize + dotSpacing) - dotSpacing;
-    int startX = (240 - totalWidth) / 2;
-    for (int i = 0; i < numDots; ++i) {
-      int x = startX + i * (dotSize + dotSpacing);
-      int y = tft.height() - 20;
-      if (i == dotIndex) {
-        tft.fillCircle(x, y, dotSize, ST77XX_WHITE);
-      } else {
-        tft.fillCircle(x, y, dotSize, ST77XX_DARK_GRAY);
-      }
+  const int numDots = 10;
+  const int dotSpacing = 12;
+  const int dotSize = 5;
+  int totalWidth = numDots * (dotSize + dotSpacing) - dotSpacing;
+  int startX = (240 - totalWidth) / 2;
+  for (int i = 0; i < numDots; ++i) {
+    int x = startX + i * (dotSize + dotSpacing);
+    int y = tft.height() - 20;
+    if (i == dotIndex) {
+      tft.fillCircle(x, y, dotSize, ST77XX_WHITE);
+    } else {
+      tft.fillCircle(x, y, dotSize, ST77XX_DARK_GRAY);
     }
-    dotIndex = (dotIndex + 1) % numDots;
   }
+  dotIndex = (dotIndex + 1) % numDots;
 }
 
 void clearScreen() {
@@ -565,10 +1415,51 @@ void displayQRCode(String text) {
   }
 }
 
-String readRFIDAndNFC() {
+// Polls for a card once and reports a card other than the current one to the server
+bool cardTapped(uint16_t timeout) {
+  String tagId = readRFIDAndNFC(timeout);
+  if (tagId == "" || current.Identity == tagId) return false;
+  current.Identity = tagId;
+  sendTriggerCheckUser();
+  // animated until the server's answer brings the next screen
+  showScreen(UI_LOADING, "Checking card");
+  return true;
+}
+
+// True once the server has answered, cards tapped meanwhile are reported
+bool actionReceived() {
+  if (!actionPending) {
+    cardTapped(READER_POLL);
+  }
+  return actionPending;
+}
+
+// The registration screen is left on a new server answer or the cancel button
+bool sessionInterrupted() {
+  return actionPending || current.Step != STEP_AUTH;
+}
+
+bool tagWindowOver() {
+  if (sessionInterrupted()) return true;
+  emulateState state = emulateTag.step(REGISTER_TAG_POLL);
+  if (state == EMULATE_RUNNING) return false;
+  if (state == EMULATE_FINISHED) {
+    Serial.println("Registration link sent to phone");
+  }
+  return registerRoleDelay.justFinished();
+}
+
+bool readerWindowOver() {
+  if (sessionInterrupted()) return true;
+  cardTapped(REGISTER_READER_POLL);
+  return registerRoleDelay.justFinished();
+}
+
+String readRFIDAndNFC(uint16_t timeout) {
   uint8_t uid[] = {0, 0, 0, 0, 0, 0, 0};
   uint8_t uidLength;
-  bool success = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength);
+  PN532TargetInfo info;
+  bool success = nfc.readPassiveTargetID(PN532_MIFARE_ISO14443A, &uid[0], &uidLength, timeout, &info);
   if (success) {
     String tagId = "";
     for (uint8_t i = 0; i < uidLength; i++) {
@@ -580,6 +1471,8 @@ String readRFIDAndNFC() {
 
     Serial.print(uidLength, DEC);
     Serial.print(" bytes | ");
+    Serial.print(pn532_cardTypeName(info.type));
+    Serial.print(" | ");
     Serial.println(tagId);
     return tagId;
   }
@@ -0,0 +1,83 @@
+// button_bounce.cpp
+// Feeds scripted edges of a bouncing cancel button through the buttonInput
+// interrupt on the simulated clock and checks the presses and long presses
+// it reports: bounce inside the debounce window, a bounce that outlasts it, a
+// tap shorter than the window and a long press.
+//
+//   g++ -Itools/host -Ilib/buttonInput -o button_bounce tools/button_bounce.cpp lib/buttonInput/buttonInput.cpp
+//       tools/host/Arduino.cpp
+//   ./button_bounce
+
+#include <stdio.h>
+#include <Arduino.h>
+#include <buttonInput.h>
+
+#define PIN 4
+
+class buttonPin : public hostPins {
+  public:
+    buttonPin() : level(0) {}
+    int read(uint8_t pin) { return pin == PIN ? level : -1; }
+    uint8_t level;
+};
+
+struct edge {
+  uint32_t at;    // ms from the start of the case
+  uint8_t level;
+};
+
+struct bounceCase {
+  const char *name;
+  edge edges[8];
+  uint8_t count;
+  uint32_t presses;
+  uint32_t longPresses;
+};
+
+static uint32_t presses = 0;
+static uint32_t longPresses = 0;
+
+static void onButton(uint8_t event, uint32_t time, void *context) {
+  if (event == BUTTON_PRESS) presses++;
+  if (event == BUTTON_LONG_PRESS) longPresses++;
+}
+
+int main() {
+  const bounceCase cases[] = {
+    {"clean press", {{0, 1}, {300, 0}}, 2, 1, 0},
+    {"bounce inside the window", {{0, 1}, {2, 0}, {4, 1}, {300, 0}, {302, 1}, {304, 0}}, 6, 1, 0},
+    {"bounce outlasting the window", {{0, 1}, {35, 0}, {40, 1}, {500, 0}}, 4, 1, 0},
+    {"tap shorter than the window", {{0, 1}, {10, 0}, {1000, 1}, {1100, 0}}, 4, 2, 0},
+    {"long press", {{0, 1}, {BUTTON_LONG_PRESS_MS + 100, 0}}, 2, 1, 1},
+  };
+
+  buttonPin pin;
+  hostAttachPins(&pin);
+  buttonInput button(PIN);
+  button.begin(onButton);
+  delay(1000);
+
+  int failures = 0;
+  for (const bounceCase &c : cases) {
+    presses = 0;
+    longPresses = 0;
+    uint32_t start = millis();
+    for (uint8_t i = 0; i < c.count; i++) {
+      delay(start + c.edges[i].at - millis());
+      pin.level = c.edges[i].level;
+      hostInterrupt(PIN);
+    }
+    delay(1000);  // apart from the next case
+    bool ok = presses == c.presses && longPresses == c.longPresses && !button.isPressed();
+    printf("%-30s %u presses, %u long presses%s\n", c.name, presses, longPresses, ok ? "" : "  FAIL");
+    if (!ok) failures++;
+  }
+  printf("%u edges ignored as bounce\n", button.bounces());
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
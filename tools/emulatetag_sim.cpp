@@ -0,0 +1,204 @@
+// emulatetag_sim.cpp
+// Drives EmulateTag::step() with a scripted reader: a phone reading the NDEF
+// file over ISO7816-4 APDUs, one per TgGetData/TgSetData exchange. Checks every
+// response, that each step() handles exactly one APDU before returning, and
+// that the selected file survives between calls and is reset per session.
+//
+//   g++ -Itools/host -Ilib/PN532 -o emulatetag_sim tools/emulatetag_sim.cpp lib/PN532/emulatetag.cpp
+//       lib/PN532/ndef_provider.cpp lib/PN532/PN532.cpp lib/PN532/PN532_trace.cpp tools/host/Arduino.cpp
+//   ./emulatetag_sim
+
+#include <stdio.h>
+#include "emulatetag.h"
+#include "hostInterface.h"
+
+struct apduStep {
+  uint8_t command[16];
+  uint8_t commandLen;
+  uint16_t responseLen;  // expected response length including SW1 SW2
+  uint8_t sw1;
+  uint8_t sw2;
+};
+
+// reader side of a Type 4 tag read of a message of messageLen bytes, in 32 byte chunks
+static uint8_t buildScript(apduStep *script, uint16_t messageLen) {
+  uint8_t n = 0;
+  script[n++] = {{0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01, 0x00}, 13, 2, 0x90, 0x00};
+  script[n++] = {{0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03}, 7, 2, 0x90, 0x00};
+  script[n++] = {{0x00, 0xB0, 0x00, 0x00, 0x0F}, 5, 17, 0x90, 0x00};
+  script[n++] = {{0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04}, 7, 2, 0x90, 0x00};
+  script[n++] = {{0x00, 0xB0, 0x00, 0x00, 0x02}, 5, 4, 0x90, 0x00};
+  for (uint16_t offset = 2; offset < messageLen + 2; offset += 32) {
+    uint8_t chunk = messageLen + 2 - offset < 32 ? messageLen + 2 - offset : 32;
+    script[n++] = {{0x00, 0xB0, (uint8_t)(offset >> 8), (uint8_t)offset, chunk}, 5, (uint16_t)(chunk + 2), 0x90, 0x00};
+  }
+  // a write to a read only tag and an unknown instruction
+  script[n++] = {{0x00, 0xD6, 0x00, 0x00, 0x01, 0x00}, 6, 2, 0x6A, 0x81};
+  script[n++] = {{0x00, 0xCA, 0x00, 0x00, 0x00}, 5, 2, 0x6A, 0x81};
+  return n;
+}
+
+class scriptedReader : public hostInterface {
+  public:
+    scriptedReader() : script(0), count(0), next(0), present(true), failures(0), lastCommand(0) {}
+
+    int16_t respond(uint8_t command, const uint8_t *data, uint8_t len, uint8_t *out) {
+      lastCommand = command;
+      switch (command) {
+        case PN532_COMMAND_TGINITASTARGET:
+          if (!present) return PN532_TIMEOUT;
+          out[0] = 0x08;  // mode: ISO14443-4 PICC
+          out[1] = 0xE0;  // RATS
+          out[2] = 0x80;
+          return 3;
+        case PN532_COMMAND_TGGETDATA:
+          if (next >= count) {
+            out[0] = 0x29;  // released by the initiator
+            return 1;
+          }
+          out[0] = 0;
+          memcpy(out + 1, script[next].command, script[next].commandLen);
+          return 1 + script[next].commandLen;
+        case PN532_COMMAND_TGSETDATA:
+          check(data, len);
+          next++;
+          out[0] = 0;
+          return 1;
+        case PN532_COMMAND_INRELEASE:
+          out[0] = 0;
+          return 1;
+      }
+      out[0] = 0;
+      return 1;
+    }
+
+    void check(const uint8_t *response, uint8_t len) {
+      const apduStep &step = script[next];
+      if (len != step.responseLen || response[len - 2] != step.sw1 || response[len - 1] != step.sw2) {
+        printf("FAIL APDU %u INS %02X: %u bytes SW %02X%02X, expected %u bytes SW %02X%02X\n", next,
+               step.command[1], len, response[len - 2], response[len - 1], step.responseLen, step.sw1, step.sw2);
+        failures++;
+        return;
+      }
+      // READ_BINARY of the NDEF file: collect what the phone would see
+      if (step.command[1] == 0xB0 && fileSelected == 0x04) {
+        uint16_t offset = (step.command[2] << 8) | step.command[3];
+        memcpy(file + offset, response, len - 2);
+      }
+      if (step.command[1] == 0xA4 && step.command[2] == 0x00) {
+        fileSelected = step.command[6];
+      }
+    }
+
+    void load(const apduStep *script, uint8_t count) {
+      this->script = script;
+      this->count = count;
+      next = 0;
+      fileSelected = 0;
+      memset(file, 0, sizeof(file));
+    }
+
+    const apduStep *script;
+    uint8_t count;
+    uint8_t next;
+    bool present;
+    int failures;
+    uint8_t lastCommand;
+    uint8_t fileSelected;
+    uint8_t file[512];
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failures++;
+  }
+}
+
+// one reader session through step(), returns the number of step() calls
+static uint16_t session(EmulateTag &tag, scriptedReader &reader, const uint8_t *message, uint16_t messageLen) {
+  apduStep script[40];
+  reader.load(script, buildScript(script, messageLen));
+
+  uint16_t steps = 0;
+  emulateState state;
+  do {
+    uint32_t before = reader.commands;
+    state = tag.step();
+    steps++;
+
+    uint32_t exchanges = reader.commands - before;
+    if (state == EMULATE_RUNNING && steps > 1 && exchanges != 2) {
+      printf("FAIL step %u issued %u commands, expected TgGetData + TgSetData\n", steps, exchanges);
+      failures++;
+    }
+  } while (state == EMULATE_RUNNING && steps < 100);
+
+  check(state == EMULATE_FINISHED, "session ends when the reader leaves");
+  check(!tag.isActive(), "session closed");
+  check(reader.lastCommand == PN532_COMMAND_INRELEASE, "target released");
+  check(reader.next == reader.count, "every APDU answered");
+
+  uint16_t fileLength = (reader.file[0] << 8) | reader.file[1];
+  check(fileLength == messageLen, "NDEF length read back");
+  check(memcmp(reader.file + 2, message, messageLen) == 0, "NDEF message read back");
+  return steps;
+}
+
+int main() {
+  scriptedReader reader;
+  EmulateTag tag(reader);
+  tag.init();
+
+  // no reader in the field
+  reader.present = false;
+  check(tag.step() == EMULATE_WAITING, "waiting without a reader");
+  reader.present = true;
+
+  // a caller owned message larger than one TgSetData frame
+  uint8_t message[200];
+  for (uint16_t i = 0; i < sizeof(message); i++) message[i] = i * 7;
+  tag.setNdefMessage(message, sizeof(message));
+  uint16_t steps = session(tag, reader, message, sizeof(message));
+  printf("static message: %u bytes in %u step() calls, %u PN532 commands\n", (unsigned)sizeof(message), steps,
+         reader.commands);
+
+  // generated URI, the state of the first session must not leak into the second
+  NdefUriProvider uri;
+  uri.setUri(NDEF_URIPREFIX_HTTPS, "revend.example/register?token=", "0123456789abcdef");
+  tag.setNdefProvider(&uri);
+  uint8_t generated[128];
+  uint16_t generatedLen = uri.length();
+  uri.read(0, generated, generatedLen);
+  reader.commands = 0;
+  steps = session(tag, reader, generated, generatedLen);
+  printf("generated URI: %u bytes in %u step() calls, %u PN532 commands\n", generatedLen, steps, reader.commands);
+
+  // the stats of the emulation's own PN532: the wait without a reader is no
+  // target, not a timeout, and every exchange succeeded
+  PN532Stats stats;
+  tag.getStats(&stats);
+  uint32_t noTarget = 0, timeouts = 0, exchanges = 0;
+  for (uint8_t i = 0; i < stats.count; i++) {
+    const PN532CommandStats &cmd = stats.commands[i];
+    timeouts += cmd.timeout;
+    if (cmd.command == PN532_COMMAND_TGINITASTARGET) noTarget += cmd.noTarget;
+    if (cmd.command == PN532_COMMAND_TGGETDATA) exchanges += cmd.success;
+  }
+  printf("stats: %u commands tracked, %u no target, %u timeouts, %u TgGetData\n", stats.count, noTarget, timeouts,
+         exchanges);
+  check(noTarget == 1, "the wait without a reader counted as no target");
+  check(timeouts == 0, "no timeouts");
+  check(exchanges > 0, "TgGetData counted");
+  check(stats.untracked == 0, "no untracked commands");
+
+  failures += reader.failures;
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
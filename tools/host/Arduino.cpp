@@ -0,0 +1,75 @@
+// Arduino.cpp
+// minimal host stand-in for the Arduino core, lets the libs build into the tools/ programs
+
+#include "Arduino.h"
+#include "SPI.h"
+
+HostSerial Serial;
+SPIClass SPI;
+
+static uint64_t nanos = 0;
+static hostPins *device = 0;
+static uint8_t pins[64];
+
+unsigned long millis() {
+  return (unsigned long)(nanos / 1000000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(nanos / 1000);
+}
+
+void delay(unsigned long ms) {
+  nanos += (uint64_t)ms * 1000000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  nanos += (uint64_t)us * 1000;
+}
+
+void yield() {
+}
+
+void hostAdvance(uint64_t ns) {
+  nanos += ns;
+}
+
+uint64_t hostNanos() {
+  return nanos;
+}
+
+void hostAttachPins(hostPins *pins) {
+  device = pins;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+  pins[pin & 63] = level;
+  if (device) {
+    device->write(pin, level);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  int level = device ? device->read(pin) : -1;
+  if (level >= 0) return level;
+  return pins[pin & 63];
+}
+
+static void (*isrs[64])(void *);
+static void *isrArgs[64];
+
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode) {
+  isrs[pin & 63] = isr;
+  isrArgs[pin & 63] = arg;
+}
+
+void detachInterrupt(uint8_t pin) {
+  isrs[pin & 63] = 0;
+}
+
+void hostInterrupt(uint8_t pin) {
+  if (isrs[pin & 63]) isrs[pin & 63](isrArgs[pin & 63]);
+}
@@ -0,0 +1,81 @@
+// Arduino.h
+// minimal host stand-in for the Arduino core, lets the libs build into the tools/ programs
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HIGH 1
+#define LOW  0
+#define INPUT        0
+#define OUTPUT       1
+#define INPUT_PULLUP 2
+#define RISING  1
+#define FALLING 2
+#define CHANGE  3
+#define DEC 10
+#define HEX 16
+#define F(x) x
+#define IRAM_ATTR
+
+typedef uint8_t byte;
+
+/**************
+  Time is simulated, it only moves when delay() is called or the program
+  advances it with hostAdvance(), so runs are repeatable and a mocked bus can
+  charge its transfer time. Benchmarks of host CPU time use std::chrono.
+****************************************************************************************/
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// advance the simulated clock
+void hostAdvance(uint64_t ns);
+uint64_t hostNanos();
+
+// a mocked device on the GPIOs, sees every digitalWrite() and can drive
+// digitalRead(), e.g. to watch its select line and raise an IRQ line
+class hostPins {
+  public:
+    virtual void write(uint8_t pin, uint8_t level) {}
+    // level of the pin, or -1 when not driven by this device
+    virtual int read(uint8_t pin) { return -1; }
+};
+void hostAttachPins(hostPins *pins);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t level);
+int digitalRead(uint8_t pin);
+
+void attachInterruptArg(uint8_t pin, void (*isr)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+// run the interrupt attached to the pin, if any, as an edge would
+void hostInterrupt(uint8_t pin);
+
+class HostSerial {
+  public:
+    void begin(unsigned long) {}
+    size_t print(const char *s) { return fputs(s, stdout), strlen(s); }
+    size_t print(char c) { return putchar(c), 1; }
+    size_t print(unsigned long n, int base = DEC) { return printf(base == HEX ? "%lX" : "%lu", n); }
+    size_t print(long n, int base = DEC) { return base == HEX ? print((unsigned long)n, HEX) : printf("%ld", n); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+    template<typename T> size_t println(T value) { size_t n = print(value); return n + print('\n'); }
+    template<typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + print('\n'); }
+    size_t println() { return print('\n'); }
+    template<typename... A> size_t printf(const char *format, A... args) { return ::printf(format, args...); }
+};
+
+extern HostSerial Serial;
+
+#endif
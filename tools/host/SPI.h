@@ -0,0 +1,56 @@
+// SPI.h
+// host stand-in for the Arduino SPI class, transfers go to a mocked device and cost simulated bus time
+
+#ifndef HOST_SPI_H
+#define HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0
+#define SPI_MODE3 3
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t clock = 1000000, uint8_t bitOrder = MSBFIRST, uint8_t mode = SPI_MODE0)
+      : clock(clock), bitOrder(bitOrder), mode(mode) {}
+    uint32_t clock;
+    uint8_t bitOrder;
+    uint8_t mode;
+};
+
+// the other end of the bus, sees the bytes as they are on the wire
+class hostSPIDevice {
+  public:
+    virtual uint8_t transfer(uint8_t data) = 0;
+};
+
+class SPIClass {
+  public:
+    SPIClass() : device(0), clock(1000000), inTransaction(false), transactions(0), bytes(0) {}
+    void begin() {}
+    void beginTransaction(SPISettings settings) {
+      clock = settings.clock;
+      inTransaction = true;
+      transactions++;
+    }
+    void endTransaction() { inTransaction = false; }
+    uint8_t transfer(uint8_t data) {
+      bytes++;
+      hostAdvance(8000000000ULL / clock);
+      return device ? device->transfer(data) : 0xFF;
+    }
+
+    void setDevice(hostSPIDevice *device) { this->device = device; }
+
+    hostSPIDevice *device;
+    uint32_t clock;
+    bool inTransaction;
+    uint32_t transactions;
+    uint32_t bytes;
+};
+
+extern SPIClass SPI;
+
+#endif
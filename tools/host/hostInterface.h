@@ -0,0 +1,61 @@
+// hostInterface.h
+// PN532Interface mocked at the command level for the tools/ programs
+
+#ifndef HOST_INTERFACE_H
+#define HOST_INTERFACE_H
+
+#include <Arduino.h>
+#include "PN532Interface.h"
+
+/**************
+  **hostInterface** stands in for the PN532 and its transport.
+
+  Each writeCommand() is handed to respond(), and its answer is what the next
+  readResponse() returns, without the D5 / command + 1 prefix, like a real
+  transport. respond() can also return a PN532_* error. Every exchange costs
+  simulated time: frameTime per frame plus byteTime per byte of both frames,
+  so a peer model can compare how many round trips a protocol needs.
+****************************************************************************************/
+class hostInterface : public PN532Interface {
+  public:
+    hostInterface() : frameTime(0), byteTime(0), commands(0), answerLen(0) {}
+
+    void begin() {}
+    void wakeup() {}
+
+    int8_t writeCommand(const uint8_t *header, uint8_t hlen, const uint8_t *body = 0, uint8_t blen = 0) {
+      uint8_t frame[300];
+      memcpy(frame, header, hlen);
+      if (blen) memcpy(frame + hlen, body, blen);
+      commands++;
+      answerLen = respond(frame[0], frame + 1, hlen + blen - 1, answer);
+      hostAdvance(frameTime + (uint64_t)byteTime * (hlen + blen + (answerLen > 0 ? answerLen : 0)));
+      return 0;
+    }
+
+    int16_t readResponse(uint8_t buf[], uint8_t len, uint16_t timeout = 1000) {
+      if (answerLen < 0) return answerLen;
+      if (answerLen > len) return PN532_NO_SPACE;
+      memcpy(buf, answer, answerLen);
+      return answerLen;
+    }
+
+    /**
+      The PN532 side of one command
+      @param command command code
+      @param data parameters after the command code
+      @param out answer data, up to 255 bytes
+      @return length of the answer or a PN532_* error
+    */
+    virtual int16_t respond(uint8_t command, const uint8_t *data, uint8_t len, uint8_t *out) = 0;
+
+    uint32_t frameTime;  // ns per exchange, host link and RF turnaround
+    uint32_t byteTime;   // ns per byte moved
+    uint32_t commands;
+
+  private:
+    uint8_t answer[255];
+    int16_t answerLen;
+};
+
+#endif
@@ -0,0 +1,452 @@
+// intake_sim.cpp
+// Runs a simulated user feeding cans and bottles through the intake of
+// readSensor() in main.cpp, with its gate, on a millisecond clock, and
+// measures items per minute the way the stats report them.
+//
+// The sensor task is mirrored at its 5 ms period: it takes the frames of the
+// last period, then runs the gate step and hold timers. The user inserts the
+// next item a fixed time after the chute cleared, a can drops once the
+// modelled gate is half open and a rejected item is taken back after a
+// reading pause. An item that drops before it is accepted is counted as
+// fallen through, and the intake must count it the same. The fastest user
+// inserts before the gate has closed behind the last can, so items fall
+// through whatever drives the gate, that row is not checked for a clean run.
+//
+// Then the same users are run with the gate driven as before servoMotion, a
+// jump and a fixed 400 ms hold, and with other profiles. The servoMotion
+// defaults are checked to keep at least 95% of the jump's items per minute,
+// with no more items falling through, at every pace.
+//
+//   g++ -O2 -Ilib/sensorFilter -Ilib/itemClassifier -Ilib/sensorSampler -Ilib/servoMotion -Ilib/eventRing
+//       -o intake_sim tools/intake_sim.cpp lib/sensorFilter/sensorFilter.cpp
+//       lib/itemClassifier/itemClassifier.cpp lib/servoMotion/servoMotion.cpp
+//   ./intake_sim
+
+#include <stdio.h>
+#include <string.h>
+#include "sensorFilter.h"
+#include "itemClassifier.h"
+#include "sensorSampler.h"
+#include "servoMotion.h"
+
+// keep in line with main.cpp
+#define CLASSIFY_FRAMES 30
+#define PARTIAL_WINDOWS 4
+#define SENSOR_TASK_PERIOD 5
+#define GATE_OPEN_ANGLE 0
+#define GATE_CLOSED_ANGLE 180
+#define SERVO_STEP 20
+#define SERVO_HOLD_DELAY 250
+#define SERVO_CLEAR_DELAY 150
+#define GATE_HOLD_ANGLE 90
+
+// the simulated chute and user
+#define INSERT_MS 20       // from touching the beam to fully in
+#define LEAVE_MS 8         // from starting to drop or being pulled to clear of the beam
+#define DROP_ANGLE GATE_HOLD_ANGLE  // an item over the gate drops once it is open this far
+#define TAKE_BACK_MS 600   // a rejected item is taken back this long after the decision
+#define SETTLE_FRAMES 5000 // filtered before sensing starts, as between sessions
+#define ITEMS 60
+
+// as IntakeStats in main.cpp
+struct intakeStats {
+  uint32_t Items;
+  uint32_t SensingMillis;
+  uint32_t DecideFramesSum;
+  uint32_t DecideFramesMax;
+  uint32_t ClearMillisSum;
+  uint32_t Cleared;
+  uint32_t FellThrough;
+};
+
+static void noWrite(uint16_t) {}
+
+// how the gate is driven
+struct gateConfig {
+  const char *name;
+  uint8_t profile;
+  float speed;        // commanded profile, see servoMotion::setSpeed()
+  float accel;
+  bool fixedHold;     // before servoMotion: one jump, closed a fixed time after the open command
+  bool waitForClose;  // decide only once the modelled gate holds the item
+};
+
+#define GATE_JUMP_SPEED 100000  // and an acceleration 100 times it, the whole move in one step
+#define SERVO_WAITING_DELAY 400 // the fixed hold before servoMotion
+
+/**************
+  readSensor(), openServo(), closeServo(), stepGate() and chuteCleared() of
+  main.cpp on the simulated clock. The timers of sensorTimers are kept as
+  deadlines and run after the frames of each wake, as sensorTask() does.
+****************************************************************************************/
+class intake {
+  public:
+    intake(const gateConfig &config)
+      : config(config), gate(noWrite, GATE_CLOSED_ANGLE), stage(DECIDED), appeared(0), partials(0), decided(false),
+               decidedAt(0), gateOpen(false), gateOpenedAt(0), nextStep(SERVO_STEP), closeAt(0) {
+      memset(&stats, 0, sizeof(stats));
+      gate.setProfile(config.profile);
+      gate.setSpeed(config.speed, config.accel);
+      gate.begin();
+    }
+
+    // frames are always filtered, sensing only decides what is done with them
+    bool frame(const sensorFrame &frame, uint32_t now, bool sensing, itemClass *out) {
+      filter.update(frame.ir, frame.metal);
+      if (!sensing) return false;
+      bool present = filter.objectPresent();
+
+      switch (stage) {
+        case EMPTY:
+          if (!present) return false;
+          stage = CLASSIFYING;
+          appeared = frame.index;
+          partials = 0;
+          features.reset();
+          if (gateOpen) {
+            closeAt = 0;
+            closeServo();
+          }
+          break;
+        case CLASSIFYING:
+          if (present) break;
+          stage = EMPTY;
+          if (gateOpen || gate.isMoving()) stats.FellThrough++;
+          return false;
+        case DECIDED:
+          if (present) return false;
+          stage = EMPTY;
+          if (decided) chuteCleared(now);
+          return false;
+      }
+
+      features.add(filter);
+      if (features.frames() < CLASSIFY_FRAMES) return false;
+      if (config.waitForClose && !gateOpen && gate.position() < GATE_HOLD_ANGLE) return false;
+
+      itemClass result = classifier.classify(features.features());
+      features.reset();
+      if (result.material == MATERIAL_PARTIAL && ++partials >= PARTIAL_WINDOWS) {
+        result.material = MATERIAL_OTHER;
+      }
+      if (result.material == MATERIAL_PARTIAL) return false;
+
+      stage = DECIDED;
+      decided = true;
+      decidedAt = now;
+      uint32_t decideFrames = frame.index - appeared;
+      stats.Items++;
+      stats.DecideFramesSum += decideFrames;
+      if (decideFrames > stats.DecideFramesMax) stats.DecideFramesMax = decideFrames;
+      if (result.material == MATERIAL_CAN) openServo(now);
+      *out = result;
+      return true;
+    }
+
+    // sensorTimers.run() at the end of a wake
+    void timers(uint32_t now) {
+      while (now >= nextStep) {
+        stepGate(now);
+        nextStep += SERVO_STEP;
+      }
+      if (closeAt && now >= closeAt) {
+        closeAt = 0;
+        closeServo();
+      }
+    }
+
+    gateConfig config;
+    servoMotion gate;
+    intakeStats stats;
+
+  private:
+    void openServo(uint32_t now) {
+      gate.moveTo(GATE_OPEN_ANGLE);
+      gateOpen = true;
+      if (config.fixedHold) {
+        gateOpenedAt = now;
+        closeAt = now + SERVO_WAITING_DELAY;
+      }
+    }
+
+    void closeServo() {
+      gate.moveTo(GATE_CLOSED_ANGLE);
+      gateOpen = false;
+    }
+
+    void stepGate(uint32_t now) {
+      bool opening = gate.isMoving() && gate.target() == GATE_OPEN_ANGLE;
+      gate.update(now);
+      if (!config.fixedHold && opening && gate.isAt(GATE_OPEN_ANGLE)) {
+        gateOpenedAt = now;
+        if (!closeAt) closeAt = now + SERVO_HOLD_DELAY;
+      }
+    }
+
+    void chuteCleared(uint32_t now) {
+      stats.ClearMillisSum += now - decidedAt;
+      stats.Cleared++;
+      if (!gateOpen) return;
+      if (config.fixedHold) {
+        if (now - gateOpenedAt + SERVO_CLEAR_DELAY < SERVO_WAITING_DELAY) closeAt = now + SERVO_CLEAR_DELAY;
+        return;
+      }
+      if (!gate.isAt(GATE_OPEN_ANGLE) || now - gateOpenedAt + SERVO_CLEAR_DELAY < SERVO_HOLD_DELAY) {
+        closeAt = now + SERVO_CLEAR_DELAY;
+      }
+    }
+
+    enum { EMPTY, CLASSIFYING, DECIDED } stage;
+    sensorFilter filter;
+    itemFeatureExtractor features;
+    treeClassifier classifier;
+    uint32_t appeared;
+    uint8_t partials;
+    bool decided;
+    uint32_t decidedAt;
+    bool gateOpen;
+    uint32_t gateOpenedAt;
+    uint32_t nextStep;
+    uint32_t closeAt;  // the servoTimer one-shot, 0 while stopped
+};
+
+#define SEED 12345
+static uint32_t seed = SEED;
+
+static int32_t uniform(int32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (int32_t)((seed >> 8) % (2 * range + 1)) - range;
+}
+
+// roughly normal, sd about sigma
+static int32_t noise(int32_t sigma) {
+  return (uniform(sigma) + uniform(sigma) + uniform(sigma) + uniform(sigma)) / 2;
+}
+
+static uint16_t clamp12(int32_t v) {
+  return v < 0 ? 0 : (v > 4095 ? 4095 : v);
+}
+
+/**************
+  One item at a time in front of the sensors. Levels with the idle IR at
+  2000 and metal at 900, a can at 350 / 150 and a bottle at 450 / 900, as in
+  sensor_replay.cpp.
+****************************************************************************************/
+class chute {
+  public:
+    enum chuteState { WAITING, INSERTING, IN, LEAVING };
+
+    chute(uint32_t nextItemMs)
+      : nextItemMs(nextItemMs), state(WAITING), isCan(false), willDrop(false), since(0), takeBackAt(0), inserted(0),
+        wrong(0), fellThrough(0) {}
+
+    sensorFrame frame(uint32_t index) {
+      int32_t scale = 0;
+      if (state == INSERTING) scale = (index - since) * 256 / INSERT_MS;
+      if (state == IN) scale = 256;
+      if (state == LEAVING) scale = 256 - (int32_t)(index - since) * 256 / LEAVE_MS;
+      int32_t ir = 2000 - (2000 - (isCan ? 350 : 450)) * scale / 256;
+      int32_t metal = 900 - (isCan ? 900 - 150 : 0) * scale / 256;
+      sensorFrame frame = {index, clamp12(ir + noise(30)), clamp12(metal + noise(15))};
+      return frame;
+    }
+
+    // the intake decided on the item in the chute
+    void decide(const itemClass &result, uint32_t now) {
+      if (state != IN && state != INSERTING) {
+        wrong++;  // nothing there to decide on
+        return;
+      }
+      bool acceptedNow = result.material == MATERIAL_CAN;
+      if (acceptedNow != isCan) wrong++;
+      if (acceptedNow) {
+        willDrop = true;
+      } else {
+        takeBackAt = now + TAKE_BACK_MS;
+      }
+    }
+
+    // one ms of the user and the item, the horn position is the modelled one
+    void step(uint32_t now, float gateAngle) {
+      switch (state) {
+        case WAITING:
+          if (now - since < nextItemMs || inserted == ITEMS) return;
+          isCan = uniform(2) != 0;  // two in three are cans
+          willDrop = false;
+          takeBackAt = 0;
+          inserted++;
+          enter(INSERTING, now);
+          return;
+        case INSERTING:
+          if (now - since >= INSERT_MS) enter(IN, now);
+          return;
+        case IN:
+          if (gateAngle < DROP_ANGLE) {
+            if (!willDrop) fellThrough++;
+            enter(LEAVING, now);
+          } else if (takeBackAt && now >= takeBackAt) {
+            enter(LEAVING, now);
+          }
+          return;
+        case LEAVING:
+          if (now - since >= LEAVE_MS) enter(WAITING, now);
+          return;
+      }
+    }
+
+    bool done() const {
+      return inserted == ITEMS && state == WAITING;
+    }
+
+    uint32_t nextItemMs;
+    chuteState state;
+    bool isCan;
+    bool willDrop;
+    uint32_t since;
+    uint32_t takeBackAt;
+    uint32_t inserted;
+    uint32_t wrong;        // decided the wrong way, or with nothing in the chute
+    uint32_t fellThrough;  // dropped through the gate before it was accepted
+
+  private:
+    void enter(chuteState next, uint32_t now) {
+      state = next;
+      since = now;
+    }
+};
+
+struct runResult {
+  intakeStats stats;
+  intakeStats halfway;  // a snapshot while the session is open
+  uint32_t halfwayMillis;
+  uint32_t wrong;
+  uint32_t fellThrough;
+  uint32_t counted;     // fell through according to the intake
+  uint32_t gateTravel;
+  bool finished;
+};
+
+static runResult run(uint32_t nextItemMs, const gateConfig &config) {
+  seed = SEED;  // the same items and noise for every gate
+  intake in(config);
+  chute user(nextItemMs);
+  runResult r;
+  memset(&r, 0, sizeof(r));
+
+  sensorFrame pending[SENSOR_TASK_PERIOD];
+  uint8_t count = 0;
+  uint32_t sensingSince = SETTLE_FRAMES;
+  bool tookHalfway = false;
+  uint32_t now;
+  for (now = 0; now < 20 * 60 * 1000; now++) {
+    bool sensing = now >= sensingSince;
+    if (sensing) user.step(now, in.gate.position());
+    pending[count++] = user.frame(now);
+    if (count < SENSOR_TASK_PERIOD) continue;
+
+    // a wake of the sensor task
+    for (uint8_t i = 0; i < count; i++) {
+      itemClass result;
+      if (in.frame(pending[i], now, sensing, &result)) user.decide(result, now);
+    }
+    count = 0;
+    in.timers(now);
+
+    if (!tookHalfway && user.inserted > ITEMS / 2) {
+      tookHalfway = true;
+      r.halfway = in.stats;
+      r.halfwayMillis = now - sensingSince;
+    }
+    if (user.done() && !in.gate.isMoving()) break;
+  }
+  r.stats = in.stats;
+  r.stats.SensingMillis = now - sensingSince;
+  r.wrong = user.wrong;
+  r.fellThrough = user.fellThrough;
+  r.counted = in.stats.FellThrough;
+  r.gateTravel = in.gate.lastTravel();
+  r.finished = user.done();
+  return r;
+}
+
+// publishIntakeStats() in main.cpp
+static double perMinute(const intakeStats &stats) {
+  return stats.SensingMillis > 0 ? stats.Items * 60000.0 / stats.SensingMillis : 0;
+}
+
+static int failures = 0;
+
+int main() {
+  const gateConfig defaults = {"defaults", SERVO_PROFILE_TRAPEZOID, SERVO_MOTION_SPEED, SERVO_MOTION_ACCEL, false,
+                                true};
+  const uint32_t gaps[] = {1000, 500, 200};
+  const uint32_t checkedGap = 500;  // and slower
+  printf("%u items, two in three cans, %u ms reading pause before a rejected item is taken back\n", ITEMS,
+         TAKE_BACK_MS);
+  printf("%14s %8s %12s %16s %14s %14s %6s %12s\n", "next item ms", "decided", "items/min", "decide mean/max",
+         "clear mean ms", "gate travel ms", "wrong", "fell through");
+  for (uint32_t gap : gaps) {
+    runResult r = run(gap, defaults);
+    const intakeStats &s = r.stats;
+    printf("%14u %8u %12.1f %10.0f / %-4u %14.0f %14u %6u %12u\n", gap, s.Items, perMinute(s),
+           s.Items ? (double)s.DecideFramesSum / s.Items : 0, s.DecideFramesMax,
+           s.Cleared ? (double)s.ClearMillisSum / s.Cleared : 0, r.gateTravel, r.wrong, r.fellThrough);
+
+    // the stats are taken with the session open, its time so far must count
+    intakeStats open = r.halfway;
+    intakeStats closedOnly = r.halfway;
+    open.SensingMillis = r.halfwayMillis;
+    closedOnly.SensingMillis = 0;
+    printf("%14s halfway snapshot: %u items, %.1f items/min with the open session, %.1f without\n", "",
+           open.Items, perMinute(open), perMinute(closedOnly));
+
+    if (gap >= checkedGap && (!r.finished || s.Items != ITEMS || r.wrong || r.fellThrough)) {
+      printf("FAIL next item after %u ms\n", gap);
+      failures++;
+    }
+    if (r.counted != r.fellThrough) {
+      printf("FAIL next item after %u ms: %u fell through, the intake counted %u\n", gap, r.fellThrough, r.counted);
+      failures++;
+    }
+  }
+
+  // the gate alone: the same user with the gate driven as before servoMotion, with the previous profile
+  // defaults, with the S-curve, and without waiting for the close
+  const gateConfig configs[] = {
+    {"jump, 400 ms hold", SERVO_PROFILE_TRAPEZOID, GATE_JUMP_SPEED, GATE_JUMP_SPEED * 100.0f, true, false},
+    {"trapezoid 400/5000", SERVO_PROFILE_TRAPEZOID, 400, 5000, false, true},
+    {"S-curve", SERVO_PROFILE_SCURVE, SERVO_MOTION_SPEED, SERVO_MOTION_ACCEL, false, true},
+    {"defaults, not waiting", SERVO_PROFILE_TRAPEZOID, SERVO_MOTION_SPEED, SERVO_MOTION_ACCEL, false, false},
+    defaults,
+  };
+  printf("\n%14s %-24s %12s %16s %14s %12s\n", "next item ms", "gate", "items/min", "decide mean/max",
+         "gate travel ms", "fell through");
+  for (uint32_t gap : gaps) {
+    runResult jump = {};
+    runResult now = {};
+    for (const gateConfig &config : configs) {
+      runResult r = run(gap, config);
+      const intakeStats &s = r.stats;
+      printf("%14u %-24s %12.1f %10.0f / %-4u %14u %12u\n", gap, config.name, perMinute(s),
+             s.Items ? (double)s.DecideFramesSum / s.Items : 0, s.DecideFramesMax, r.gateTravel, r.fellThrough);
+      if (config.fixedHold) jump = r;
+      if (config.name == defaults.name) now = r;
+    }
+    // the profile may cost a little time over the jump, not a slower cycle or items lost
+    if (perMinute(now.stats) < 0.95 * perMinute(jump.stats)) {
+      printf("FAIL the defaults take %.1f items/min, the jump %.1f\n", perMinute(now.stats), perMinute(jump.stats));
+      failures++;
+    }
+    if (now.fellThrough > jump.fellThrough) {
+      printf("FAIL with the defaults %u items fell through, with the jump %u\n", now.fellThrough, jump.fellThrough);
+      failures++;
+    }
+  }
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,217 @@
+// llcp_bench.cpp
+// Measures LLCP throughput between the kiosk (PN532 as target) and a
+// scripted phone (initiator) in both directions. The phone follows the
+// negotiated receive window and acknowledges each I PDU it gets at once.
+// Every PN532 command costs simulated time, see PN532_COMMAND_NS and
+// PN532_BYTE_NS, so bytes/s follow from how many exchanges a transfer needs.
+//
+//   g++ -Itools/host -Ilib/PN532 -o llcp_bench tools/llcp_bench.cpp lib/PN532/llcp.cpp lib/PN532/mac_link.cpp
+//       lib/PN532/PN532.cpp lib/PN532/PN532_trace.cpp tools/host/Arduino.cpp
+//   ./llcp_bench
+//
+// To compare with another version of llcp.h/llcp.cpp, e.g. from before the
+// receive window, put both files in a directory and add -I<dir> before
+// -Ilib/PN532 and <dir>/llcp.cpp instead of lib/PN532/llcp.cpp.
+
+#include <stdio.h>
+#include "llcp.h"
+#include "hostInterface.h"
+
+// HSU at 115200 plus 424 kbit/s RF per byte, and PN532 plus phone turnaround per command
+#define PN532_COMMAND_NS 2000000
+#define PN532_BYTE_NS    106000
+
+#define PDU_SYMM    0x00
+#define PDU_CONNECT 0x04
+#define PDU_DISC    0x05
+#define PDU_CC      0x06
+#define PDU_DM      0x07
+#define PDU_I       0x0c
+#define PDU_RR      0x0d
+
+#define PEER_SAP  0x20
+#define KIOSK_SAP 0x04
+
+#define PEER_MIU  250  // MIUX 122
+#define PEER_RW   4
+
+class scriptedPhone : public hostInterface {
+  public:
+    scriptedPhone(bool sending, uint16_t total, uint8_t fragment)
+      : sending(sending), total(total), fragment(fragment), sent(0), received(0), ns(0), nr(0), va(0),
+        kioskRW(1), connected(false), connectSent(false), discSent(false), done(false), needAck(false),
+        errors(0) {
+      frameTime = PN532_COMMAND_NS;
+      byteTime = PN532_BYTE_NS;
+    }
+
+    int16_t respond(uint8_t command, const uint8_t *data, uint8_t len, uint8_t *out) {
+      switch (command) {
+        case PN532_COMMAND_TGINITASTARGET:
+          out[0] = 0x04;  // mode: DEP
+          return 1;
+        case PN532_COMMAND_TGGETDATA:
+          if (done) {
+            out[0] = 0x29;  // released by the initiator
+            return 1;
+          }
+          out[0] = 0;
+          return 1 + nextPDU(out + 1);
+        case PN532_COMMAND_TGSETDATA:
+          onAnswer(data, len);
+          out[0] = 0;
+          return 1;
+      }
+      out[0] = 0;
+      return 1;
+    }
+
+    bool sending;       // the phone sends, the kiosk reads
+    uint16_t total;
+    uint8_t fragment;
+    uint16_t sent;
+    uint16_t received;
+    uint8_t ns;
+    uint8_t nr;
+    uint8_t va;
+    uint8_t kioskRW;
+    bool connected;
+    bool connectSent;
+    bool discSent;
+    bool done;
+    bool needAck;
+    uint32_t errors;
+
+  private:
+    uint8_t header(uint8_t *pdu, uint8_t type) {
+      pdu[0] = (KIOSK_SAP << 2) + (type >> 2);
+      pdu[1] = ((type & 0x3) << 6) + PEER_SAP;
+      return 2;
+    }
+
+    uint8_t nextPDU(uint8_t *pdu) {
+      if (!connectSent) {
+        connectSent = true;
+        uint8_t n = header(pdu, PDU_CONNECT);
+        const uint8_t params[] = {0x02, 2, 0, PEER_MIU - 128, 0x05, 1, PEER_RW};
+        memcpy(pdu + n, params, sizeof(params));
+        return n + sizeof(params);
+      }
+      if (!connected) {
+        return header(pdu, PDU_SYMM);
+      }
+      if (sending && sent < total && ((ns - va) & 0x0F) < kioskRW) {
+        uint8_t n = header(pdu, PDU_I);
+        pdu[n++] = (ns << 4) + nr;
+        uint8_t chunk = total - sent < fragment ? total - sent : fragment;
+        for (uint8_t i = 0; i < chunk; i++) pdu[n++] = sent + i;
+        sent += chunk;
+        ns = (ns + 1) & 0x0F;
+        needAck = false;
+        return n;
+      }
+      if (needAck) {
+        needAck = false;
+        uint8_t n = header(pdu, PDU_RR);
+        pdu[n++] = nr;
+        return n;
+      }
+      bool finished = sending ? sent == total && va == ns : received == total;
+      if (finished && !discSent) {
+        discSent = true;
+        return header(pdu, PDU_DISC);
+      }
+      return header(pdu, PDU_SYMM);
+    }
+
+    void onAnswer(const uint8_t *pdu, uint8_t len) {
+      if (len < 2) {
+        errors++;
+        return;
+      }
+      uint8_t type = ((pdu[0] & 0x3) << 2) + (pdu[1] >> 6);
+      switch (type) {
+        case PDU_CC:
+          connected = true;
+          for (uint8_t i = 2; i + 2 <= len; i += 2 + pdu[i + 1]) {
+            if (pdu[i] == 0x05 && pdu[i + 1] == 1) kioskRW = pdu[i + 2] & 0x0F;
+          }
+          break;
+        case PDU_I:
+          if (len < 3 || (pdu[2] >> 4) != nr) {
+            errors++;
+            return;
+          }
+          va = pdu[2] & 0x0F;
+          for (uint8_t i = 3; i < len; i++) {
+            if (pdu[i] != (uint8_t)(received + i - 3)) errors++;
+          }
+          received += len - 3;
+          nr = (nr + 1) & 0x0F;
+          needAck = true;
+          break;
+        case PDU_RR:
+          if (len >= 3) va = pdu[2] & 0x0F;
+          break;
+        case PDU_DM:
+          done = true;
+          break;
+        case PDU_SYMM:
+          break;
+        default:
+          errors++;
+      }
+    }
+};
+
+static int failures = 0;
+
+static void run(bool phoneSends, uint16_t total, uint8_t fragment) {
+  scriptedPhone phone(phoneSends, total, fragment);
+  LLCP llcp(phone);
+
+  bool ok = llcp.activate() > 0 && llcp.waitForConnection() > 0;
+  uint64_t start = hostNanos();
+  uint32_t commands = phone.commands;
+
+  uint16_t moved = 0;
+  uint8_t buf[255];
+  while (ok && moved < total) {
+    if (phoneSends) {
+      int16_t n = llcp.read(buf, sizeof(buf));
+      ok = n > 0;
+      for (int16_t i = 0; ok && i < n; i++) {
+        if (buf[i] != (uint8_t)(moved + i)) ok = false;
+      }
+      moved += n > 0 ? n : 0;
+    } else {
+      uint8_t chunk = total - moved < fragment ? total - moved : fragment;
+      for (uint8_t i = 0; i < chunk; i++) buf[i] = moved + i;
+      ok = llcp.write(buf, 0, buf, chunk);
+      moved += chunk;
+    }
+  }
+  ok = ok && llcp.waitForDisconnection() > 0;
+
+  double seconds = (hostNanos() - start) / 1e9;
+  uint32_t exchanges = (phone.commands - commands) / 2;
+  ok = ok && phone.done && phone.errors == 0 && (phoneSends ? phone.sent : phone.received) == total;
+  if (!ok) {
+    printf("FAIL %s\n", phoneSends ? "phone to kiosk" : "kiosk to phone");
+    failures++;
+  }
+  printf("%-15s %5u bytes in %3u byte I PDUs: %3u exchanges, %6.0f bytes/s\n",
+         phoneSends ? "phone to kiosk" : "kiosk to phone", total, fragment, exchanges, total / seconds);
+}
+
+int main() {
+  run(true, 2048, 128);
+  run(false, 2048, 120);
+
+  if (failures) {
+    printf("%d transfers failed\n", failures);
+    return 1;
+  }
+  printf("all transfers complete\n");
+  return 0;
+}
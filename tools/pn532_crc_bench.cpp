@@ -0,0 +1,80 @@
+// pn532_crc_bench.cpp
+// Checks the constexpr CRC_A table of PN532_crc.h against the bitwise
+// computation and known frames, then times both per byte on the host.
+//
+//   g++ -O2 -Ilib/PN532 -o pn532_crc_bench tools/pn532_crc_bench.cpp && ./pn532_crc_bench
+
+#include <stdio.h>
+#include <chrono>
+#include "PN532_crc.h"
+
+// the bitwise kernel the table replaces
+static uint16_t crcBitwise(const uint8_t *data, uint8_t len, uint16_t crc = PN532_CRC_A_PRESET) {
+  for (uint8_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0x8408 : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+template<typename F>
+static double nsPerByte(F crc, const uint8_t *data, uint8_t len, uint32_t rounds) {
+  volatile uint16_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < rounds; i++) {
+    sink = sink + crc(data, len);
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / rounds / len;
+}
+
+int main() {
+  int failures = 0;
+
+  // ISO/IEC 14443-3 examples and the Ultralight READ of page 0
+  struct { uint8_t data[4]; uint8_t len; uint16_t crc; } known[] = {
+    {{0x00, 0x00}, 2, 0x1EA0},
+    {{0x12, 0x34}, 2, 0xCF26},
+    {{0x30, 0x00}, 2, 0xA802},
+  };
+  for (auto &k : known) {
+    if (pn532_crcA(k.data, k.len) != k.crc || crcBitwise(k.data, k.len) != k.crc) {
+      printf("FAIL %02X %02X: table %04X bitwise %04X expected %04X\n", k.data[0], k.data[1],
+             pn532_crcA(k.data, k.len), crcBitwise(k.data, k.len), k.crc);
+      failures++;
+    }
+  }
+
+  uint8_t frame[64];
+  uint32_t seed = 1;
+  for (uint32_t round = 0; round < 100000; round++) {
+    uint8_t len = 1 + round % sizeof(frame);
+    for (uint8_t i = 0; i < len; i++) {
+      seed = seed * 1103515245 + 12345;
+      frame[i] = seed >> 16;
+    }
+    if (pn532_crcA(frame, len) != crcBitwise(frame, len)) {
+      printf("FAIL random frame of %u bytes\n", len);
+      failures++;
+      break;
+    }
+  }
+
+  const uint8_t lengths[] = {2, 16, 58};
+  for (uint8_t len : lengths) {
+    uint32_t rounds = 20000000 / len;
+    double table = nsPerByte([](const uint8_t *d, uint8_t l) { return pn532_crcA(d, l); }, frame, len, rounds);
+    double bitwise = nsPerByte([](const uint8_t *d, uint8_t l) { return crcBitwise(d, l); }, frame, len, rounds);
+    printf("%2u byte frames: table %.2f ns/byte, bitwise %.2f ns/byte, %.1fx\n", len, table, bitwise,
+           bitwise / table);
+  }
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
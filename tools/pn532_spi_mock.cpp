@@ -0,0 +1,243 @@
+// pn532_spi_mock.cpp
+// Runs PN532_SPI against a mocked PN532 on a simulated SPI bus. Checks the
+// framing in both directions, the LSB-first bit order and the ready handshake,
+// then reports the per-command overhead in bus bytes, transactions and time.
+//
+//   g++ -Itools/host -Ilib/PN532 -Ilib/PN532_SPI -o pn532_spi_mock tools/pn532_spi_mock.cpp
+//       lib/PN532_SPI/PN532_SPI.cpp lib/PN532/PN532.cpp lib/PN532/PN532_trace.cpp tools/host/Arduino.cpp
+//   ./pn532_spi_mock
+
+#include <stdio.h>
+#include <SPI.h>
+#include "PN532.h"
+#include "PN532_SPI.h"
+
+#define SS_PIN  5
+#define IRQ_PIN 4
+
+#define OP_DATA_WRITE  1
+#define OP_STATUS_READ 2
+#define OP_DATA_READ   3
+
+static uint8_t reverse(uint8_t b) {
+  REVERSE_BITS_ORDER(b);
+  return b;
+}
+
+// Answers GetFirmwareVersion and SAMConfiguration like a PN532 v1.6, anything
+// else with an empty response. Bytes on the wire are LSB first.
+class mockPN532 : public hostSPIDevice, public hostPins {
+  public:
+    mockPN532() : selected(false), op(0), frameLen(0), outLen(0), outPos(0), readyAt(0),
+                  ackPending(false), badFrames(0), commands(0), irq(PN532_SPI_NO_IRQ) {}
+
+    // ns the chip takes to ACK a frame and to answer it
+    uint32_t ackDelay = 300000;
+    uint32_t responseDelay = 1000000;
+
+    void write(uint8_t pin, uint8_t level) {
+      if (pin == SS_PIN) select(level == LOW);
+    }
+
+    int read(uint8_t pin) {
+      if (pin != irq) return -1;
+      return isReady() ? LOW : HIGH;
+    }
+
+    void select(bool low) {
+      if (low) {
+        selected = true;
+        op = 0;
+        return;
+      }
+      selected = false;
+      if (op == OP_DATA_WRITE) {
+        receive();
+      } else if (op == OP_DATA_READ && outLen && outPos >= outLen) {
+        if (ackPending) {
+          ackPending = false;
+          queue(response, responseLen, hostNanos() + responseDelay);
+        } else {
+          outLen = 0;
+        }
+      }
+    }
+
+    uint8_t transfer(uint8_t wire) {
+      if (!selected) return 0xFF;
+      uint8_t b = reverse(wire);
+      if (!op) {
+        op = b;
+        if (op == OP_DATA_READ) outPos = 0;
+        return 0;
+      }
+      switch (op) {
+        case OP_DATA_WRITE:
+          if (frameLen < sizeof(frame)) frame[frameLen++] = b;
+          return 0;
+        case OP_STATUS_READ:
+          return reverse(isReady() ? 1 : 0);
+        case OP_DATA_READ:
+          return reverse(outPos < outLen ? out[outPos++] : 0);
+      }
+      return 0;
+    }
+
+    bool isReady() {
+      return outLen && outPos == 0 && hostNanos() >= readyAt;
+    }
+
+    bool selected;
+    uint8_t op;
+    uint8_t frame[300];
+    uint16_t frameLen;
+    uint8_t out[300];
+    uint16_t outLen;
+    uint16_t outPos;
+    uint64_t readyAt;
+    bool ackPending;
+    uint8_t response[300];
+    uint16_t responseLen;
+    uint32_t badFrames;
+    uint32_t commands;
+    uint8_t irq;
+
+  private:
+    void queue(const uint8_t *data, uint16_t len, uint64_t at) {
+      memcpy(out, data, len);
+      outLen = len;
+      outPos = 0;
+      readyAt = at;
+    }
+
+    // 00 00 FF LEN LCS D4 CMD ... DCS 00
+    void receive() {
+      uint8_t *f = frame;
+      uint16_t len = frameLen;
+      frameLen = 0;
+      if (len < 9 || f[0] != 0 || f[1] != 0 || f[2] != 0xFF || (uint8_t)(f[3] + f[4]) != 0 ||
+          len != f[3] + 7 || f[5] != PN532_HOSTTOPN532) {
+        badFrames++;
+        return;
+      }
+      uint8_t sum = 0;
+      for (uint8_t i = 0; i < f[3] + 1; i++) sum += f[5 + i];
+      if (sum != 0 || f[len - 1] != 0) {
+        badFrames++;
+        return;
+      }
+      commands++;
+
+      uint8_t command = f[6];
+      uint8_t data[8];
+      uint8_t dataLen = 0;
+      data[dataLen++] = PN532_PN532TOHOST;
+      data[dataLen++] = command + 1;
+      if (command == PN532_COMMAND_GETFIRMWAREVERSION) {
+        const uint8_t version[] = {0x32, 0x01, 0x06, 0x07};
+        memcpy(data + dataLen, version, sizeof(version));
+        dataLen += sizeof(version);
+      }
+
+      responseLen = 0;
+      response[responseLen++] = 0;
+      response[responseLen++] = 0;
+      response[responseLen++] = 0xFF;
+      response[responseLen++] = dataLen;
+      response[responseLen++] = -dataLen;
+      sum = 0;
+      for (uint8_t i = 0; i < dataLen; i++) {
+        response[responseLen++] = data[i];
+        sum += data[i];
+      }
+      response[responseLen++] = -sum;
+      response[responseLen++] = 0;
+
+      const uint8_t ack[] = {0, 0, 0xFF, 0, 0xFF, 0};
+      ackPending = true;
+      queue(ack, sizeof(ack), hostNanos() + ackDelay);
+    }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+  if (!ok) {
+    printf("FAIL %s\n", what);
+    failures++;
+  }
+}
+
+// Runs commands back to back and prints what each one costs on the bus
+static void measure(const char *name, uint8_t irq, uint32_t ackDelay, uint32_t responseDelay) {
+  mockPN532 chip;
+  chip.irq = irq;
+  chip.ackDelay = ackDelay;
+  chip.responseDelay = responseDelay;
+  SPI.setDevice(&chip);
+  hostAttachPins(&chip);
+
+  PN532_SPI bus(SPI, SS_PIN, irq);
+  PN532 nfc(bus);
+  bus.begin();
+
+  const int COMMANDS = 1000;
+  uint32_t bytes = SPI.bytes;
+  uint32_t transactions = SPI.transactions;
+  uint64_t start = hostNanos();
+  int ok = 0;
+  for (int i = 0; i < COMMANDS; i++) {
+    if (nfc.getFirmwareVersion() == 0x32010607) ok++;
+  }
+  double perCommand = (hostNanos() - start) / 1000.0 / COMMANDS;
+  double perBytes = (double)(SPI.bytes - bytes) / COMMANDS;
+  double perTransactions = (double)(SPI.transactions - transactions) / COMMANDS;
+
+  check(ok == COMMANDS, "GetFirmwareVersion answered");
+  check(chip.badFrames == 0, "frames from the host are valid");
+  check(chip.commands == COMMANDS, "every frame reached the chip");
+
+  // 9 + 6 + 13 bytes of frames, 10 bits each on a 115200 UART
+  double hsu = (9 + 6 + 13) * 10 * 1000000.0 / 115200;
+  printf("%-28s %8.1f us/command %6.1f bytes %5.1f transactions  (chip %u+%u us, HSU wire time %.0f us)\n",
+         name, perCommand, perBytes, perTransactions, ackDelay / 1000, responseDelay / 1000, hsu);
+}
+
+int main() {
+  // framing and bit order, the mock only understands frames sent LSB first
+  {
+    mockPN532 chip;
+    SPI.setDevice(&chip);
+    hostAttachPins(&chip);
+    PN532_SPI bus(SPI, SS_PIN);
+    bus.begin();
+    const uint8_t command[] = {PN532_COMMAND_SAMCONFIGURATION, 0x01, 0x14, 0x01};
+    check(bus.writeCommand(command, sizeof(command)) == 0, "SAMConfiguration ACKed");
+    uint8_t buf[16];
+    check(bus.readResponse(buf, sizeof(buf), 100) == 0, "SAMConfiguration response");
+    check(chip.commands == 1 && chip.badFrames == 0, "SAMConfiguration framing");
+    check(SPI.clock == PN532_SPI_CLOCK, "bus runs at the PN532 clock");
+    check(!SPI.inTransaction, "transaction released");
+
+    // a frame too short to hold TFI and the command must not be drained as 254 bytes
+    check(bus.writeCommand(command, sizeof(command)) == 0, "SAMConfiguration ACKed again");
+    chip.out[3] = 1;
+    chip.out[4] = 0xFF;
+    hostAdvance(chip.responseDelay);  // ready, so only the frame itself is counted
+    uint32_t bytes = SPI.bytes;
+    check(bus.readResponse(buf, sizeof(buf), 100) == PN532_INVALID_FRAME, "LEN 1 is an invalid frame");
+    check(SPI.bytes - bytes < 16, "LEN 1 frame not drained");
+  }
+
+  measure("status polling", PN532_SPI_NO_IRQ, 300000, 1000000);
+  measure("IRQ pin", IRQ_PIN, 300000, 1000000);
+  measure("status polling, fast chip", PN532_SPI_NO_IRQ, 50000, 100000);
+  measure("IRQ pin, fast chip", IRQ_PIN, 50000, 100000);
+
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,29 @@
+// pn532_trace_decode.cpp
+// Turns a binary PN532 trace dump (the payload published on
+// revend/trace/<token>, or concatenated payloads) into a transcript.
+//
+//   g++ -Ilib/PN532 -o pn532_trace_decode tools/pn532_trace_decode.cpp lib/PN532/PN532_trace.cpp
+//   mosquitto_sub -t 'revend/trace/#' -N > dump.bin && ./pn532_trace_decode < dump.bin
+
+#include <stdio.h>
+#include "PN532_trace.h"
+
+int main(int argc, char **argv) {
+  FILE *in = stdin;
+  if (argc > 1 && !(in = fopen(argv[1], "rb"))) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  PN532TraceRecord rec;
+  char line[160];
+  unsigned long count = 0;
+  while (fread(&rec, sizeof(rec), 1, in) == 1) {
+    PN532Trace::format(&rec, line, sizeof(line));
+    puts(line);
+    count++;
+  }
+
+  fprintf(stderr, "%lu records\n", count);
+  return 0;
+}
@@ -0,0 +1,162 @@
+// scheduler_bench.cpp
+// Runs hundreds of periodic and one-shot timers through millisScheduler over
+// ten minutes of simulated time. Checks every timer fired on its exact deadlines
+// and never drifted, then compares the host CPU cost of a millisecond tick
+// with polling the same timers as millisDelay instances. Last, checks that one
+// run() also calls timers restarted by a callback and catches up a late period.
+//
+//   g++ -O2 -DMILLIS_SCHEDULER_SIZE=1024 -Itools/host -Ilib/millisDelay -o scheduler_bench tools/scheduler_bench.cpp
+//       lib/millisDelay/millisScheduler.cpp lib/millisDelay/millisDelay.cpp tools/host/Arduino.cpp
+//   ./scheduler_bench
+
+#include <stdio.h>
+#include <chrono>
+#include <Arduino.h>
+#include <millisDelay.h>
+#include <millisScheduler.h>
+
+#define SIM_MS 600000UL
+
+static millisScheduler scheduler;
+static uint32_t fired[MILLIS_SCHEDULER_SIZE];
+static unsigned long period[MILLIS_SCHEDULER_SIZE];
+static unsigned long lastFire[MILLIS_SCHEDULER_SIZE];
+static uint32_t late = 0;
+
+// callbacks carry no argument, so one trampoline per timer is generated
+template<int16_t ID> static void onTimer() {
+  unsigned long now = millis();
+  if (lastFire[ID] && now - lastFire[ID] != period[ID]) late++;
+  lastFire[ID] = now;
+  fired[ID]++;
+}
+
+// split in halves, so the template depth stays log2 of the count
+template<int16_t FIRST, int16_t COUNT> struct trampolines {
+  static void fill(millisCallback *table) {
+    trampolines<FIRST, COUNT / 2>::fill(table);
+    trampolines<FIRST + COUNT / 2, COUNT - COUNT / 2>::fill(table);
+  }
+};
+
+template<int16_t FIRST> struct trampolines<FIRST, 1> {
+  static void fill(millisCallback *table) {
+    table[FIRST] = onTimer<FIRST>;
+  }
+};
+
+template<int16_t FIRST> struct trampolines<FIRST, 0> {
+  static void fill(millisCallback *) {}
+};
+
+static uint32_t oneShots = 0;
+static int16_t oneShotTimer;
+
+static void onOneShot() {
+  oneShots++;
+  scheduler.start(oneShotTimer, 1 + oneShots % 97);  // restarted from its own callback
+}
+
+static double runScheduler(uint16_t count, uint32_t *expected) {
+  static millisCallback table[MILLIS_SCHEDULER_SIZE];
+  trampolines<0, MILLIS_SCHEDULER_SIZE>::fill(table);
+
+  uint32_t seed = 7;
+  for (uint16_t i = 0; i < count; i++) {
+    seed = seed * 1103515245 + 12345;
+    period[i] = 5 + (seed >> 16) % 5000;
+    int16_t id = scheduler.add(table[i], period[i]);
+    if (id != i) {
+      printf("FAIL add() returned %d for timer %u\n", id, i);
+      return -1;
+    }
+    scheduler.start(id, period[i]);
+  }
+  oneShotTimer = scheduler.add(onOneShot);
+  scheduler.start(oneShotTimer, 1);
+
+  *expected = 0;
+  for (uint16_t i = 0; i < count; i++) *expected += SIM_MS / period[i];
+
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long ms = 0; ms < SIM_MS; ms++) {
+    delay(1);
+    scheduler.run();
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / SIM_MS;
+}
+
+static double runPolling(uint16_t count) {
+  static millisDelay delays[MILLIS_SCHEDULER_SIZE];
+  for (uint16_t i = 0; i < count; i++) delays[i].start(period[i]);
+
+  uint32_t calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long ms = 0; ms < SIM_MS; ms++) {
+    delay(1);
+    for (uint16_t i = 0; i < count; i++) {
+      if (delays[i].justFinished()) {
+        delays[i].repeat();
+        calls++;
+      }
+    }
+  }
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  if (calls == 0) printf("no polling calls\n");
+  return elapsed.count() / SIM_MS;
+}
+
+// what a single run() covers, as millisScheduler.h documents it
+static millisScheduler passScheduler;
+static int16_t chainTimer;
+static uint32_t chained = 0;
+static uint32_t behind = 0;
+
+static void onChain() {
+  if (++chained == 1) passScheduler.start(chainTimer, 0);
+}
+
+static void onBehind() {
+  behind++;
+}
+
+static bool checkPass() {
+  chainTimer = passScheduler.add(onChain);
+  int16_t behindTimer = passScheduler.add(onBehind, 10);
+  passScheduler.start(chainTimer, 0);
+  passScheduler.start(behindTimer, 10);
+  delay(35);
+  passScheduler.run();
+  printf("one run(): a one-shot restarted with delay 0 called %u times, a 10 ms timer 35 ms late %u times\n",
+         chained, behind);
+  return chained == 2 && behind == 3;
+}
+
+int main() {
+  const uint16_t count = MILLIS_SCHEDULER_SIZE - 1;
+  uint32_t expected;
+  double scheduled = runScheduler(count, &expected);
+  if (scheduled < 0) return 1;
+
+  uint32_t total = 0;
+  for (uint16_t i = 0; i < count; i++) total += fired[i];
+
+  // the idle gap a task could block for, with a single far timer left
+  for (uint16_t i = 0; i < count; i++) scheduler.stop(i);
+  scheduler.stop(oneShotTimer);
+  scheduler.start(0, 1234);
+  unsigned long idle = scheduler.nextDeadline();
+
+  double polled = runPolling(count);
+
+  printf("%u periodic timers + 1 one-shot over %lu s: %u callbacks, %u expected, %u off schedule, %u one-shots\n",
+         count, SIM_MS / 1000, total, expected, late, oneShots);
+  printf("per 1 ms tick: scheduler %.0f ns, polling millisDelay %.0f ns\n", scheduled, polled);
+
+  bool pass = checkPass();
+
+  bool ok = total == expected && late == 0 && idle == 1234 && oneShots > 0 && pass;
+  printf(ok ? "all checks passed\n" : "FAIL\n");
+  return ok ? 0 : 1;
+}
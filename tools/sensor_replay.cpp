@@ -0,0 +1,493 @@
+// sensor_replay.cpp
+// Replays sensor frames through sensorFilter and the item classifier the way
+// readSensor() in main.cpp does, and reports what was decided and how fast.
+//
+// With a dump of the blocks published on revend/sensor_trace/<token> it
+// decodes them and prints each decision. A labels file, one of can, other or
+// foil per line in insertion order, adds the accuracy:
+//
+//   g++ -O2 -Ilib/sensorFilter -Ilib/itemClassifier -Ilib/sensorTrace -Ilib/sensorSampler -Ilib/eventRing
+//       -o sensor_replay tools/sensor_replay.cpp lib/sensorFilter/sensorFilter.cpp
+//       lib/itemClassifier/itemClassifier.cpp lib/sensorTrace/sensorTrace.cpp
+//   mosquitto_sub -t 'revend/sensor_trace/#' -N > session.bin
+//   ./sensor_replay session.bin labels.txt
+//
+// Without arguments it generates a labelled session with sensor noise,
+// spikes and a drifting idle level, sends it through sensorTrace and back,
+// and compares the decisions with the fixed IR 1200 / metal 500 thresholds
+// and 20 frame dwell used before sensorFilter.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "sensorFilter.h"
+#include "itemClassifier.h"
+#include "sensorTrace.h"
+
+// keep in line with main.cpp
+#define CLASSIFY_FRAMES 30
+#define PARTIAL_WINDOWS 4
+#define RAW_IR_THRESHOLD 1200
+#define RAW_METAL_THRESHOLD 500
+#define RAW_DWELL_FRAMES 20
+
+// one frame per ms, as sensorSampler delivers them
+#define FRAME_MS 1.0
+
+struct decision {
+  uint32_t index;      // frame it was made on
+  uint32_t appeared;   // frame the object was first seen on
+  itemClass result;
+};
+
+/**************
+  readSensor() without the gate: wait for the chute to clear, collect
+  CLASSIFY_FRAMES of features once an object is present, classify, and look
+  again over the next window while the result is MATERIAL_PARTIAL, up to
+  PARTIAL_WINDOWS windows before the item is rejected.
+****************************************************************************************/
+class filteredIntake {
+  public:
+    filteredIntake(const sensorCalibration &calibration) : stage(DECIDED), appeared(0), partials(0) {
+      filter.setCalibration(calibration);
+    }
+
+    // sensing started again, an item already in the chute is not counted
+    void restart() {
+      stage = DECIDED;
+      features.reset();
+    }
+
+    bool frame(const sensorFrame &frame, decision *out) {
+      filter.update(frame.ir, frame.metal);
+      bool present = filter.objectPresent();
+      switch (stage) {
+        case EMPTY:
+          if (!present) return false;
+          stage = CLASSIFYING;
+          appeared = frame.index;
+          partials = 0;
+          features.reset();
+          break;
+        case CLASSIFYING:
+          if (present) break;
+          stage = EMPTY;
+          return false;
+        case DECIDED:
+          if (!present) stage = EMPTY;
+          return false;
+      }
+
+      features.add(filter);
+      if (features.frames() < CLASSIFY_FRAMES) return false;
+      itemClass result = classifier.classify(features.features());
+      features.reset();
+      if (result.material == MATERIAL_PARTIAL && ++partials >= PARTIAL_WINDOWS) {
+        result.material = MATERIAL_OTHER;
+      }
+      if (result.material == MATERIAL_PARTIAL) return false;
+
+      stage = DECIDED;
+      out->index = frame.index;
+      out->appeared = appeared;
+      out->result = result;
+      return true;
+    }
+
+  private:
+    enum { EMPTY, CLASSIFYING, DECIDED } stage;
+    sensorFilter filter;
+    itemFeatureExtractor features;
+    treeClassifier classifier;
+    uint32_t appeared;
+    uint8_t partials;
+};
+
+// readSensor() before sensorFilter: raw thresholds, whichever state is seen RAW_DWELL_FRAMES times first
+class rawIntake {
+  public:
+    rawIntake() : success(0), failed(0), isSet(false), appeared(0) {}
+
+    void restart() {
+      success = 0;
+      failed = 0;
+      isSet = false;
+    }
+
+    bool frame(const sensorFrame &frame, decision *out) {
+      bool hasObject = frame.ir < RAW_IR_THRESHOLD;
+      bool isMetal = frame.metal < RAW_METAL_THRESHOLD;
+      if (!hasObject) {
+        restart();
+        return false;
+      }
+      if (success == 0 && failed == 0 && !isSet) appeared = frame.index;
+      if (isSet) return false;
+      uint16_t &count = isMetal ? success : failed;
+      if (count < RAW_DWELL_FRAMES) {
+        count++;
+        return false;
+      }
+      isSet = true;
+      out->index = frame.index;
+      out->appeared = appeared;
+      out->result.material = isMetal ? MATERIAL_CAN : MATERIAL_OTHER;
+      out->result.confidence = 100;
+      return true;
+    }
+
+  private:
+    uint16_t success;
+    uint16_t failed;
+    bool isSet;
+    uint32_t appeared;
+};
+
+// frames decoded from concatenated blocks as sent, false if a block is malformed
+static bool decodeDump(const std::vector<uint8_t> &dump, std::vector<sensorFrame> &frames, uint32_t *blocks) {
+  const size_t header = offsetof(sensorTraceBlock, data);
+  static sensorFrame decoded[SENSOR_TRACE_DATA];
+  *blocks = 0;
+  size_t at = 0;
+  while (at + header <= dump.size()) {
+    sensorTraceBlock block;
+    memcpy(&block, &dump[at], header);
+    size_t size = header + block.length;
+    uint16_t n = sensorTrace::decode(&dump[at], dump.size() - at, decoded, SENSOR_TRACE_DATA);
+    if (n == 0 || n != block.count) return false;
+    frames.insert(frames.end(), decoded, decoded + n);
+    at += size;
+    (*blocks)++;
+  }
+  return at == dump.size();
+}
+
+// runs an intake over the frames, a gap in the frame indices is a new sensing period
+template <typename I>
+static std::vector<decision> replay(I &intake, const std::vector<sensorFrame> &frames) {
+  std::vector<decision> decisions;
+  for (size_t i = 0; i < frames.size(); i++) {
+    if (i > 0 && frames[i].index != frames[i - 1].index + 1) intake.restart();
+    decision d;
+    if (intake.frame(frames[i], &d)) decisions.push_back(d);
+  }
+  return decisions;
+}
+
+// accepted means the gate opens, the only thing the user sees
+static bool accepted(const decision &d) {
+  return d.result.material == MATERIAL_CAN;
+}
+
+static itemMaterial parseMaterial(const char *name) {
+  if (!strcmp(name, "can")) return MATERIAL_CAN;
+  if (!strcmp(name, "other")) return MATERIAL_OTHER;
+  if (!strcmp(name, "foil")) return MATERIAL_FOIL;
+  return MATERIAL_UNKNOWN;
+}
+
+static int replayFile(const char *dumpPath, const char *labelsPath) {
+  FILE *in = fopen(dumpPath, "rb");
+  if (!in) {
+    perror(dumpPath);
+    return 1;
+  }
+  std::vector<uint8_t> dump;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0) dump.insert(dump.end(), buf, buf + n);
+  fclose(in);
+
+  std::vector<sensorFrame> frames;
+  uint32_t blocks;
+  if (!decodeDump(dump, frames, &blocks)) {
+    printf("FAIL malformed block after %u blocks\n", blocks);
+    return 1;
+  }
+
+  std::vector<itemMaterial> labels;
+  if (labelsPath) {
+    FILE *lf = fopen(labelsPath, "r");
+    if (!lf) {
+      perror(labelsPath);
+      return 1;
+    }
+    char line[32];
+    while (fgets(line, sizeof(line), lf)) {
+      line[strcspn(line, "\r\n ")] = 0;
+      if (line[0]) labels.push_back(parseMaterial(line));
+    }
+    fclose(lf);
+  }
+
+  sensorCalibration calibration = sensorFilter().calibration();
+  filteredIntake intake(calibration);
+  std::vector<decision> decisions = replay(intake, frames);
+
+  uint32_t right = 0;
+  double latencySum = 0;
+  double latencyMax = 0;
+  for (size_t i = 0; i < decisions.size(); i++) {
+    const decision &d = decisions[i];
+    double latency = (d.index - d.appeared) * FRAME_MS;
+    latencySum += latency;
+    if (latency > latencyMax) latencyMax = latency;
+    printf("%10.3f s  %-7s %3u%%  %4.0f ms after it appeared", d.index * FRAME_MS / 1000,
+           itemMaterialName(d.result.material), d.result.confidence, latency);
+    if (i < labels.size()) {
+      bool ok = accepted(d) == (labels[i] == MATERIAL_CAN);
+      right += ok;
+      printf("  labelled %s%s", itemMaterialName(labels[i]), ok ? "" : "  WRONG");
+    }
+    printf("\n");
+  }
+  printf("%zu frames in %u blocks, %zu decisions, latency mean %.0f ms max %.0f ms\n", frames.size(), blocks,
+         decisions.size(), decisions.empty() ? 0 : latencySum / decisions.size(), latencyMax);
+  if (!labels.empty()) {
+    printf("accept/reject right for %u of %zu labelled items%s\n", right, labels.size(),
+           decisions.size() != labels.size() ? ", decision and label counts differ" : "");
+  }
+  return 0;
+}
+
+// synthetic session
+
+enum itemKind {
+  KIND_CAN,
+  KIND_BOTTLE,
+  KIND_FOIL,
+  KIND_SHALLOW,   // a small item that only covers part of the IR beam
+  KIND_SLOW_CAN,  // a can pushed in slowly
+  KIND_COUNT,
+};
+
+struct kindProfile {
+  const char *name;
+  bool isCan;
+  uint16_t ir;           // level once fully inserted, with the idle level at 2000
+  uint16_t metal;        // with the idle level at 900
+  uint16_t rise;         // frames to get there
+  uint16_t metalFrames;  // 0 if the metal level is held, else how long it is seen in passing
+};
+
+static const kindProfile profiles[KIND_COUNT] = {
+  {"can", true, 350, 150, 20, 0},
+  {"bottle", false, 450, 900, 25, 0},
+  {"foil", false, 600, 350, 20, 8},
+  {"shallow", false, 1100, 900, 20, 0},
+  {"slow can", true, 350, 150, 150, 0},
+};
+
+struct insertion {
+  itemKind kind;
+  uint32_t start;  // first frame of the drop
+  uint32_t end;    // first frame after it, the next idle frame
+};
+
+static uint32_t seed = 12345;
+
+static int32_t uniform(int32_t range) {
+  seed = seed * 1103515245 + 12345;
+  return (int32_t)((seed >> 8) % (2 * range + 1)) - range;
+}
+
+// roughly normal, sd about sigma
+static int32_t noise(int32_t sigma) {
+  return (uniform(sigma) + uniform(sigma) + uniform(sigma) + uniform(sigma)) / 2;
+}
+
+static uint16_t clamp12(int32_t v) {
+  return v < 0 ? 0 : (v > 4095 ? 4095 : v);
+}
+
+#define IDLE_FRAMES 20000
+#define ITEMS_PER_KIND 20
+
+static void generate(std::vector<sensorFrame> &frames, std::vector<insertion> &items, int32_t irNoise,
+                     int32_t metalNoise) {
+  std::vector<itemKind> order;
+  for (uint8_t k = 0; k < KIND_COUNT; k++) {
+    for (uint8_t i = 0; i < ITEMS_PER_KIND; i++) order.push_back((itemKind)k);
+  }
+  for (size_t i = order.size() - 1; i > 0; i--) {
+    size_t j = (uint32_t)(uniform(1 << 20) + (1 << 20)) % (i + 1);
+    itemKind t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+  // schedule first, the idle level drifts over the whole session
+  uint32_t at = IDLE_FRAMES;
+  for (itemKind kind : order) {
+    insertion item;
+    item.kind = kind;
+    item.start = at;
+    item.end = at + profiles[kind].rise + 250 + uniform(100) + 100;
+    items.push_back(item);
+    at = item.end + 500 + uniform(200);
+  }
+  uint32_t total = at;
+
+  size_t next = 0;
+  int32_t irTarget = 0;
+  int32_t metalTarget = 0;
+  for (uint32_t index = 0; index < total; index++) {
+    int32_t irIdle = 2000 - 150 * (int64_t)index / total;
+    int32_t metalIdle = 900 - 40 * (int64_t)index / total;
+    int32_t ir = irIdle;
+    int32_t metal = metalIdle;
+
+    while (next < items.size() && index >= items[next].end) next++;
+    if (next < items.size() && index >= items[next].start) {
+      const insertion &item = items[next];
+      const kindProfile &p = profiles[item.kind];
+      uint32_t in = index - item.start;
+      uint32_t fall = item.end - index;  // the last 8 frames drop back to idle
+      if (in == 0) {
+        irTarget = p.ir + uniform(60);
+        metalTarget = p.metal + uniform(30);
+      }
+      int32_t irDrop = (irIdle - irTarget);
+      int32_t metalDrop = p.metal >= 900 ? 0 : (metalIdle - metalTarget);
+      int32_t scale = in < p.rise ? (int32_t)(in * 256 / p.rise) : 256;
+      if (fall < 8) scale = scale * fall / 8;
+      ir = irIdle - irDrop * scale / 256;
+      if (p.metalFrames == 0) {
+        metal = metalIdle - metalDrop * scale / 256;
+      } else if (in >= p.rise && in < p.rise + p.metalFrames) {
+        metal = metalIdle - metalDrop;
+      } else {
+        metal = metalIdle - 50 * scale / 256;
+      }
+    }
+
+    ir += noise(irNoise);
+    metal += noise(metalNoise);
+    if (uniform(150) == 0) ir -= 1500;    // a dark spike
+    if (uniform(150) == 0) metal -= 700;
+    sensorFrame frame = {index, clamp12(ir), clamp12(metal)};
+    frames.push_back(frame);
+  }
+}
+
+struct score {
+  uint32_t right[KIND_COUNT];
+  uint32_t decided[KIND_COUNT];
+  uint32_t spurious;   // decisions with no item in front of the sensors, or a second one for the same item
+  double latencySum;   // from the start of the insertion
+  double latencyMax;
+  uint32_t latencyCount;
+};
+
+static score evaluate(const std::vector<decision> &decisions, const std::vector<insertion> &items) {
+  score s;
+  memset(&s, 0, sizeof(s));
+  size_t i = 0;
+  std::vector<bool> seen(items.size(), false);
+  for (const decision &d : decisions) {
+    while (i < items.size() && d.index >= items[i].end) i++;
+    if (i >= items.size() || d.index < items[i].start || seen[i]) {
+      s.spurious++;
+      continue;
+    }
+    seen[i] = true;
+    const insertion &item = items[i];
+    s.decided[item.kind]++;
+    if (accepted(d) == profiles[item.kind].isCan) s.right[item.kind]++;
+    double latency = (d.index - item.start) * FRAME_MS;
+    s.latencySum += latency;
+    if (latency > s.latencyMax) s.latencyMax = latency;
+    s.latencyCount++;
+  }
+  return s;
+}
+
+static void report(const char *name, const score &s) {
+  uint32_t right = 0;
+  printf("%-22s", name);
+  for (uint8_t k = 0; k < KIND_COUNT; k++) {
+    printf(" %5u/%-2u", s.right[k], s.decided[k]);
+    right += s.right[k];
+  }
+  printf(" %6u/%-3u %8u %6.0f / %-4.0f\n", right, KIND_COUNT * ITEMS_PER_KIND, s.spurious,
+         s.latencyCount ? s.latencySum / s.latencyCount : 0, s.latencyMax);
+}
+
+static int failures = 0;
+
+static void synthetic(const char *name, int32_t irNoise, int32_t metalNoise) {
+  std::vector<sensorFrame> frames;
+  std::vector<insertion> items;
+  generate(frames, items, irNoise, metalNoise);
+
+  // through the recorder and back, as the frames would arrive from a device
+  sensorTrace recorder;
+  std::vector<uint8_t> dump;
+  sensorTraceBlock block;
+  for (const sensorFrame &frame : frames) {
+    recorder.record(frame);
+    while (recorder.pop(&block)) {
+      const uint8_t *bytes = (const uint8_t *)&block;
+      dump.insert(dump.end(), bytes, bytes + sensorTrace::size(block));
+    }
+  }
+  recorder.flush();
+  while (recorder.pop(&block)) {
+    const uint8_t *bytes = (const uint8_t *)&block;
+    dump.insert(dump.end(), bytes, bytes + sensorTrace::size(block));
+  }
+
+  std::vector<sensorFrame> decoded;
+  uint32_t blocks;
+  bool same = decodeDump(dump, decoded, &blocks) && decoded.size() == frames.size() && recorder.dropped() == 0;
+  for (size_t i = 0; same && i < frames.size(); i++) {
+    same = decoded[i].index == frames[i].index && decoded[i].ir == frames[i].ir &&
+           decoded[i].metal == frames[i].metal;
+  }
+  if (!same) {
+    printf("FAIL frames differ after encoding and decoding\n");
+    failures++;
+  }
+  printf("%s session, noise sd IR %d metal %d: %zu insertions after %u idle frames, %zu frames in %u blocks of "
+         "%zu bytes, %s\n", name, irNoise, metalNoise, items.size(), IDLE_FRAMES, frames.size(), blocks, dump.size(),
+         same ? "decoded back identical" : "decoded back different");
+
+  filteredIntake filtered(sensorFilter().calibration());
+  rawIntake raw;
+  score now = evaluate(replay(filtered, decoded), items);
+  score before = evaluate(replay(raw, decoded), items);
+
+  printf("accept/reject right / decided per kind of item, %u of each\n", ITEMS_PER_KIND);
+  printf("%-22s", "");
+  for (uint8_t k = 0; k < KIND_COUNT; k++) printf(" %8s", profiles[k].name);
+  printf(" %10s %8s %s\n", "total", "spurious", "latency mean / max ms");
+  report("filter + tree", now);
+  report("raw 1200/500, dwell 20", before);
+
+  // spikes and noise alone must never make a decision, and every item ends in the right one
+  if (now.spurious > 0) {
+    printf("FAIL %u decisions without an item\n", now.spurious);
+    failures++;
+  }
+  for (uint8_t k = 0; k < KIND_COUNT; k++) {
+    if (now.right[k] != ITEMS_PER_KIND) {
+      printf("FAIL %u %s items decided wrong or never\n", ITEMS_PER_KIND - now.right[k], profiles[k].name);
+      failures++;
+    }
+  }
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1) {
+    return replayFile(argv[1], argc > 2 ? argv[2] : 0);
+  }
+  synthetic("quiet", 30, 15);
+  synthetic("noisy", 120, 60);
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}